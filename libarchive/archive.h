@@ -350,6 +350,7 @@ typedef const char *archive_passphrase_callback(struct archive *,
 #define ARCHIVE_READ_FORMAT_CAPS_NONE (0) /* no special capabilities */
 #define ARCHIVE_READ_FORMAT_CAPS_ENCRYPT_DATA (1<<0)  /* reader can detect encrypted data */
 #define ARCHIVE_READ_FORMAT_CAPS_ENCRYPT_METADATA (1<<1)  /* reader can detect encryptable metadata (pathname, mtime, etc.) */
+#define ARCHIVE_READ_FORMAT_CAPS_SEEK_HEADER (1<<2)  /* reader can restart at a header offset, see archive_read_seek_header() */
 
 /*
  * Codes returned by archive_read_has_encrypted_entries().
@@ -539,6 +540,10 @@ __LA_DECL int archive_read_open_fd(struct archive *, int _fd,
 /* Read an archive that's already open, using a FILE *. */
 /* Note: DO NOT use this with tape drives. */
 __LA_DECL int archive_read_open_FILE(struct archive *, FILE *_file);
+/* Read an archive stored on tc storage, with batched read-ahead. */
+/* Note: the application must have called tc_init(). */
+__LA_DECL int archive_read_open_tc(struct archive *, const char *_path,
+		     size_t _block_size);
 
 /* Parses and returns next entry header. */
 __LA_DECL int archive_read_next_header(struct archive *,
@@ -554,6 +559,24 @@ __LA_DECL int archive_read_next_header2(struct archive *,
  */
 __LA_DECL la_int64_t		 archive_read_header_position(struct archive *);
 
+/*
+ * Position the reader at a header previously returned by
+ * archive_read_header_position(), so that the next call to
+ * archive_read_next_header() reads that entry again.  Requires
+ * ARCHIVE_READ_FORMAT_CAPS_SEEK_HEADER and a seekable input.
+ */
+__LA_DECL int	archive_read_seek_header(struct archive *, la_int64_t);
+
+/*
+ * Read-ahead statistics of a filter, numbered as for
+ * archive_filter_bytes(): bytes copied to give the format or the next
+ * filter contiguous data, and bytes it consumed without a copy.
+ */
+__LA_DECL la_int64_t	archive_read_filter_bytes_copied(struct archive *,
+			    int);
+__LA_DECL la_int64_t	archive_read_filter_bytes_passed(struct archive *,
+			    int);
+
 /*
  * Returns 1 if the archive contains at least one encrypted entry.
  * If the archive format not support encryption at all
@@ -820,6 +843,8 @@ __LA_DECL int archive_write_open_filename_w(struct archive *,
 __LA_DECL int archive_write_open_file(struct archive *, const char *_file)
 		__LA_DEPRECATED;
 __LA_DECL int archive_write_open_FILE(struct archive *, FILE *);
+/* Write to tc storage in large coalesced writes; tc_init() must be done. */
+__LA_DECL int archive_write_open_tc(struct archive *, const char *_path);
 /* _buffSize is the size of the buffer, _used refers to a variable that
  * will be updated after each write into the buffer. */
 __LA_DECL int archive_write_open_memory(struct archive *,
@@ -895,6 +920,13 @@ __LA_DECL int archive_write_set_passphrase_callback(struct archive *,
  * to pull entries out of an archive and create them on disk.
  */
 __LA_DECL struct archive	*archive_write_disk_new(void);
+/* Same, but batches the operations into tc compounds.  The caller must
+ * have initialized tc.  Returns NULL if tc I/O is not supported. */
+__LA_DECL struct archive	*archive_write_disk_tc_new(void);
+/* Send the queued tc operations once this many operations or bytes of
+ * file data are queued. */
+__LA_DECL int archive_write_disk_tc_set_batch_size(struct archive *,
+    int /* max_ops */, size_t /* max_bytes */);
 /* This file will not be overwritten. */
 __LA_DECL int archive_write_disk_set_skip_file(struct archive *,
     la_int64_t, la_int64_t);
@@ -942,6 +974,9 @@ __LA_DECL la_int64_t archive_write_disk_uid(struct archive *, const char *, la_i
  * This is still evolving and somewhat experimental.
  */
 __LA_DECL struct archive *archive_read_disk_new(void);
+/* Same, but walks tc storage with batched compounds.  The caller must
+ * have initialized tc.  Returns NULL if tc I/O is not supported. */
+__LA_DECL struct archive *archive_read_disk_tc_new(void);
 /* The names for symlink modes here correspond to an old BSD
  * command-line argument convention: -L, -P, -H */
 /* Follow all symlinks. */
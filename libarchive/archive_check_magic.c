@@ -95,6 +95,7 @@ archive_handle_type_name(unsigned m)
 	case ARCHIVE_WRITE_DISK_MAGIC:	return ("archive_write_disk");
 	case ARCHIVE_READ_DISK_MAGIC:	return ("archive_read_disk");
 	case ARCHIVE_MATCH_MAGIC:	return ("archive_match");
+	case ARCHIVE_WRITE_DISK_TC_MAGIC: return ("archive_write_disk_tc");
 	default:			return NULL;
 	}
 }
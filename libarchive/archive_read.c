@@ -55,6 +55,14 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read.c 201157 2009-12-29 05:30:2
 
 #define minimum(a, b) (a < b ? a : b)
 
+/*
+ * The copy buffer is kept this much larger than the largest request,
+ * up to COPY_BUFFER_SLACK_MAX, so that shifting the unconsumed bytes
+ * back to its start happens at most once per that many bytes consumed.
+ */
+#define COPY_BUFFER_SLACK_MAX	(1024 * 1024)
+#define copy_buffer_slack(min)	minimum(min, COPY_BUFFER_SLACK_MAX)
+
 static int	choose_filters(struct archive_read *);
 static int	choose_format(struct archive_read *);
 static struct archive_vtable *archive_read_vtable(void);
@@ -757,6 +765,60 @@ archive_read_header_position(struct archive *_a)
 	return (a->header_position);
 }
 
+/*
+ * Position the reader so that the next call to
+ * archive_read_next_header() reads the header that started at
+ * offset, as returned by archive_read_header_position().
+ */
+int
+archive_read_seek_header(struct archive *_a, int64_t offset)
+{
+	struct archive_read *a = (struct archive_read *)_a;
+	int64_t pos;
+	int r;
+
+	archive_check_magic(_a, ARCHIVE_READ_MAGIC,
+	    ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA | ARCHIVE_STATE_EOF,
+	    "archive_read_seek_header");
+
+	if ((archive_read_format_capabilities(_a)
+	    & ARCHIVE_READ_FORMAT_CAPS_SEEK_HEADER) == 0) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Format does not support seeking to a header");
+		return (ARCHIVE_FAILED);
+	}
+	if (offset < 0) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Invalid header offset");
+		return (ARCHIVE_FAILED);
+	}
+
+	/* Let the format release whatever it holds of this entry. */
+	if (a->archive.state == ARCHIVE_STATE_DATA) {
+		r = archive_read_data_skip(&a->archive);
+		if (r == ARCHIVE_FATAL) {
+			a->archive.state = ARCHIVE_STATE_FATAL;
+			return (ARCHIVE_FATAL);
+		}
+	}
+
+	pos = __archive_read_seek(a, offset, SEEK_SET);
+	if (pos == ARCHIVE_FAILED) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Input does not support seeking");
+		return (ARCHIVE_FAILED);
+	}
+	if (pos != offset) {
+		if (pos >= 0)
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "Can't seek to offset %jd", (intmax_t)offset);
+		a->archive.state = ARCHIVE_STATE_FATAL;
+		return (ARCHIVE_FATAL);
+	}
+	a->archive.state = ARCHIVE_STATE_HEADER;
+	return (ARCHIVE_OK);
+}
+
 /*
  * Returns 1 if the archive contains at least one encrypted entry.
  * If the archive format not support encryption at all
@@ -1171,6 +1233,32 @@ _archive_filter_bytes(struct archive *_a, int n)
 	return f == NULL ? -1 : f->position;
 }
 
+/*
+ * Read-ahead statistics of filter n: bytes the read-ahead layer had to
+ * copy to hand out contiguous data, and bytes handed out in place.
+ */
+int64_t
+archive_read_filter_bytes_copied(struct archive *_a, int n)
+{
+	struct archive_read_filter *f;
+
+	archive_check_magic(_a, ARCHIVE_READ_MAGIC,
+	    ARCHIVE_STATE_ANY, "archive_read_filter_bytes_copied");
+	f = get_filter(_a, n);
+	return f == NULL ? -1 : f->bytes_copied;
+}
+
+int64_t
+archive_read_filter_bytes_passed(struct archive *_a, int n)
+{
+	struct archive_read_filter *f;
+
+	archive_check_magic(_a, ARCHIVE_READ_MAGIC,
+	    ARCHIVE_STATE_ANY, "archive_read_filter_bytes_passed");
+	f = get_filter(_a, n);
+	return f == NULL ? -1 : f->bytes_passed;
+}
+
 /*
  * Used internally by read format handlers to register their bid and
  * initialization functions.
@@ -1308,7 +1396,7 @@ __archive_read_filter_ahead(struct archive_read_filter *filter,
     size_t min, ssize_t *avail)
 {
 	ssize_t bytes_read;
-	size_t tocopy;
+	size_t tocopy, want;
 
 	if (filter->fatal) {
 		if (avail)
@@ -1316,6 +1404,11 @@ __archive_read_filter_ahead(struct archive_read_filter *filter,
 		return (NULL);
 	}
 
+	/* The copy buffer size to use if this request must be copied. */
+	want = min + copy_buffer_slack(min);
+	if (want < min)
+		want = min;
+
 	/*
 	 * Keep pulling more data until we can satisfy the request.
 	 */
@@ -1351,12 +1444,17 @@ __archive_read_filter_ahead(struct archive_read_filter *filter,
 			return (filter->client_next);
 		}
 
-		/* Move data forward in copy buffer if necessary. */
+		/*
+		 * Move data forward in copy buffer if necessary.  If the
+		 * buffer is to be enlarged, that moves the data instead.
+		 */
 		if (filter->next > filter->buffer &&
+		    filter->buffer_size >= want &&
 		    filter->next + min > filter->buffer + filter->buffer_size) {
 			if (filter->avail > 0)
 				memmove(filter->buffer, filter->next,
 				    filter->avail);
+			filter->bytes_copied += filter->avail;
 			filter->next = filter->buffer;
 		}
 
@@ -1409,15 +1507,15 @@ __archive_read_filter_ahead(struct archive_read_filter *filter,
 			 */
 
 			/* Ensure the buffer is big enough. */
-			if (min > filter->buffer_size) {
+			if (want > filter->buffer_size) {
 				size_t s, t;
 				char *p;
 
 				/* Double the buffer; watch for overflow. */
 				s = t = filter->buffer_size;
 				if (s == 0)
-					s = min;
-				while (s < min) {
+					s = t = want;
+				while (s < want) {
 					t *= 2;
 					if (t <= s) { /* Integer overflow! */
 						archive_set_error(
@@ -1432,7 +1530,7 @@ __archive_read_filter_ahead(struct archive_read_filter *filter,
 					}
 					s = t;
 				}
-				/* Now s >= min, so allocate a new buffer. */
+				/* Now s >= want, so allocate a new buffer. */
 				p = (char *)malloc(s);
 				if (p == NULL) {
 					archive_set_error(
@@ -1447,6 +1545,7 @@ __archive_read_filter_ahead(struct archive_read_filter *filter,
 				/* Move data into newly-enlarged buffer. */
 				if (filter->avail > 0)
 					memmove(p, filter->next, filter->avail);
+				filter->bytes_copied += filter->avail;
 				free(filter->buffer);
 				filter->next = filter->buffer = p;
 				filter->buffer_size = s;
@@ -1465,6 +1564,7 @@ __archive_read_filter_ahead(struct archive_read_filter *filter,
 
 			memcpy(filter->next + filter->avail,
 			    filter->client_next, tocopy);
+			filter->bytes_copied += tocopy;
 			/* Remove this data from client buffer. */
 			filter->client_next += tocopy;
 			filter->client_avail -= tocopy;
@@ -1540,6 +1640,7 @@ advance_file_pointer(struct archive_read_filter *filter, int64_t request)
 		filter->client_avail -= min;
 		request -= min;
 		filter->position += min;
+		filter->bytes_passed += min;
 		total_bytes_skipped += min;
 	}
 	if (request == 0)
@@ -1606,19 +1707,16 @@ __archive_read_seek(struct archive_read *a, int64_t offset, int whence)
 	return __archive_read_filter_seek(a->filter, offset, whence);
 }
 
-int64_t
-__archive_read_filter_seek(struct archive_read_filter *filter, int64_t offset,
-    int whence)
+/*
+ * Seek the client, which may span several data nodes.
+ */
+static int64_t
+client_seek(struct archive_read_filter *filter, int64_t offset, int whence)
 {
 	struct archive_read_client *client;
 	int64_t r;
 	unsigned int cursor;
 
-	if (filter->closed || filter->fatal)
-		return (ARCHIVE_FATAL);
-	if (filter->seek == NULL)
-		return (ARCHIVE_FAILED);
-
 	client = &(filter->archive->client);
 	switch (whence) {
 	case SEEK_CUR:
@@ -1707,7 +1805,30 @@ __archive_read_filter_seek(struct archive_read_filter *filter, int64_t offset,
 	default:
 		return (ARCHIVE_FATAL);
 	}
-	r += client->dataset[cursor].begin_position;
+	return (r + client->dataset[cursor].begin_position);
+}
+
+int64_t
+__archive_read_filter_seek(struct archive_read_filter *filter, int64_t offset,
+    int whence)
+{
+	int64_t r;
+
+	if (filter->closed || filter->fatal)
+		return (ARCHIVE_FATAL);
+	if (filter->seek == NULL)
+		return (ARCHIVE_FAILED);
+
+	if (filter->upstream == NULL)
+		r = client_seek(filter, offset, whence);
+	else {
+		/* Decompression filters only see absolute positions. */
+		if (whence == SEEK_CUR) {
+			offset += filter->position;
+			whence = SEEK_SET;
+		}
+		r = (filter->seek)(filter, offset, whence);
+	}
 
 	if (r >= 0) {
 		/*
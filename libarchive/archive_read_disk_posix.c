@@ -489,6 +489,9 @@ _archive_read_free(struct archive *_a)
 	else
 		r = ARCHIVE_OK;
 
+#ifdef HAVE_TC_API_H
+	__archive_read_disk_tc_free(a);
+#endif
 	tree_free(a->tree);
 	if (a->cleanup_gname != NULL && a->lookup_gname_data != NULL)
 		(a->cleanup_gname)(a->lookup_gname_data);
@@ -513,6 +516,10 @@ _archive_read_close(struct archive *_a)
 	if (a->archive.state != ARCHIVE_STATE_FATAL)
 		a->archive.state = ARCHIVE_STATE_CLOSED;
 
+#ifdef HAVE_TC_API_H
+	if (a->tc_tree != NULL)
+		__archive_read_disk_tc_close(a);
+#endif
 	tree_close(a->tree);
 
 	return (ARCHIVE_OK);
@@ -722,6 +729,11 @@ _archive_read_data_block(struct archive *_a, const void **buff,
 	archive_check_magic(_a, ARCHIVE_READ_DISK_MAGIC, ARCHIVE_STATE_DATA,
 	    "archive_read_data_block");
 
+#ifdef HAVE_TC_API_H
+	if (a->tc_tree != NULL)
+		return (__archive_read_disk_tc_data_block(a, buff, size,
+		    offset));
+#endif
 	if (t->entry_eof || t->entry_remaining_bytes <= 0) {
 		r = ARCHIVE_EOF;
 		goto abort_read_data;
@@ -1119,6 +1131,10 @@ _archive_read_next_header2(struct archive *_a, struct archive_entry *entry)
 	    ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA,
 	    "archive_read_next_header2");
 
+#ifdef HAVE_TC_API_H
+	if (a->tc_tree != NULL)
+		return (__archive_read_disk_tc_next_header2(a, entry));
+#endif
 	t = a->tree;
 	if (t->entry_fd >= 0) {
 		close_and_restore_time(t->entry_fd, t, &t->restore_time);
@@ -1257,6 +1273,10 @@ archive_read_disk_can_descend(struct archive *_a)
 	    ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA,
 	    "archive_read_disk_can_descend");
 
+#ifdef HAVE_TC_API_H
+	if (a->tc_tree != NULL)
+		return (__archive_read_disk_tc_can_descend(a));
+#endif
 	return (t->visit_type == TREE_REGULAR && t->descend);
 }
 
@@ -1274,6 +1294,10 @@ archive_read_disk_descend(struct archive *_a)
 	    ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA,
 	    "archive_read_disk_descend");
 
+#ifdef HAVE_TC_API_H
+	if (a->tc_tree != NULL)
+		return (__archive_read_disk_tc_descend(a));
+#endif
 	if (t->visit_type != TREE_REGULAR || !t->descend)
 		return (ARCHIVE_OK);
 
@@ -1339,6 +1363,10 @@ _archive_read_disk_open(struct archive *_a, const char *pathname)
 {
 	struct archive_read_disk *a = (struct archive_read_disk *)_a;
 
+#ifdef HAVE_TC_API_H
+	if (a->tc_tree != NULL)
+		return (__archive_read_disk_tc_open(a, pathname));
+#endif
 	if (a->tree != NULL)
 		a->tree = tree_reopen(a->tree, pathname, a->restore_time);
 	else
@@ -1367,6 +1395,11 @@ archive_read_disk_current_filesystem(struct archive *_a)
 	archive_check_magic(_a, ARCHIVE_READ_DISK_MAGIC, ARCHIVE_STATE_DATA,
 	    "archive_read_disk_current_filesystem");
 
+#ifdef HAVE_TC_API_H
+	/* tc reports no device numbers. */
+	if (a->tc_tree != NULL)
+		return (0);
+#endif
 	return (a->tree->current_filesystem_id);
 }
 
@@ -1431,6 +1464,10 @@ archive_read_disk_current_filesystem_is_synthetic(struct archive *_a)
 	archive_check_magic(_a, ARCHIVE_READ_DISK_MAGIC, ARCHIVE_STATE_DATA,
 	    "archive_read_disk_current_filesystem");
 
+#ifdef HAVE_TC_API_H
+	if (a->tc_tree != NULL)
+		return (-1);
+#endif
 	return (a->tree->current_filesystem->synthetic);
 }
 
@@ -1446,6 +1483,10 @@ archive_read_disk_current_filesystem_is_remote(struct archive *_a)
 	archive_check_magic(_a, ARCHIVE_READ_DISK_MAGIC, ARCHIVE_STATE_DATA,
 	    "archive_read_disk_current_filesystem");
 
+#ifdef HAVE_TC_API_H
+	if (a->tc_tree != NULL)
+		return (-1);
+#endif
 	return (a->tree->current_filesystem->remote);
 }
 
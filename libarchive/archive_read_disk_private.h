@@ -34,6 +34,7 @@
 #define ARCHIVE_READ_DISK_PRIVATE_H_INCLUDED
 
 struct tree;
+struct tc_tree;
 struct archive_entry;
 
 struct archive_read_disk {
@@ -62,6 +63,8 @@ struct archive_read_disk {
 	int	(*open_on_current_dir)(struct tree*, const char *, int);
 	int	(*tree_current_dir_fd)(struct tree*);
 	int	(*tree_enter_working_dir)(struct tree*);
+	/* Set by archive_read_disk_tc_new() to walk tc storage instead. */
+	struct tc_tree *tc_tree;
 
 	/* Set 1 if users request to restore atime . */
 	int		 restore_time;
@@ -94,4 +97,15 @@ struct archive_read_disk {
 	void	*excluded_cb_data;
 };
 
+/* The tc walk, used in place of the tree when tc_tree is set. */
+int	__archive_read_disk_tc_open(struct archive_read_disk *, const char *);
+int	__archive_read_disk_tc_next_header2(struct archive_read_disk *,
+	    struct archive_entry *);
+int	__archive_read_disk_tc_data_block(struct archive_read_disk *,
+	    const void **, size_t *, int64_t *);
+int	__archive_read_disk_tc_can_descend(struct archive_read_disk *);
+int	__archive_read_disk_tc_descend(struct archive_read_disk *);
+void	__archive_read_disk_tc_close(struct archive_read_disk *);
+void	__archive_read_disk_tc_free(struct archive_read_disk *);
+
 #endif
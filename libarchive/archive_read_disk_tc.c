@@ -0,0 +1,887 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_TC_API_H
+#include <tc_api.h>
+#endif
+
+#include "archive.h"
+
+#ifndef HAVE_TC_API_H
+
+struct archive *
+archive_read_disk_tc_new(void)
+{
+	return (NULL);
+}
+
+#else	/* Support tc I/O */
+
+#include "archive_entry.h"
+#include "archive_private.h"
+#include "archive_rb.h"
+#include "archive_read_disk_private.h"
+
+/*
+ * archive_read_disk_tc walks a tree on tc storage, usually a remote NFS
+ * server, for an otherwise ordinary archive_read_disk object, so symlink
+ * modes, matching, metadata filters and descend decisions work as usual.
+ *
+ * Directories the client descends into are not listed one by one: when
+ * the entries already listed run out, all pending directories are listed
+ * by one tc_listdirv compound, which returns the attributes along with
+ * the names, and the link targets of the new symlinks are then read by one
+ * tc_readlinkv.  File data is read the same way: when the current file
+ * needs data, one tc_readv reads the next chunk of it together with the
+ * beginning of the regular files queued after it, which are then served
+ * from memory.  The tree is therefore visited breadth first, a batch of
+ * directories at a time.
+ *
+ * tc reports no device numbers, file flags, ACLs or extended attributes,
+ * so none of those are set in the entries, and access times are not
+ * restored.
+ */
+
+/* Directories listed by one tc_listdirv. */
+#define TC_LIST_DIRS	64
+/* Files and bytes read by one tc_readv. */
+#define TC_READ_FILES	64
+#define TC_READ_BYTES	(4 * 1024 * 1024)
+
+struct tc_entry {
+	struct tc_entry	*next;
+	char		*path;
+	struct tc_attrs	 attrs;
+	/* Target of a symlink archived as such. */
+	char		*symlink;
+	/* Set if attrs describe the target of a followed symlink. */
+	int		 followed;
+	/* Data read ahead, starting at data_offset. */
+	char		*data;
+	size_t		 data_length;
+	int64_t		 data_offset;
+	int		 data_eof;
+};
+
+struct visited_dir {
+	struct archive_rb_node	 node;
+	struct visited_dir	*next;
+	uint64_t		 fileid;
+};
+
+struct tc_tree {
+	/* Entries listed but not yet returned. */
+	struct tc_entry	*head;
+	struct tc_entry	*tail;
+	struct tc_entry	*current;
+	int		 descend;
+
+	/* Directories to list, and the path the walk started from. */
+	char		**pending;
+	int		 pending_count;
+	int		 pending_size;
+	char		*root;
+	int		 root_done;
+
+	char		 symlink_mode;
+	int64_t		 entry_offset;
+	int64_t		 entry_remaining;
+
+	/* In 'L' mode, directories entered, so symlink loops end. */
+	struct archive_rb_tree	 visited;
+	struct visited_dir	*visited_list;
+};
+
+static int
+visited_cmp_node(const struct archive_rb_node *n1,
+    const struct archive_rb_node *n2)
+{
+	const struct visited_dir *v1 = (const struct visited_dir *)n1;
+	const struct visited_dir *v2 = (const struct visited_dir *)n2;
+
+	if (v1->fileid == v2->fileid)
+		return (0);
+	return (v1->fileid < v2->fileid ? 1 : -1);
+}
+
+static int
+visited_cmp_key(const struct archive_rb_node *n, const void *key)
+{
+	const struct visited_dir *v = (const struct visited_dir *)n;
+	uint64_t fileid = *(const uint64_t *)key;
+
+	if (v->fileid == fileid)
+		return (0);
+	return (v->fileid < fileid ? 1 : -1);
+}
+
+/*
+ * Create a new archive_read_disk object that walks tc storage.
+ * tc_init() must have been called by the application.
+ */
+struct archive *
+archive_read_disk_tc_new(void)
+{
+	static const struct archive_rb_tree_ops rb_ops = {
+		visited_cmp_node, visited_cmp_key
+	};
+	struct archive_read_disk *a;
+	struct tc_tree *t;
+
+	a = (struct archive_read_disk *)archive_read_disk_new();
+	if (a == NULL)
+		return (NULL);
+	t = (struct tc_tree *)calloc(1, sizeof(*t));
+	if (t == NULL) {
+		archive_read_free(&a->archive);
+		return (NULL);
+	}
+	__archive_rb_tree_init(&t->visited, &rb_ops);
+	a->tc_tree = t;
+	return (&a->archive);
+}
+
+static void
+free_entry(struct tc_entry *e)
+{
+	if (e == NULL)
+		return;
+	free(e->path);
+	free(e->symlink);
+	free(e->data);
+	free(e);
+}
+
+static void
+free_pending(struct tc_tree *t)
+{
+	int i;
+
+	for (i = 0; i < t->pending_count; i++)
+		free(t->pending[i]);
+	t->pending_count = 0;
+}
+
+/* Drop the state of the previous walk. */
+static void
+tc_tree_reset(struct tc_tree *t)
+{
+	struct tc_entry *e;
+	struct visited_dir *v;
+
+	while ((e = t->head) != NULL) {
+		t->head = e->next;
+		free_entry(e);
+	}
+	t->tail = NULL;
+	free_entry(t->current);
+	t->current = NULL;
+	t->descend = 0;
+	free_pending(t);
+	free(t->root);
+	t->root = NULL;
+	while ((v = t->visited_list) != NULL) {
+		t->visited_list = v->next;
+		free(v);
+	}
+	__archive_rb_tree_init(&t->visited, t->visited.rbt_ops);
+}
+
+int
+__archive_read_disk_tc_open(struct archive_read_disk *a, const char *path)
+{
+	struct tc_tree *t = a->tc_tree;
+
+	tc_tree_reset(t);
+	t->root = strdup(path);
+	if (t->root == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate tar data");
+		a->archive.state = ARCHIVE_STATE_FATAL;
+		return (ARCHIVE_FATAL);
+	}
+	t->root_done = 0;
+	t->symlink_mode = a->symlink_mode;
+	a->archive.state = ARCHIVE_STATE_HEADER;
+	return (ARCHIVE_OK);
+}
+
+void
+__archive_read_disk_tc_close(struct archive_read_disk *a)
+{
+	tc_tree_reset(a->tc_tree);
+}
+
+void
+__archive_read_disk_tc_free(struct archive_read_disk *a)
+{
+	struct tc_tree *t = a->tc_tree;
+
+	if (t == NULL)
+		return;
+	tc_tree_reset(t);
+	free(t->pending);
+	free(t);
+	a->tc_tree = NULL;
+}
+
+static struct tc_entry *
+new_entry(struct archive_read_disk *a, const char *path,
+    const struct tc_attrs *attrs)
+{
+	struct tc_entry *e;
+
+	e = (struct tc_entry *)calloc(1, sizeof(*e));
+	if (e == NULL || (e->path = strdup(path)) == NULL) {
+		free(e);
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate tar data");
+		return (NULL);
+	}
+	if (attrs != NULL)
+		e->attrs = *attrs;
+	e->attrs.file = tc_file_from_path(e->path);
+	return (e);
+}
+
+struct list_state {
+	struct archive_read_disk *a;
+	struct tc_entry *head;
+	struct tc_entry *tail;
+	int failed;
+};
+
+/*
+ * Name listed entries after the directory as the client gave it, rather
+ * than however the server spells it.
+ */
+static bool
+list_entry(const struct tc_attrs *attrs, const char *dir, void *cbarg)
+{
+	struct list_state *ls = (struct list_state *)cbarg;
+	struct archive_string path;
+	const char *name;
+	struct tc_entry *e;
+
+	name = strrchr(attrs->file.path, '/');
+	name = name != NULL ? name + 1 : attrs->file.path;
+	archive_string_init(&path);
+	archive_strcpy(&path, dir);
+	if (path.length > 0 && path.s[path.length - 1] != '/')
+		archive_strappend_char(&path, '/');
+	archive_strcat(&path, name);
+	e = new_entry(ls->a, path.s, attrs);
+	archive_string_free(&path);
+	if (e == NULL) {
+		ls->failed = 1;
+		return (false);
+	}
+	if (ls->tail != NULL)
+		ls->tail->next = e;
+	else
+		ls->head = e;
+	ls->tail = e;
+	return (true);
+}
+
+/*
+ * Resolve the symlinks among freshly listed entries: in 'L' mode by
+ * fetching the attributes of their targets, and otherwise, or if the
+ * target is missing, by reading the link.  One compound each.
+ */
+static int
+resolve_symlinks(struct archive_read_disk *a, struct tc_entry *head)
+{
+	struct tc_tree *t = a->tc_tree;
+	struct tc_entry *e, **links = NULL;
+	struct tc_attrs *attrs = NULL;
+	const char **paths = NULL;
+	char **bufs = NULL;
+	size_t *sizes = NULL;
+	int i, j, n, count = 0, ret = ARCHIVE_OK;
+	tc_res res;
+
+	for (e = head; e != NULL; e = e->next)
+		if (S_ISLNK(e->attrs.mode))
+			count++;
+	if (count == 0)
+		return (ARCHIVE_OK);
+	links = (struct tc_entry **)calloc(count, sizeof(*links));
+	attrs = (struct tc_attrs *)calloc(count, sizeof(*attrs));
+	paths = (const char **)calloc(count, sizeof(*paths));
+	bufs = (char **)calloc(count, sizeof(*bufs));
+	sizes = (size_t *)calloc(count, sizeof(*sizes));
+	if (links == NULL || attrs == NULL || paths == NULL || bufs == NULL ||
+	    sizes == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate tar data");
+		ret = ARCHIVE_FATAL;
+		goto done;
+	}
+	for (n = 0, e = head; e != NULL; e = e->next)
+		if (S_ISLNK(e->attrs.mode))
+			links[n++] = e;
+
+	if (t->symlink_mode == 'L') {
+		for (i = 0; i < count; i += res.index + 1) {
+			for (n = i; n < count; n++) {
+				attrs[n].file = links[n]->attrs.file;
+				attrs[n].masks = TC_ATTRS_MASK_ALL;
+			}
+			res = tc_getattrsv(attrs + i, count - i, false);
+			if (tc_okay(res))
+				res.index = count - i;
+			else if (res.index < 0 || res.index >= count - i)
+				res.index = 0;
+			/* Targets that exist are archived in place of links. */
+			for (n = i; n < i + res.index; n++) {
+				attrs[n].file = links[n]->attrs.file;
+				links[n]->attrs = attrs[n];
+				links[n]->followed = 1;
+			}
+		}
+	}
+
+	for (i = 0, n = 0; i < count; i++) {
+		if (links[i]->followed)
+			continue;
+		/* Room for a terminator after a target of PATH_MAX. */
+		bufs[n] = (char *)malloc(PATH_MAX + 1);
+		if (bufs[n] == NULL) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "Can't allocate tar data");
+			ret = ARCHIVE_FATAL;
+			goto done;
+		}
+		sizes[n] = PATH_MAX;
+		paths[n] = links[i]->path;
+		links[n++] = links[i];
+	}
+	for (i = 0; i < n; i += res.index + 1) {
+		res = tc_readlinkv(paths + i, bufs + i, sizes + i, n - i, false);
+		if (tc_okay(res))
+			res.index = n - i;
+		else if (res.index < 0 || res.index >= n - i)
+			res.index = 0;
+		/* A link that can't be read is archived with no target. */
+		for (j = i; j < i + res.index; j++) {
+			bufs[j][sizes[j] < PATH_MAX ? sizes[j] : PATH_MAX] = '\0';
+			links[j]->symlink = bufs[j];
+			bufs[j] = NULL;
+		}
+	}
+done:
+	if (bufs != NULL)
+		for (i = 0; i < count; i++)
+			free(bufs[i]);
+	free(links);
+	free(attrs);
+	free(paths);
+	free(bufs);
+	free(sizes);
+	return (ret);
+}
+
+/* List the pending directories with one compound. */
+static int
+list_pending(struct archive_read_disk *a)
+{
+	struct tc_tree *t = a->tc_tree;
+	struct list_state ls;
+	struct tc_entry *e;
+	int count, i, r;
+	tc_res res;
+
+	count = t->pending_count;
+	if (count > TC_LIST_DIRS)
+		count = TC_LIST_DIRS;
+	memset(&ls, 0, sizeof(ls));
+	ls.a = a;
+	res = tc_listdirv((const char **)t->pending, count, TC_ATTRS_MASK_ALL,
+	    0, false, list_entry, &ls, false);
+	if (!tc_okay(res) && !ls.failed) {
+		if (res.index < 0 || res.index >= count)
+			res.index = 0;
+		archive_set_error(&a->archive, res.err_no,
+		    "%s: Couldn't visit directory", t->pending[res.index]);
+		/* The directories after the one that failed are retried. */
+		count = res.index + 1;
+		r = ARCHIVE_FAILED;
+	} else
+		r = ls.failed ? ARCHIVE_FATAL : ARCHIVE_OK;
+	for (i = 0; i < count; i++)
+		free(t->pending[i]);
+	memmove(t->pending, t->pending + count,
+	    (t->pending_count - count) * sizeof(*t->pending));
+	t->pending_count -= count;
+
+	if (r != ARCHIVE_FATAL) {
+		i = resolve_symlinks(a, ls.head);
+		if (i < r)
+			r = i;
+	}
+	if (ls.head != NULL) {
+		if (t->tail != NULL)
+			t->tail->next = ls.head;
+		else
+			t->head = ls.head;
+		t->tail = ls.tail;
+	}
+	if (r == ARCHIVE_FATAL) {
+		while ((e = t->head) != NULL) {
+			t->head = e->next;
+			free_entry(e);
+		}
+		t->tail = NULL;
+	}
+	return (r);
+}
+
+struct root_state {
+	const char *name;
+	struct tc_attrs attrs;
+	int found;
+};
+
+/* Pick the starting path out of the listing of its parent. */
+static bool
+find_root(const struct tc_attrs *attrs, const char *dir, void *cbarg)
+{
+	struct root_state *rs = (struct root_state *)cbarg;
+	const char *name;
+
+	(void)dir; /* UNUSED */
+	name = strrchr(attrs->file.path, '/');
+	name = name != NULL ? name + 1 : attrs->file.path;
+	if (strcmp(name, rs->name) != 0)
+		return (true);
+	rs->attrs = *attrs;
+	rs->found = 1;
+	return (false);
+}
+
+/*
+ * Look up the starting path.  tc has no lstat(), so in 'P' mode, where a
+ * symlink is archived as itself, it is found by listing its parent.
+ */
+static int
+stat_root(struct archive_read_disk *a, struct tc_attrs *attrs)
+{
+	struct tc_tree *t = a->tc_tree;
+	struct archive_string dir;
+	struct root_state rs;
+	const char *name, *dirs[1];
+	tc_res res;
+
+	name = strrchr(t->root, '/');
+	name = name != NULL ? name + 1 : t->root;
+	if (t->symlink_mode != 'P' || name[0] == '\0' ||
+	    strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+		memset(attrs, 0, sizeof(*attrs));
+		attrs->file = tc_file_from_path(t->root);
+		attrs->masks = TC_ATTRS_MASK_ALL;
+		res = tc_getattrsv(attrs, 1, false);
+		if (!tc_okay(res)) {
+			archive_set_error(&a->archive, res.err_no,
+			    "%s: Cannot stat", t->root);
+			return (ARCHIVE_FAILED);
+		}
+		return (ARCHIVE_OK);
+	}
+
+	archive_string_init(&dir);
+	if (name == t->root)
+		archive_strcpy(&dir, ".");
+	else if (name == t->root + 1)
+		archive_strcpy(&dir, "/");
+	else
+		archive_strncpy(&dir, t->root, name - t->root - 1);
+	memset(&rs, 0, sizeof(rs));
+	rs.name = name;
+	dirs[0] = dir.s;
+	res = tc_listdirv(dirs, 1, TC_ATTRS_MASK_ALL, 0, false, find_root,
+	    &rs, false);
+	archive_string_free(&dir);
+	if (!rs.found) {
+		archive_set_error(&a->archive,
+		    tc_okay(res) ? ENOENT : res.err_no,
+		    "%s: Cannot stat", t->root);
+		return (ARCHIVE_FAILED);
+	}
+	*attrs = rs.attrs;
+	return (ARCHIVE_OK);
+}
+
+/* Make the next entry of the walk current. */
+static int
+next_tc_entry(struct archive_read_disk *a)
+{
+	struct tc_tree *t = a->tc_tree;
+	struct tc_entry *e;
+	struct tc_attrs attrs;
+	int r;
+
+	free_entry(t->current);
+	t->current = NULL;
+	t->descend = 0;
+	if (!t->root_done) {
+		t->root_done = 1;
+		r = stat_root(a, &attrs);
+		if (r != ARCHIVE_OK)
+			return (r);
+		t->current = new_entry(a, t->root, &attrs);
+		if (t->current == NULL)
+			return (ARCHIVE_FATAL);
+		return (resolve_symlinks(a, t->current));
+	}
+	while (t->head == NULL) {
+		if (t->pending_count == 0)
+			return (ARCHIVE_EOF);
+		r = list_pending(a);
+		if (r != ARCHIVE_OK && t->head == NULL)
+			return (r);
+	}
+	e = t->head;
+	t->head = e->next;
+	if (t->head == NULL)
+		t->tail = NULL;
+	e->next = NULL;
+	t->current = e;
+	return (ARCHIVE_OK);
+}
+
+static int
+excluded(struct archive_read_disk *a, struct archive_entry *entry, int r)
+{
+	if (r < 0) {
+		archive_set_error(&(a->archive), errno,
+		    "Failed : %s", archive_error_string(a->matching));
+		return (r);
+	}
+	if (r) {
+		if (a->excluded_cb_func)
+			a->excluded_cb_func(&(a->archive),
+			    a->excluded_cb_data, entry);
+		return (ARCHIVE_RETRY);
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Fill @entry for the current entry, applying the same matching and
+ * filters, in the same order, as the POSIX walk.
+ */
+static int
+next_entry(struct archive_read_disk *a, struct archive_entry *entry)
+{
+	struct tc_tree *t = a->tc_tree;
+	struct tc_entry *e;
+	const char *name;
+	int r;
+
+	r = next_tc_entry(a);
+	if (r != ARCHIVE_OK)
+		return (r);
+	e = t->current;
+
+	archive_entry_copy_pathname(entry, e->path);
+	if (a->matching) {
+		r = excluded(a, entry,
+		    archive_match_path_excluded(a->matching, entry));
+		if (r != ARCHIVE_OK)
+			return (r);
+	}
+
+	/* Symlinks were resolved for 'L' when listed. */
+	if (t->symlink_mode == 'H')
+		t->symlink_mode = 'P';
+	t->descend = S_ISDIR(e->attrs.mode);
+
+	archive_entry_set_mode(entry, e->attrs.mode);
+	archive_entry_set_size(entry, e->attrs.size);
+	archive_entry_set_nlink(entry, e->attrs.nlink);
+	archive_entry_set_ino64(entry, e->attrs.fileid);
+	archive_entry_set_uid(entry, e->attrs.uid);
+	archive_entry_set_gid(entry, e->attrs.gid);
+	archive_entry_set_rdev(entry, e->attrs.rdev);
+	archive_entry_set_atime(entry, e->attrs.atime.tv_sec,
+	    e->attrs.atime.tv_nsec);
+	archive_entry_set_mtime(entry, e->attrs.mtime.tv_sec,
+	    e->attrs.mtime.tv_nsec);
+	archive_entry_set_ctime(entry, e->attrs.ctime.tv_sec,
+	    e->attrs.ctime.tv_nsec);
+	if (!S_ISREG(e->attrs.mode))
+		archive_entry_set_size(entry, 0);
+	if (S_ISLNK(e->attrs.mode) && e->symlink != NULL)
+		archive_entry_copy_symlink(entry, e->symlink);
+
+	if (a->matching) {
+		r = excluded(a, entry,
+		    archive_match_time_excluded(a->matching, entry));
+		if (r != ARCHIVE_OK)
+			return (r);
+	}
+
+	name = archive_read_disk_uname(&(a->archive), archive_entry_uid(entry));
+	if (name != NULL)
+		archive_entry_copy_uname(entry, name);
+	name = archive_read_disk_gname(&(a->archive), archive_entry_gid(entry));
+	if (name != NULL)
+		archive_entry_copy_gname(entry, name);
+
+	if (a->matching) {
+		r = excluded(a, entry,
+		    archive_match_owner_excluded(a->matching, entry));
+		if (r != ARCHIVE_OK)
+			return (r);
+	}
+
+	if (a->metadata_filter_func) {
+		if (!a->metadata_filter_func(&(a->archive),
+		    a->metadata_filter_data, entry))
+			return (ARCHIVE_RETRY);
+	}
+
+	archive_entry_copy_sourcepath(entry, e->path);
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_read_disk_tc_next_header2(struct archive_read_disk *a,
+    struct archive_entry *entry)
+{
+	struct tc_tree *t = a->tc_tree;
+	int r;
+
+	for (;;) {
+		r = next_entry(a, entry);
+		if (r == ARCHIVE_RETRY) {
+			archive_entry_clear(entry);
+			continue;
+		}
+		break;
+	}
+
+	switch (r) {
+	case ARCHIVE_EOF:
+		a->archive.state = ARCHIVE_STATE_EOF;
+		break;
+	case ARCHIVE_OK:
+	case ARCHIVE_WARN:
+		t->entry_offset = 0;
+		t->entry_remaining = archive_entry_filetype(entry) == AE_IFREG ?
+		    archive_entry_size(entry) : 0;
+		a->archive.state = ARCHIVE_STATE_DATA;
+		break;
+	case ARCHIVE_FAILED:
+		/* Move on past an entry or directory that failed. */
+		break;
+	case ARCHIVE_FATAL:
+		a->archive.state = ARCHIVE_STATE_FATAL;
+		break;
+	}
+
+	__archive_reset_read_data(&a->archive);
+	return (r);
+}
+
+int
+__archive_read_disk_tc_can_descend(struct archive_read_disk *a)
+{
+	struct tc_tree *t = a->tc_tree;
+
+	return (t->current != NULL && t->descend);
+}
+
+int
+__archive_read_disk_tc_descend(struct archive_read_disk *a)
+{
+	struct tc_tree *t = a->tc_tree;
+	struct tc_entry *e = t->current;
+	struct visited_dir *v;
+	char **p;
+	int size;
+
+	if (e == NULL || !t->descend)
+		return (ARCHIVE_OK);
+	t->descend = 0;
+	if (t->symlink_mode == 'L') {
+		/* Don't go around a symlink loop. */
+		if (__archive_rb_tree_find_node(&t->visited,
+		    &e->attrs.fileid) != NULL)
+			return (ARCHIVE_OK);
+		v = (struct visited_dir *)calloc(1, sizeof(*v));
+		if (v != NULL) {
+			v->fileid = e->attrs.fileid;
+			__archive_rb_tree_insert_node(&t->visited, &v->node);
+			v->next = t->visited_list;
+			t->visited_list = v;
+		}
+	}
+	if (t->pending_count == t->pending_size) {
+		size = t->pending_size < 16 ? 16 : t->pending_size * 2;
+		p = (char **)realloc(t->pending, size * sizeof(*p));
+		if (p == NULL) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "Can't allocate tar data");
+			return (ARCHIVE_FATAL);
+		}
+		t->pending = p;
+		t->pending_size = size;
+	}
+	t->pending[t->pending_count] = strdup(e->path);
+	if (t->pending[t->pending_count] == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate tar data");
+		return (ARCHIVE_FATAL);
+	}
+	t->pending_count++;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Read the next chunk of the current file along with the beginning of the
+ * regular files queued after it, up to TC_READ_BYTES in all.
+ */
+static int
+read_ahead(struct archive_read_disk *a)
+{
+	struct tc_tree *t = a->tc_tree;
+	struct tc_iovec iovs[TC_READ_FILES];
+	struct tc_entry *entries[TC_READ_FILES];
+	struct tc_entry *e;
+	size_t total = 0, length;
+	int i, count = 0, ret = ARCHIVE_OK;
+	tc_res res;
+
+	for (e = t->current; e != NULL && count < TC_READ_FILES &&
+	    total < TC_READ_BYTES; e = (e == t->current) ? t->head : e->next) {
+		if (e != t->current) {
+			if (!S_ISREG(e->attrs.mode) || e->attrs.size == 0 ||
+			    e->data != NULL)
+				continue;
+			length = e->attrs.size;
+			e->data_offset = 0;
+		} else {
+			length = (size_t)t->entry_remaining;
+			e->data_offset = t->entry_offset;
+		}
+		if (length > TC_READ_BYTES - total)
+			length = TC_READ_BYTES - total;
+		free(e->data);
+		e->data = (char *)malloc(length);
+		if (e->data == NULL) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "Couldn't allocate memory");
+			a->archive.state = ARCHIVE_STATE_FATAL;
+			ret = ARCHIVE_FATAL;
+			break;
+		}
+		memset(&iovs[count], 0, sizeof(iovs[count]));
+		iovs[count].file = e->attrs.file;
+		iovs[count].offset = e->data_offset;
+		iovs[count].length = length;
+		iovs[count].data = e->data;
+		entries[count++] = e;
+		total += length;
+	}
+
+	if (ret == ARCHIVE_OK) {
+		res = tc_readv(iovs, count, false);
+		if (!tc_okay(res)) {
+			if (res.index < 0 || res.index >= count)
+				res.index = 0;
+			if (res.index == 0) {
+				archive_set_error(&a->archive, res.err_no,
+				    "Can't read '%s'", t->current->path);
+				ret = ARCHIVE_FATAL;
+			}
+		} else
+			res.index = count;
+	}
+	for (i = 0; i < count; i++) {
+		e = entries[i];
+		if (ret != ARCHIVE_OK || i >= res.index) {
+			/* Those that failed are read again on their own. */
+			free(e->data);
+			e->data = NULL;
+			continue;
+		}
+		e->data_length = iovs[i].length;
+		e->data_eof = iovs[i].is_eof;
+	}
+	return (ret);
+}
+
+int
+__archive_read_disk_tc_data_block(struct archive_read_disk *a,
+    const void **buff, size_t *size, int64_t *offset)
+{
+	struct tc_tree *t = a->tc_tree;
+	struct tc_entry *e = t->current;
+	size_t skip;
+	int r;
+
+	*buff = NULL;
+	*size = 0;
+	*offset = t->entry_offset;
+	if (e == NULL || t->entry_remaining <= 0)
+		return (ARCHIVE_EOF);
+	if (e->data == NULL || e->data_offset > t->entry_offset ||
+	    e->data_offset + (int64_t)e->data_length <= t->entry_offset) {
+		if (e->data != NULL && e->data_eof)
+			return (ARCHIVE_EOF);
+		r = read_ahead(a);
+		if (r != ARCHIVE_OK)
+			return (r);
+		if (e->data_length == 0) {
+			/* The file shrank since it was listed. */
+			t->entry_remaining = 0;
+			return (ARCHIVE_EOF);
+		}
+	}
+	skip = (size_t)(t->entry_offset - e->data_offset);
+	*buff = e->data + skip;
+	*size = e->data_length - skip;
+	if ((int64_t)*size > t->entry_remaining)
+		*size = (size_t)t->entry_remaining;
+	t->entry_offset += *size;
+	t->entry_remaining -= *size;
+	return (ARCHIVE_OK);
+}
+
+#endif	/* Support tc I/O */
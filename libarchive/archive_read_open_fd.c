@@ -49,12 +49,17 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read_open_fd.c 201103 2009-12-28
 #endif
 
 #include "archive.h"
+#include "archive_read_prefetch_private.h"
+#include "archive_read_private.h"
 
 struct read_fd_data {
 	int	 fd;
 	size_t	 block_size;
 	char	 use_lseek;
 	void	*buffer;
+#ifdef ARCHIVE_READ_PREFETCH
+	struct archive_read_prefetch *prefetch;
+#endif
 };
 
 static int	file_close(struct archive *, void *);
@@ -96,6 +101,16 @@ archive_read_open_fd(struct archive *a, int fd, size_t block_size)
 	if (S_ISREG(st.st_mode)) {
 		archive_read_extract_set_skip_file(a, st.st_dev, st.st_ino);
 		mine->use_lseek = 1;
+#ifdef ARCHIVE_READ_PREFETCH
+		if (((struct archive_read *)a)->file_prefetch > 0) {
+			int64_t offset = lseek(fd, 0, SEEK_CUR);
+
+			if (offset >= 0)
+				mine->prefetch = __archive_read_prefetch_new(
+				    fd, offset, block_size,
+				    ((struct archive_read *)a)->file_prefetch);
+		}
+#endif
 	}
 #if defined(__CYGWIN__) || defined(_WIN32)
 	setmode(mine->fd, O_BINARY);
@@ -117,7 +132,14 @@ file_read(struct archive *a, void *client_data, const void **buff)
 
 	*buff = mine->buffer;
 	for (;;) {
-		bytes_read = read(mine->fd, mine->buffer, mine->block_size);
+#ifdef ARCHIVE_READ_PREFETCH
+		if (mine->prefetch != NULL)
+			bytes_read = __archive_read_prefetch_read(
+			    mine->prefetch, buff);
+		else
+#endif
+			bytes_read = read(mine->fd, mine->buffer,
+			    mine->block_size);
 		if (bytes_read < 0) {
 			if (errno == EINTR)
 				continue;
@@ -138,6 +160,10 @@ file_skip(struct archive *a, void *client_data, int64_t request)
 
 	if (!mine->use_lseek)
 		return (0);
+#ifdef ARCHIVE_READ_PREFETCH
+	if (mine->prefetch != NULL)
+		return (__archive_read_prefetch_skip(mine->prefetch, request));
+#endif
 
 	/* Reduce a request that would overflow the 'skip' variable. */
 	if (sizeof(request) > sizeof(skip)) {
@@ -183,7 +209,13 @@ file_seek(struct archive *a, void *client_data, int64_t request, int whence)
 
 	/* We use off_t here because lseek() is declared that way. */
 	/* See above for notes about when off_t is less than 64 bits. */
-	r = lseek(mine->fd, request, whence);
+#ifdef ARCHIVE_READ_PREFETCH
+	if (mine->prefetch != NULL)
+		r = __archive_read_prefetch_seek(mine->prefetch, request,
+		    whence);
+	else
+#endif
+		r = lseek(mine->fd, request, whence);
 	if (r >= 0)
 		return r;
 
@@ -205,6 +237,14 @@ file_close(struct archive *a, void *client_data)
 	struct read_fd_data *mine = (struct read_fd_data *)client_data;
 
 	(void)a; /* UNUSED */
+#ifdef ARCHIVE_READ_PREFETCH
+	if (mine->prefetch != NULL) {
+		/* The caller owns the fd; leave it where reading stopped. */
+		lseek(mine->fd,
+		    __archive_read_prefetch_position(mine->prefetch), SEEK_SET);
+		__archive_read_prefetch_free(mine->prefetch);
+	}
+#endif
 	free(mine->buffer);
 	free(mine);
 	return (ARCHIVE_OK);
@@ -47,6 +47,9 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read_open_filename.c 201093 2009
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -61,6 +64,8 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read_open_filename.c 201093 2009
 
 #include "archive.h"
 #include "archive_private.h"
+#include "archive_read_prefetch_private.h"
+#include "archive_read_private.h"
 #include "archive_string.h"
 
 #ifndef O_BINARY
@@ -70,12 +75,34 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read_open_filename.c 201093 2009
 #define O_CLOEXEC	0
 #endif
 
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#define USE_MMAP
+#endif
+
+/*
+ * With the "read:mmap" option, regular files are mapped a window at a
+ * time and each window is handed to libarchive as one block, without
+ * copying it.  Skips and seeks only move the read position.
+ */
+#define DEFAULT_MMAP_WINDOW	(64 * 1024 * 1024)
+
 struct read_file_data {
 	int	 fd;
 	size_t	 block_size;
 	void	*buffer;
 	mode_t	 st_mode;  /* Mode bits for opened file. */
 	char	 use_lseek;
+	char	 use_mmap;
+	/* mmap state: file size, next byte to return, current window. */
+	int64_t	 size;
+	int64_t	 position;
+	size_t	 map_window;
+	char	*map;
+	int64_t	 map_offset;
+	size_t	 map_length;
+#ifdef ARCHIVE_READ_PREFETCH
+	struct archive_read_prefetch *prefetch;
+#endif
 	enum fnt_e { FNT_STDIN, FNT_MBS, FNT_WCS } filename_type;
 	union {
 		char	 m[1];/* MBS filename. */
@@ -91,6 +118,11 @@ static ssize_t	file_read(struct archive *, void *, const void **buff);
 static int64_t	file_seek(struct archive *, void *, int64_t request, int);
 static int64_t	file_skip(struct archive *, void *, int64_t request);
 static int64_t	file_skip_lseek(struct archive *, void *, int64_t request);
+#ifdef USE_MMAP
+static ssize_t	file_read_mmap(struct archive *, struct read_file_data *,
+		    const void **buff);
+static void	file_unmap(struct read_file_data *);
+#endif
 
 int
 archive_read_open_file(struct archive *a, const char *filename,
@@ -371,6 +403,39 @@ file_open(struct archive *a, void *client_data)
 	if (is_disk_like)
 		mine->use_lseek = 1;
 
+	mine->use_mmap = 0;
+#ifdef USE_MMAP
+	/* stdin may not be at offset 0, so only named files are mapped. */
+	if (((struct archive_read *)a)->file_mmap &&
+	    mine->filename_type != FNT_STDIN &&
+	    S_ISREG(st.st_mode) && st.st_size > 0) {
+		size_t page = (size_t)sysconf(_SC_PAGESIZE);
+		size_t window = ((struct archive_read *)a)->file_mmap_window;
+
+		if (window == 0)
+			window = DEFAULT_MMAP_WINDOW;
+		mine->map_window = (window + page - 1) / page * page;
+		mine->use_mmap = 1;
+		mine->size = st.st_size;
+		mine->position = 0;
+		mine->map = NULL;
+	}
+#endif
+#ifdef ARCHIVE_READ_PREFETCH
+	/* With "read:prefetch", disk-like inputs are read ahead on a
+	 * helper thread, starting where the descriptor stands. */
+	mine->prefetch = NULL;
+	if (!mine->use_mmap && is_disk_like &&
+	    ((struct archive_read *)a)->file_prefetch > 0) {
+		int64_t offset = lseek(fd, 0, SEEK_CUR);
+
+		if (offset >= 0)
+			mine->prefetch = __archive_read_prefetch_new(fd,
+			    offset, mine->block_size,
+			    ((struct archive_read *)a)->file_prefetch);
+	}
+#endif
+
 	return (ARCHIVE_OK);
 }
 
@@ -384,9 +449,10 @@ file_read(struct archive *a, void *client_data, const void **buff)
 	 * mis-aligned, read and return a short block to try to get
 	 * us back in alignment. */
 
-	/* TODO: Someday, try mmap() here; if that succeeds, give
-	 * the entire file to libarchive as a single block.  That
-	 * could be a lot faster than block-by-block manual I/O. */
+#ifdef USE_MMAP
+	if (mine->use_mmap)
+		return (file_read_mmap(a, mine, buff));
+#endif
 
 	/* TODO: We might be able to improve performance on pipes and
 	 * sockets by setting non-blocking I/O and just accepting
@@ -395,7 +461,14 @@ file_read(struct archive *a, void *client_data, const void **buff)
 
 	*buff = mine->buffer;
 	for (;;) {
-		bytes_read = read(mine->fd, mine->buffer, mine->block_size);
+#ifdef ARCHIVE_READ_PREFETCH
+		if (mine->prefetch != NULL)
+			bytes_read = __archive_read_prefetch_read(
+			    mine->prefetch, buff);
+		else
+#endif
+			bytes_read = read(mine->fd, mine->buffer,
+			    mine->block_size);
 		if (bytes_read < 0) {
 			if (errno == EINTR)
 				continue;
@@ -413,6 +486,69 @@ file_read(struct archive *a, void *client_data, const void **buff)
 	}
 }
 
+#ifdef USE_MMAP
+/*
+ * Return the rest of the window holding the read position, mapping a
+ * new window starting at the read position if there is none.  The
+ * previous window is no longer referenced once libarchive asks for the
+ * next block.  If the file can't be mapped, fall back to read().
+ */
+static ssize_t
+file_read_mmap(struct archive *a, struct read_file_data *mine,
+    const void **buff)
+{
+	size_t page;
+	ssize_t bytes;
+	void *p;
+
+	*buff = mine->buffer;
+	if (mine->position >= mine->size)
+		return (0);
+	if (mine->map == NULL || mine->position < mine->map_offset ||
+	    mine->position >= mine->map_offset + (int64_t)mine->map_length) {
+		file_unmap(mine);
+		page = (size_t)sysconf(_SC_PAGESIZE);
+		mine->map_offset = mine->position - mine->position % page;
+		mine->map_length = mine->map_window;
+		if ((int64_t)mine->map_length > mine->size - mine->map_offset)
+			mine->map_length =
+			    (size_t)(mine->size - mine->map_offset);
+		p = mmap(NULL, mine->map_length, PROT_READ, MAP_PRIVATE,
+		    mine->fd, (off_t)mine->map_offset);
+		if (p == MAP_FAILED) {
+			mine->use_mmap = 0;
+			if (lseek(mine->fd, mine->position, SEEK_SET) < 0) {
+				archive_set_error(a, errno,
+				    "Error seeking in '%s'", mine->filename.m);
+				return (-1);
+			}
+			return (file_read(a, mine, buff));
+		}
+		mine->map = (char *)p;
+#ifdef MADV_SEQUENTIAL
+		madvise(p, mine->map_length, MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+		madvise(p, mine->map_length, MADV_WILLNEED);
+#endif
+	}
+	*buff = mine->map + (mine->position - mine->map_offset);
+	bytes = (ssize_t)(mine->map_offset + mine->map_length -
+	    mine->position);
+	mine->position += bytes;
+	return (bytes);
+}
+
+static void
+file_unmap(struct read_file_data *mine)
+{
+	if (mine->map != NULL) {
+		munmap(mine->map, mine->map_length);
+		mine->map = NULL;
+	}
+}
+#endif
+
 /*
  * Regular files and disk-like block devices can use simple lseek
  * without needing to round the request to the block size.
@@ -485,6 +621,21 @@ file_skip(struct archive *a, void *client_data, int64_t request)
 {
 	struct read_file_data *mine = (struct read_file_data *)client_data;
 
+#ifdef USE_MMAP
+	if (mine->use_mmap) {
+		if (request > mine->size - mine->position)
+			request = mine->size - mine->position;
+		if (request < 0)
+			request = 0;
+		mine->position += request;
+		return (request);
+	}
+#endif
+#ifdef ARCHIVE_READ_PREFETCH
+	if (mine->prefetch != NULL)
+		return (__archive_read_prefetch_skip(mine->prefetch, request));
+#endif
+
 	/* Delegate skip requests. */
 	if (mine->use_lseek)
 		return (file_skip_lseek(a, client_data, request));
@@ -502,9 +653,32 @@ file_seek(struct archive *a, void *client_data, int64_t request, int whence)
 	struct read_file_data *mine = (struct read_file_data *)client_data;
 	int64_t r;
 
+#ifdef USE_MMAP
+	if (mine->use_mmap) {
+		if (whence == SEEK_CUR)
+			request += mine->position;
+		else if (whence == SEEK_END)
+			request += mine->size;
+		if (request >= 0) {
+			mine->position = request;
+			return (request);
+		}
+		errno = EINVAL;
+		archive_set_error(a, errno, "Error seeking in '%s'",
+		    mine->filename.m);
+		return (ARCHIVE_FATAL);
+	}
+#endif
+
 	/* We use off_t here because lseek() is declared that way. */
 	/* See above for notes about when off_t is less than 64 bits. */
-	r = lseek(mine->fd, request, whence);
+#ifdef ARCHIVE_READ_PREFETCH
+	if (mine->prefetch != NULL)
+		r = __archive_read_prefetch_seek(mine->prefetch, request,
+		    whence);
+	else
+#endif
+		r = lseek(mine->fd, request, whence);
 	if (r >= 0)
 		return r;
 
@@ -527,6 +701,20 @@ file_close2(struct archive *a, void *client_data)
 
 	(void)a; /* UNUSED */
 
+#ifdef USE_MMAP
+	file_unmap(mine);
+	mine->use_mmap = 0;
+#endif
+#ifdef ARCHIVE_READ_PREFETCH
+	if (mine->prefetch != NULL) {
+		/* Leave stdin where the archive was read up to. */
+		if (mine->filename_type == FNT_STDIN)
+			lseek(mine->fd, __archive_read_prefetch_position(
+			    mine->prefetch), SEEK_SET);
+		__archive_read_prefetch_free(mine->prefetch);
+		mine->prefetch = NULL;
+	}
+#endif
 	/* Only flush and close if open succeeded. */
 	if (mine->fd >= 0) {
 		/*
@@ -0,0 +1,304 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_TC_API_H
+#include <tc_api.h>
+#endif
+
+#include "archive.h"
+
+#ifndef HAVE_TC_API_H
+
+int
+archive_read_open_tc(struct archive *a, const char *path, size_t block_size)
+{
+	(void)path; /* UNUSED */
+	(void)block_size; /* UNUSED */
+	archive_set_error(a, ARCHIVE_ERRNO_MISC,
+	    "tc I/O not supported on this platform");
+	return (ARCHIVE_FATAL);
+}
+
+#else	/* Support tc I/O */
+
+/*
+ * The archive is read ahead TC_READ_AHEAD bytes at a time, by one tc_readv
+ * compound of consecutive block_size reads, and the blocks are then handed
+ * to libarchive one by one.
+ */
+#define TC_READ_AHEAD	(4 * 1024 * 1024)
+
+struct read_tc_data {
+	char	*path;
+	size_t	 block_size;
+	/* Blocks fetched by each compound. */
+	int	 nblocks;
+	char	*buffer;
+	size_t	*lengths;
+	/* Blocks fetched by the last compound, and the next one to return. */
+	int	 ready;
+	int	 next;
+	/* Bytes of the next block already skipped. */
+	size_t	 next_skipped;
+	/* Archive offset of the next byte returned to libarchive. */
+	int64_t	 offset;
+	char	 eof;
+};
+
+static int	file_close(struct archive *, void *);
+static int	file_fill(struct archive *, struct read_tc_data *);
+static ssize_t	file_read(struct archive *, void *, const void **buff);
+static int64_t	file_seek(struct archive *, void *, int64_t request, int);
+static void	file_reposition(struct read_tc_data *, int64_t offset);
+static int64_t	file_skip(struct archive *, void *, int64_t request);
+
+/*
+ * Read an archive stored at @path on tc storage.  tc_init() must have been
+ * called by the application.
+ */
+int
+archive_read_open_tc(struct archive *a, const char *path, size_t block_size)
+{
+	struct read_tc_data *mine;
+	struct tc_attrs attrs;
+	tc_res res;
+
+	archive_clear_error(a);
+	memset(&attrs, 0, sizeof(attrs));
+	attrs.file = tc_file_from_path(path);
+	attrs.masks = TC_ATTRS_MASK_NONE;
+	attrs.masks.has_size = 1;
+	res = tc_getattrsv(&attrs, 1, false);
+	if (!tc_okay(res)) {
+		archive_set_error(a, res.err_no, "Failed to stat '%s'", path);
+		return (ARCHIVE_FATAL);
+	}
+
+	mine = (struct read_tc_data *)calloc(1, sizeof(*mine));
+	if (mine != NULL) {
+		mine->block_size = block_size;
+		mine->nblocks = TC_READ_AHEAD / block_size;
+		if (mine->nblocks < 1)
+			mine->nblocks = 1;
+		mine->path = strdup(path);
+		mine->buffer = (char *)malloc(mine->nblocks * block_size);
+		mine->lengths = (size_t *)calloc(mine->nblocks,
+		    sizeof(*mine->lengths));
+	}
+	if (mine == NULL || mine->path == NULL || mine->buffer == NULL ||
+	    mine->lengths == NULL) {
+		archive_set_error(a, ENOMEM, "No memory");
+		if (mine != NULL) {
+			free(mine->path);
+			free(mine->buffer);
+			free(mine->lengths);
+			free(mine);
+		}
+		return (ARCHIVE_FATAL);
+	}
+
+	archive_read_set_read_callback(a, file_read);
+	archive_read_set_skip_callback(a, file_skip);
+	archive_read_set_seek_callback(a, file_seek);
+	archive_read_set_close_callback(a, file_close);
+	archive_read_set_callback_data(a, mine);
+	return (archive_read_open1(a));
+}
+
+/*
+ * Read the next nblocks blocks with one compound.  Blocks after a short
+ * one are past the end of the file and dropped.
+ */
+static int
+file_fill(struct archive *a, struct read_tc_data *mine)
+{
+	struct tc_iovec *iovs;
+	tc_res res;
+	int i;
+
+	iovs = (struct tc_iovec *)calloc(mine->nblocks, sizeof(*iovs));
+	if (iovs == NULL) {
+		archive_set_error(a, ENOMEM, "No memory");
+		return (ARCHIVE_FATAL);
+	}
+	for (i = 0; i < mine->nblocks; i++) {
+		iovs[i].file = tc_file_from_path(mine->path);
+		iovs[i].offset = mine->offset + (int64_t)i * mine->block_size;
+		iovs[i].length = mine->block_size;
+		iovs[i].data = mine->buffer + (size_t)i * mine->block_size;
+	}
+	res = tc_readv(iovs, mine->nblocks, false);
+	if (!tc_okay(res)) {
+		archive_set_error(a, res.err_no, "Error reading '%s'",
+		    mine->path);
+		free(iovs);
+		return (ARCHIVE_FATAL);
+	}
+
+	mine->ready = 0;
+	mine->next = 0;
+	for (i = 0; i < mine->nblocks; i++) {
+		mine->lengths[mine->ready++] = iovs[i].length;
+		if (iovs[i].is_eof || iovs[i].length < mine->block_size) {
+			mine->eof = 1;
+			break;
+		}
+	}
+	free(iovs);
+	return (ARCHIVE_OK);
+}
+
+static ssize_t
+file_read(struct archive *a, void *client_data, const void **buff)
+{
+	struct read_tc_data *mine = (struct read_tc_data *)client_data;
+	size_t length;
+
+	if (mine->next >= mine->ready) {
+		if (mine->eof)
+			return (0);
+		if (file_fill(a, mine) != ARCHIVE_OK)
+			return (-1);
+	}
+	*buff = mine->buffer + (size_t)mine->next * mine->block_size +
+	    mine->next_skipped;
+	length = mine->lengths[mine->next++] - mine->next_skipped;
+	mine->next_skipped = 0;
+	mine->offset += length;
+	return (length);
+}
+
+/* Forget the blocks read ahead and continue reading from @offset. */
+static void
+file_reposition(struct read_tc_data *mine, int64_t offset)
+{
+	mine->offset = offset;
+	mine->ready = 0;
+	mine->next = 0;
+	mine->next_skipped = 0;
+	mine->eof = 0;
+}
+
+/*
+ * A skip that ends within the blocks read ahead just drops the blocks
+ * before its end.  A longer one costs nothing either: the next compound
+ * simply starts further on.  As with lseek(), skipping past the end is not
+ * an error; the next read returns end of file.
+ */
+static int64_t
+file_skip(struct archive *a, void *client_data, int64_t request)
+{
+	struct read_tc_data *mine = (struct read_tc_data *)client_data;
+	int64_t remaining = request;
+	size_t avail;
+	int i;
+
+	(void)a; /* UNUSED */
+	for (i = mine->next; i < mine->ready; i++) {
+		avail = mine->lengths[i] - (i == mine->next ?
+		    mine->next_skipped : 0);
+		if (remaining < (int64_t)avail) {
+			mine->next_skipped = (i == mine->next ?
+			    mine->next_skipped : 0) + (size_t)remaining;
+			mine->next = i;
+			mine->offset += request;
+			return (request);
+		}
+		remaining -= avail;
+	}
+	file_reposition(mine, mine->offset + request);
+	return (request);
+}
+
+static int64_t
+file_seek(struct archive *a, void *client_data, int64_t request, int whence)
+{
+	struct read_tc_data *mine = (struct read_tc_data *)client_data;
+	struct tc_attrs attrs;
+	tc_res res;
+	int64_t base;
+
+	switch (whence) {
+	case SEEK_SET:
+		base = 0;
+		break;
+	case SEEK_CUR:
+		base = mine->offset;
+		break;
+	case SEEK_END:
+		memset(&attrs, 0, sizeof(attrs));
+		attrs.file = tc_file_from_path(mine->path);
+		attrs.masks = TC_ATTRS_MASK_NONE;
+		attrs.masks.has_size = 1;
+		res = tc_getattrsv(&attrs, 1, false);
+		if (!tc_okay(res)) {
+			archive_set_error(a, res.err_no,
+			    "Failed to stat '%s'", mine->path);
+			return (ARCHIVE_FATAL);
+		}
+		base = attrs.size;
+		break;
+	default:
+		archive_set_error(a, EINVAL, "Invalid whence %d", whence);
+		return (ARCHIVE_FATAL);
+	}
+	if (base + request < 0) {
+		archive_set_error(a, EINVAL, "Seek before start of '%s'",
+		    mine->path);
+		return (ARCHIVE_FATAL);
+	}
+	file_reposition(mine, base + request);
+	return (mine->offset);
+}
+
+static int
+file_close(struct archive *a, void *client_data)
+{
+	struct read_tc_data *mine = (struct read_tc_data *)client_data;
+
+	(void)a; /* UNUSED */
+	free(mine->path);
+	free(mine->buffer);
+	free(mine->lengths);
+	free(mine);
+	return (ARCHIVE_OK);
+}
+
+#endif	/* Support tc I/O */
@@ -0,0 +1,328 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "archive.h"
+#include "archive_read_prefetch_private.h"
+
+#ifdef ARCHIVE_READ_PREFETCH
+
+struct prefetch_block {
+	char		*buff;
+	int64_t		 offset;
+	ssize_t		 length;	/* 0 at end of file, -1 on error. */
+	int		 err;
+};
+
+/*
+ * blocks[] is a ring: the ready blocks, in file order, start at head,
+ * and the helper thread fills the one after them from next_offset.
+ * While the caller holds the block at head (lent), it counts as ready
+ * so the thread leaves it alone.
+ */
+struct archive_read_prefetch {
+	pthread_t		 thread;
+	pthread_mutex_t		 mutex;
+	pthread_cond_t		 cond;
+	int			 fd;
+	size_t			 block_size;
+	int			 depth;
+	struct prefetch_block	*blocks;
+	int			 head;
+	int			 ready;
+	size_t			 skipped;	/* Bytes of head block skipped. */
+	char			 lent;
+	char			 filling;	/* Thread is in pread(). */
+	char			 restarted;	/* Discard what it reads. */
+	char			 eof;		/* Or error; wait for restart. */
+	char			 stop;
+	int64_t			 next_offset;
+	int64_t			 position;	/* End of the lent block. */
+};
+
+static void *
+prefetch_thread(void *arg)
+{
+	struct archive_read_prefetch *p = (struct archive_read_prefetch *)arg;
+	struct prefetch_block *b;
+	int64_t offset;
+	ssize_t bytes;
+	int err;
+
+	pthread_mutex_lock(&p->mutex);
+	for (;;) {
+		while (!p->stop && (p->eof || p->ready == p->depth))
+			pthread_cond_wait(&p->cond, &p->mutex);
+		if (p->stop)
+			break;
+		b = &p->blocks[(p->head + p->ready) % p->depth];
+		offset = p->next_offset;
+		p->filling = 1;
+		pthread_mutex_unlock(&p->mutex);
+
+		do {
+			bytes = pread(p->fd, b->buff, p->block_size,
+			    (off_t)offset);
+		} while (bytes < 0 && errno == EINTR);
+		err = bytes < 0 ? errno : 0;
+
+		pthread_mutex_lock(&p->mutex);
+		p->filling = 0;
+		if (p->restarted) {
+			p->restarted = 0;
+		} else {
+			b->offset = offset;
+			b->length = bytes;
+			b->err = err;
+			p->ready++;
+			if (bytes <= 0)
+				p->eof = 1;
+			else
+				p->next_offset += bytes;
+		}
+		pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+	return (NULL);
+}
+
+/* Give back the block lent by the last read.  Called locked. */
+static void
+release_block(struct archive_read_prefetch *p)
+{
+	if (p->lent) {
+		p->lent = 0;
+		p->head = (p->head + 1) % p->depth;
+		p->ready--;
+		pthread_cond_broadcast(&p->cond);
+	}
+}
+
+/* Drop everything read ahead and continue from offset.  Called locked. */
+static void
+restart(struct archive_read_prefetch *p, int64_t offset)
+{
+	p->lent = 0;
+	p->head = 0;
+	p->ready = 0;
+	p->skipped = 0;
+	p->eof = 0;
+	p->restarted = p->filling;
+	p->next_offset = offset;
+	p->position = offset;
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+	posix_fadvise(p->fd, (off_t)offset,
+	    (off_t)(p->block_size * p->depth), POSIX_FADV_WILLNEED);
+#endif
+	pthread_cond_broadcast(&p->cond);
+}
+
+struct archive_read_prefetch *
+__archive_read_prefetch_new(int fd, int64_t offset, size_t block_size,
+    int depth)
+{
+	struct archive_read_prefetch *p;
+	int i;
+
+	p = (struct archive_read_prefetch *)calloc(1, sizeof(*p));
+	if (p == NULL)
+		return (NULL);
+	p->fd = fd;
+	p->block_size = block_size;
+	p->depth = depth;
+	p->next_offset = p->position = offset;
+	p->blocks = (struct prefetch_block *)calloc(depth, sizeof(*p->blocks));
+	if (p->blocks == NULL)
+		goto fail;
+	for (i = 0; i < depth; i++) {
+		p->blocks[i].buff = (char *)malloc(block_size);
+		if (p->blocks[i].buff == NULL)
+			goto fail;
+	}
+	if (pthread_mutex_init(&p->mutex, NULL) != 0)
+		goto fail;
+	if (pthread_cond_init(&p->cond, NULL) != 0) {
+		pthread_mutex_destroy(&p->mutex);
+		goto fail;
+	}
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_SEQUENTIAL)
+	posix_fadvise(fd, (off_t)offset, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	if (pthread_create(&p->thread, NULL, prefetch_thread, p) != 0) {
+		pthread_cond_destroy(&p->cond);
+		pthread_mutex_destroy(&p->mutex);
+		goto fail;
+	}
+	return (p);
+fail:
+	for (i = 0; p->blocks != NULL && i < depth; i++)
+		free(p->blocks[i].buff);
+	free(p->blocks);
+	free(p);
+	return (NULL);
+}
+
+ssize_t
+__archive_read_prefetch_read(struct archive_read_prefetch *p,
+    const void **buff)
+{
+	struct prefetch_block *b;
+	ssize_t bytes;
+
+	pthread_mutex_lock(&p->mutex);
+	release_block(p);
+	while (p->ready == 0)
+		pthread_cond_wait(&p->cond, &p->mutex);
+	b = &p->blocks[p->head];
+	bytes = b->length;
+	*buff = b->buff;
+	if (bytes > 0) {
+		/* Lend it; end of file and errors stay for the next call. */
+		*buff = b->buff + p->skipped;
+		bytes -= p->skipped;
+		p->skipped = 0;
+		p->lent = 1;
+		p->position = b->offset + b->length;
+	} else if (bytes < 0)
+		errno = b->err;
+	pthread_mutex_unlock(&p->mutex);
+	return (bytes);
+}
+
+/*
+ * A skip that ends within the blocks already read drops the ones before
+ * its end and the skipped part of the last; only one that goes past
+ * them all restarts reading at the new position.
+ */
+int64_t
+__archive_read_prefetch_skip(struct archive_read_prefetch *p, int64_t request)
+{
+	int64_t remaining = request;
+	struct prefetch_block *b;
+	size_t avail;
+
+	pthread_mutex_lock(&p->mutex);
+	release_block(p);
+	while (remaining > 0 && p->ready > 0) {
+		b = &p->blocks[p->head];
+		if (b->length <= 0)
+			break;
+		avail = (size_t)b->length - p->skipped;
+		if ((int64_t)avail > remaining) {
+			p->skipped += (size_t)remaining;
+			p->position += remaining;
+			remaining = 0;
+			break;
+		}
+		remaining -= avail;
+		p->position += avail;
+		p->skipped = 0;
+		p->head = (p->head + 1) % p->depth;
+		p->ready--;
+	}
+	if (remaining > 0)
+		restart(p, p->position + remaining);
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+	return (request);
+}
+
+int64_t
+__archive_read_prefetch_seek(struct archive_read_prefetch *p, int64_t offset,
+    int whence)
+{
+	struct stat st;
+
+	pthread_mutex_lock(&p->mutex);
+	if (whence == SEEK_CUR)
+		offset += p->position;
+	else if (whence == SEEK_END) {
+		if (fstat(p->fd, &st) != 0) {
+			pthread_mutex_unlock(&p->mutex);
+			return (-1);
+		}
+		offset += st.st_size;
+	}
+	if (offset < 0) {
+		pthread_mutex_unlock(&p->mutex);
+		errno = EINVAL;
+		return (-1);
+	}
+	restart(p, offset);
+	pthread_mutex_unlock(&p->mutex);
+	return (offset);
+}
+
+int64_t
+__archive_read_prefetch_position(struct archive_read_prefetch *p)
+{
+	int64_t position;
+
+	pthread_mutex_lock(&p->mutex);
+	position = p->position;
+	pthread_mutex_unlock(&p->mutex);
+	return (position);
+}
+
+void
+__archive_read_prefetch_free(struct archive_read_prefetch *p)
+{
+	int i;
+
+	pthread_mutex_lock(&p->mutex);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->mutex);
+	pthread_join(p->thread, NULL);
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->mutex);
+	for (i = 0; i < p->depth; i++)
+		free(p->blocks[i].buff);
+	free(p->blocks);
+	free(p);
+}
+
+#endif /* ARCHIVE_READ_PREFETCH */
@@ -0,0 +1,60 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LIBARCHIVE_BUILD
+#error This header is only to be used internally to libarchive.
+#endif
+
+#ifndef ARCHIVE_READ_PREFETCH_PRIVATE_H_INCLUDED
+#define ARCHIVE_READ_PREFETCH_PRIVATE_H_INCLUDED
+
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_PREAD)
+#define ARCHIVE_READ_PREFETCH
+#endif
+
+#ifdef ARCHIVE_READ_PREFETCH
+/*
+ * Sequential read-ahead of a file on a helper thread, used by
+ * archive_read_open_filename() and archive_read_open_fd() when the
+ * "read:prefetch" option is set.  Up to depth blocks are read with
+ * pread() ahead of the one lent to the caller, which stays valid until
+ * the next call.  Errors are returned as -1 with errno set.
+ */
+struct archive_read_prefetch;
+
+struct archive_read_prefetch *
+	__archive_read_prefetch_new(int fd, int64_t offset,
+	    size_t block_size, int depth);
+ssize_t	__archive_read_prefetch_read(struct archive_read_prefetch *,
+	    const void **buff);
+int64_t	__archive_read_prefetch_skip(struct archive_read_prefetch *,
+	    int64_t request);
+int64_t	__archive_read_prefetch_seek(struct archive_read_prefetch *,
+	    int64_t offset, int whence);
+int64_t	__archive_read_prefetch_position(struct archive_read_prefetch *);
+void	__archive_read_prefetch_free(struct archive_read_prefetch *);
+#endif
+
+#endif
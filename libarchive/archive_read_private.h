@@ -113,6 +113,10 @@ struct archive_read_filter {
 	size_t		 client_total;
 	const char	*client_next;
 	size_t		 client_avail;
+	/* Bytes copied into the copy buffer or moved within it, and
+	 * bytes consumed straight from the client buffer. */
+	int64_t		 bytes_copied;
+	int64_t		 bytes_passed;
 	char		 end_of_file;
 	char		 closed;
 	char		 fatal;
@@ -178,6 +182,11 @@ struct archive_read {
 	/* Whether to bypass filter bidding process */
 	int bypass_filter_bidding;
 
+	/* Options of the built-in client readers, module name "read". */
+	int		  file_mmap;
+	size_t		  file_mmap_window;
+	int		  file_prefetch;
+
 	/* File offset of beginning of most recently-read header. */
 	int64_t		  header_position;
 
@@ -26,6 +26,16 @@
 #include "archive_platform.h"
 __FBSDID("$FreeBSD$");
 
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
 #include "archive_read_private.h"
 #include "archive_options_private.h"
 
@@ -33,6 +43,8 @@ static int	archive_set_format_option(struct archive *a,
 		    const char *m, const char *o, const char *v);
 static int	archive_set_filter_option(struct archive *a,
 		    const char *m, const char *o, const char *v);
+static int	archive_set_client_option(struct archive *a,
+		    const char *m, const char *o, const char *v);
 static int	archive_set_option(struct archive *a,
 		    const char *m, const char *o, const char *v);
 
@@ -113,19 +125,19 @@ archive_set_filter_option(struct archive *_a, const char *m, const char *o,
     const char *v)
 {
 	struct archive_read *a = (struct archive_read *)_a;
-	struct archive_read_filter *filter;
 	struct archive_read_filter_bidder *bidder;
+	size_t i;
 	int r, rv = ARCHIVE_WARN, matched_modules = 0;
 
-	for (filter = a->filter; filter != NULL; filter = filter->upstream) {
-		bidder = filter->bidder;
-		if (bidder == NULL)
-			continue;
-		if (bidder->options == NULL)
+	/* Options are set before the archive is opened, so they go to
+	 * the registered bidders, which pass them on to their filters. */
+	for (i = 0; i < sizeof(a->bidders)/sizeof(a->bidders[0]); i++) {
+		bidder = &a->bidders[i];
+		if (bidder->options == NULL || bidder->name == NULL)
 			/* This bidder does not support option */
 			continue;
 		if (m != NULL) {
-			if (strcmp(filter->name, m) != 0)
+			if (strcmp(bidder->name, m) != 0)
 				continue;
 			++matched_modules;
 		}
@@ -145,11 +157,73 @@ archive_set_filter_option(struct archive *_a, const char *m, const char *o,
 	return (rv);
 }
 
+/*
+ * Options for the client readers built into libarchive, such as
+ * archive_read_open_filename(), go to the module "read".
+ */
+static int
+archive_set_client_option(struct archive *_a, const char *m, const char *o,
+    const char *v)
+{
+	struct archive_read *a = (struct archive_read *)_a;
+	char *end;
+	unsigned long long n;
+
+	if (m != NULL && strcmp(m, "read") != 0)
+		return (ARCHIVE_WARN - 1);
+	if (o == NULL)
+		return (ARCHIVE_WARN);
+	if (strcmp(o, "mmap") == 0) {
+		a->file_mmap = (v != NULL);
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(o, "mmap-window") == 0) {
+		if (v == NULL)
+			return (ARCHIVE_FAILED);
+		errno = 0;
+		n = strtoull(v, &end, 10);
+		if (errno != 0 || *end != '\0' || n == 0 ||
+		    n > (size_t)-1) {
+			archive_set_error(_a, ARCHIVE_ERRNO_MISC,
+			    "Invalid mmap-window: `%s'", v);
+			return (ARCHIVE_FAILED);
+		}
+		a->file_mmap_window = (size_t)n;
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(o, "prefetch") == 0) {
+		if (v == NULL) {
+			a->file_prefetch = 0;
+			return (ARCHIVE_OK);
+		}
+		errno = 0;
+		n = strtoull(v, &end, 10);
+		if (errno != 0 || *end != '\0' || n > 1024) {
+			archive_set_error(_a, ARCHIVE_ERRNO_MISC,
+			    "Invalid prefetch: `%s'", v);
+			return (ARCHIVE_FAILED);
+		}
+		a->file_prefetch = (int)n;
+		return (ARCHIVE_OK);
+	}
+	return (ARCHIVE_WARN);
+}
+
 static int
 archive_set_option(struct archive *a, const char *m, const char *o,
     const char *v)
 {
-	return _archive_set_either_option(a, m, o, v,
+	int r1, r2;
+
+	r1 = archive_set_client_option(a, m, o, v);
+	if (r1 == ARCHIVE_FATAL || r1 == ARCHIVE_FAILED)
+		return (r1);
+	if (m != NULL && r1 != ARCHIVE_WARN - 1)
+		return (r1);
+	r2 = _archive_set_either_option(a, m, o, v,
 	    archive_set_format_option,
 	    archive_set_filter_option);
+	if (r1 == ARCHIVE_OK && r2 == ARCHIVE_WARN)
+		return (ARCHIVE_OK);
+	return (r2);
 }
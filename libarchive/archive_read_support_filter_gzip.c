@@ -34,6 +34,10 @@ __FBSDID("$FreeBSD$");
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#include <stdio.h>
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
@@ -45,10 +49,94 @@ __FBSDID("$FreeBSD$");
 #endif
 
 #include "archive.h"
+#include "archive_endian.h"
 #include "archive_private.h"
 #include "archive_read_private.h"
 
+/* The seek index needs inflateGetDictionary(), new in zlib 1.2.8. */
+#if defined(HAVE_ZLIB_H) && defined(ZLIB_VERNUM) && ZLIB_VERNUM >= 0x1280
+#define GZIP_INDEX_SUPPORTED 1
+#endif
+
+/* Parallel decoding also needs threads. */
+#if defined(GZIP_INDEX_SUPPORTED) && defined(HAVE_PTHREAD_H)
+#define GZIP_PARALLEL_SUPPORTED 1
+#endif
+
+#define GZIP_INDEX_SPAN_DEFAULT	(4 * 1024 * 1024)
+#define GZIP_INDEX_MAGIC	"LAGZIDX2"
+#define GZIP_WINDOW_SIZE	32768
+#define GZIP_THREADS_MAX	64
+/* Compressed bytes per chunk of a parallel batch. */
+#define GZIP_CHUNK_SIZE		(1024 * 1024)
+/* A chunk stops at the first block boundary past this much output. */
+#define GZIP_CHUNK_OUTPUT_MAX	(64 * 1024 * 1024)
+
+/* Options, kept by the bidder until the filter is created. */
+struct gzip_options {
+	struct archive_read	*archive;
+	char		 index;		/* Keep a seek index. */
+	char		*index_file;	/* Load it from and save it here. */
+	int64_t		 index_span;	/* Output bytes between checkpoints. */
+	int		 threads;	/* Decode in parallel on this many. */
+};
+
 #ifdef HAVE_ZLIB_H
+/*
+ * A point at a deflate block boundary where decompression can be
+ * restarted without reading what precedes it, in the manner of zlib's
+ * examples/zran.c: the input offset, the bits of the byte before it
+ * that belong to the next block and the 32K of output the next block
+ * may refer back to.
+ */
+struct gzip_checkpoint {
+	int64_t		 in;		/* Upstream offset of the next byte. */
+	int64_t		 out;		/* Output offset. */
+	int		 bits;		/* Bits of in - 1 not yet used. */
+	size_t		 window_size;	/* Bytes of window. */
+	unsigned char	*window;	/* The window, compressed. */
+	size_t		 window_compressed;
+};
+
+struct gzip_index {
+	struct gzip_checkpoint	*checkpoints;	/* Ordered by out. */
+	size_t		 count;
+	size_t		 allocated;
+	int64_t		 span;
+	int64_t		 total_out;	/* Valid once complete. */
+	/* Size and last gzip trailer of the input, valid once complete. */
+	int64_t		 total_in;
+	unsigned char	 trailer[8];
+	char		 complete;	/* Covers all of the data. */
+};
+
+#ifdef GZIP_PARALLEL_SUPPORTED
+/*
+ * A run of deflate blocks decoded on its own thread.  Chunk 0 of a
+ * batch continues the main stream.  Every other chunk starts at a
+ * block boundary found by searching its part of the input, before the
+ * output that its back-references reach into is known, and so is
+ * decoded twice, with the marker dictionaries described at
+ * gzip_resolve().
+ */
+struct gzip_chunk {
+	struct private_data *state;
+	const unsigned char *in;	/* The whole batch of input. */
+	size_t		 in_size;
+	size_t		 search;	/* Byte offset to search from. */
+	int64_t		 start;		/* Bit offset of the first block. */
+	int64_t		 target;	/* Stop at a boundary at or past. */
+	int64_t		 end;		/* Bit offset where it stopped. */
+	char		 found;
+	char		 failed;
+	char		 stream_end;	/* Stopped after the last block. */
+	unsigned char	*out[2];
+	size_t		 out_size[2];
+	size_t		 out_allocated[2];
+	pthread_t	 thread;
+};
+#endif
+
 struct private_data {
 	z_stream	 stream;
 	char		 in_stream;
@@ -56,11 +144,33 @@ struct private_data {
 	size_t		 out_block_size;
 	int64_t		 total_out;
 	unsigned long	 crc;
+	int64_t		 member_out;	/* Output of this member so far. */
+	char		 member_whole;	/* All of it, so crc can be checked. */
 	char		 eof; /* True = found end of compressed data. */
+	/* Seek index, if enabled. */
+	char		 indexed;
+	char		 index_built;	/* Completed here, not loaded. */
+	struct gzip_index index;
+	int64_t		 start;		/* Upstream offset of the data. */
+	unsigned char	*window;	/* Scratch space for one window. */
+#ifdef GZIP_PARALLEL_SUPPORTED
+	/* Parallel decoding, if enabled. */
+	int		 threads;
+	char		 at_boundary;	/* Main stream is between blocks. */
+	int64_t		 parallel_resume; /* Don't try before this offset. */
+	unsigned char	*markers[2];	/* Marker dictionaries. */
+	struct gzip_chunk *chunks;	/* The last batch, threads of them. */
+	int		 chunks_decoded;
+	int		 chunks_returned;
+#endif
 };
 
 /* Gzip Filter. */
 static ssize_t	gzip_filter_read(struct archive_read_filter *, const void **);
+#ifdef GZIP_INDEX_SUPPORTED
+static int64_t	gzip_filter_skip(struct archive_read_filter *, int64_t);
+static int64_t	gzip_filter_seek(struct archive_read_filter *, int64_t, int);
+#endif
 static int	gzip_filter_close(struct archive_read_filter *);
 #endif
 
@@ -77,6 +187,9 @@ static int	gzip_filter_close(struct archive_read_filter *);
 static int	gzip_bidder_bid(struct archive_read_filter_bidder *,
 		    struct archive_read_filter *);
 static int	gzip_bidder_init(struct archive_read_filter *);
+static int	gzip_bidder_options(struct archive_read_filter_bidder *,
+		    const char *, const char *);
+static int	gzip_bidder_free(struct archive_read_filter_bidder *);
 
 #if ARCHIVE_VERSION_NUMBER < 4000000
 /* Deprecated; remove in libarchive 4.0 */
@@ -92,19 +205,30 @@ archive_read_support_filter_gzip(struct archive *_a)
 {
 	struct archive_read *a = (struct archive_read *)_a;
 	struct archive_read_filter_bidder *bidder;
+	struct gzip_options *opts;
 
 	archive_check_magic(_a, ARCHIVE_READ_MAGIC,
 	    ARCHIVE_STATE_NEW, "archive_read_support_filter_gzip");
 
-	if (__archive_read_get_bidder(a, &bidder) != ARCHIVE_OK)
+	opts = (struct gzip_options *)calloc(1, sizeof(*opts));
+	if (opts == NULL) {
+		archive_set_error(_a, ENOMEM, "Can't allocate gzip options");
+		return (ARCHIVE_FATAL);
+	}
+	opts->archive = a;
+	opts->index_span = GZIP_INDEX_SPAN_DEFAULT;
+
+	if (__archive_read_get_bidder(a, &bidder) != ARCHIVE_OK) {
+		free(opts);
 		return (ARCHIVE_FATAL);
+	}
 
-	bidder->data = NULL;
+	bidder->data = opts;
 	bidder->name = "gzip";
 	bidder->bid = gzip_bidder_bid;
 	bidder->init = gzip_bidder_init;
-	bidder->options = NULL;
-	bidder->free = NULL; /* No data, so no cleanup necessary. */
+	bidder->options = gzip_bidder_options;
+	bidder->free = gzip_bidder_free;
 	/* Signal the extent of gzip support with the return value here. */
 #if HAVE_ZLIB_H
 	return (ARCHIVE_OK);
@@ -115,6 +239,93 @@ archive_read_support_filter_gzip(struct archive *_a)
 #endif
 }
 
+static int
+gzip_bidder_options(struct archive_read_filter_bidder *self,
+    const char *key, const char *val)
+{
+	struct gzip_options *opts = (struct gzip_options *)self->data;
+#ifdef GZIP_INDEX_SUPPORTED
+	char *end;
+	long long n = 0;
+#endif
+
+	if (strcmp(key, "threads") == 0) {
+#ifndef GZIP_PARALLEL_SUPPORTED
+		archive_set_error(&opts->archive->archive, ARCHIVE_ERRNO_MISC,
+		    "gzip: threads option requires zlib 1.2.8 or later "
+		    "and POSIX threads");
+		return (ARCHIVE_FAILED);
+#else
+		if (val != NULL) {
+			errno = 0;
+			n = strtoll(val, &end, 10);
+			if (errno != 0 || *end != '\0' || end == val)
+				n = 0;
+		}
+		if (n < 1 || n > GZIP_THREADS_MAX) {
+			archive_set_error(&opts->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "gzip: Invalid threads");
+			return (ARCHIVE_FAILED);
+		}
+		opts->threads = (int)n;
+		return (ARCHIVE_OK);
+#endif
+	}
+	if (strcmp(key, "index") != 0 && strcmp(key, "index-file") != 0 &&
+	    strcmp(key, "index-span") != 0) {
+		/* Note: The "warn" return is just to inform the options
+		 * supervisor that we didn't handle it.  It will generate
+		 * a suitable error if no one used this option. */
+		return (ARCHIVE_WARN);
+	}
+#ifndef GZIP_INDEX_SUPPORTED
+	(void)val; /* UNUSED */
+	archive_set_error(&opts->archive->archive, ARCHIVE_ERRNO_MISC,
+	    "gzip: %s option requires zlib 1.2.8 or later", key);
+	return (ARCHIVE_FAILED);
+#else
+	if (strcmp(key, "index") == 0) {
+		opts->index = (val != NULL && val[0] != 0);
+		return (ARCHIVE_OK);
+	} else if (strcmp(key, "index-file") == 0) {
+		free(opts->index_file);
+		opts->index_file = NULL;
+		if (val != NULL && val[0] != 0) {
+			opts->index_file = strdup(val);
+			if (opts->index_file == NULL) {
+				archive_set_error(&opts->archive->archive,
+				    ENOMEM, "Can't allocate gzip options");
+				return (ARCHIVE_FATAL);
+			}
+			opts->index = 1;
+		}
+		return (ARCHIVE_OK);
+	}
+	if (val != NULL) {
+		errno = 0;
+		n = strtoll(val, &end, 10);
+		if (errno == 0 && *end == '\0' && end != val && n > 0) {
+			opts->index_span = n;
+			return (ARCHIVE_OK);
+		}
+	}
+	archive_set_error(&opts->archive->archive, ARCHIVE_ERRNO_MISC,
+	    "gzip: Invalid index-span");
+	return (ARCHIVE_FAILED);
+#endif
+}
+
+static int
+gzip_bidder_free(struct archive_read_filter_bidder *self)
+{
+	struct gzip_options *opts = (struct gzip_options *)self->data;
+
+	free(opts->index_file);
+	free(opts);
+	self->data = NULL;
+	return (ARCHIVE_OK);
+}
+
 /*
  * Read and verify the header.
  *
@@ -243,6 +454,16 @@ gzip_bidder_init(struct archive_read_filter *self)
 
 #else
 
+#ifdef GZIP_INDEX_SUPPORTED
+static int	gzip_index_load(struct archive_read_filter *, const char *);
+#endif
+#ifdef GZIP_PARALLEL_SUPPORTED
+static int	gzip_parallel_init(struct archive_read_filter *, int);
+static ssize_t	gzip_parallel_read(struct archive_read_filter *,
+		    const void **);
+static void	gzip_parallel_discard(struct private_data *);
+#endif
+
 /*
  * Initialize the filter object.
  */
@@ -250,6 +471,7 @@ static int
 gzip_bidder_init(struct archive_read_filter *self)
 {
 	struct private_data *state;
+	struct gzip_options *opts;
 	static const size_t out_block_size = 64 * 1024;
 	void *out_block;
 
@@ -275,6 +497,43 @@ gzip_bidder_init(struct archive_read_filter *self)
 
 	state->in_stream = 0; /* We're not actually within a stream yet. */
 
+	/*
+	 * The seek index and parallel decoding only apply to gzip data
+	 * read straight from the client, so that an index file can't be
+	 * claimed by a second, nested gzip filter, and the threads aren't
+	 * multiplied by it.  A filter appended before the archive is
+	 * opened has no upstream yet, and gets neither.
+	 */
+	opts = (struct gzip_options *)self->bidder->data;
+	if (self->upstream == NULL || self->upstream->upstream != NULL)
+		return (ARCHIVE_OK);
+#ifdef GZIP_INDEX_SUPPORTED
+	if (opts->index || opts->threads > 1) {
+		state->window = (unsigned char *)malloc(GZIP_WINDOW_SIZE);
+		if (state->window == NULL) {
+			archive_set_error(&self->archive->archive, ENOMEM,
+			    "Can't allocate data for gzip decompression");
+			return (ARCHIVE_FATAL);
+		}
+	}
+#endif
+#ifdef GZIP_PARALLEL_SUPPORTED
+	if (opts->threads > 1 &&
+	    gzip_parallel_init(self, opts->threads) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+#endif
+
+	if (!opts->index)
+		return (ARCHIVE_OK);
+#ifdef GZIP_INDEX_SUPPORTED
+	state->indexed = 1;
+	state->index.span = opts->index_span;
+	state->start = self->upstream->position;
+	self->skip = gzip_filter_skip;
+	self->seek = gzip_filter_seek;
+	if (opts->index_file != NULL)
+		return (gzip_index_load(self, opts->index_file));
+#endif
 	return (ARCHIVE_OK);
 }
 
@@ -296,6 +555,8 @@ consume_header(struct archive_read_filter *self)
 
 	/* Initialize CRC accumulator. */
 	state->crc = crc32(0L, NULL, 0);
+	state->member_out = 0;
+	state->member_whole = 1;
 
 	/* Initialize compression library. */
 	state->stream.next_in = (unsigned char *)(uintptr_t)
@@ -336,6 +597,17 @@ consume_header(struct archive_read_filter *self)
 	return (ARCHIVE_FATAL);
 }
 
+/* Add size bytes of output to the CRC of the current member. */
+static void
+gzip_member_update(struct private_data *state, const unsigned char *p,
+    size_t size)
+{
+	if (size == 0)
+		return;
+	state->crc = crc32(state->crc, p, (uInt)size);
+	state->member_out += size;
+}
+
 static int
 consume_trailer(struct archive_read_filter *self)
 {
@@ -361,7 +633,22 @@ consume_trailer(struct archive_read_filter *self)
 	if (p == NULL || avail == 0)
 		return (ARCHIVE_FATAL);
 
-	/* XXX TODO: Verify the length and CRC. */
+	/* The CRC and length can only be checked if we decoded all of
+	 * the member rather than starting at a checkpoint. */
+	if (state->member_whole &&
+	    archive_le32dec(p) != (uint32_t)state->crc) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "gzip CRC mismatch");
+		return (ARCHIVE_FATAL);
+	}
+	if (state->member_whole &&
+	    archive_le32dec(p + 4) != (uint32_t)state->member_out) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "gzip length mismatch");
+		return (ARCHIVE_FATAL);
+	}
+	if (state->indexed && !state->index.complete)
+		memcpy(state->index.trailer, p, 8);
 
 	/* We've verified the trailer, so consume it now. */
 	__archive_read_filter_consume(self->upstream, 8);
@@ -369,21 +656,97 @@ consume_trailer(struct archive_read_filter *self)
 	return (ARCHIVE_OK);
 }
 
-static ssize_t
-gzip_filter_read(struct archive_read_filter *self, const void **p)
+#ifdef GZIP_INDEX_SUPPORTED
+/*
+ * Record where the decompressor is now, just past the end of a deflate
+ * block, as a checkpoint.  in is the upstream offset of the next byte
+ * it will read.
+ */
+static int
+gzip_add_checkpoint(struct archive_read_filter *self, int64_t in)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct gzip_index *index = &state->index;
+	struct gzip_checkpoint *c;
+	uInt window_size = GZIP_WINDOW_SIZE;
+	uLongf compressed;
+
+	if (index->count == index->allocated) {
+		size_t allocated = index->allocated ? index->allocated * 2 : 16;
+
+		c = (struct gzip_checkpoint *)realloc(index->checkpoints,
+		    allocated * sizeof(*c));
+		if (c == NULL)
+			goto nomem;
+		index->checkpoints = c;
+		index->allocated = allocated;
+	}
+	c = &index->checkpoints[index->count];
+	if (inflateGetDictionary(&(state->stream), state->window,
+	    &window_size) != Z_OK) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "Can't save gzip window");
+		return (ARCHIVE_FATAL);
+	}
+	compressed = compressBound(window_size);
+	c->window = (unsigned char *)malloc(compressed);
+	if (c->window == NULL)
+		goto nomem;
+	if (compress2(c->window, &compressed, state->window, window_size,
+	    Z_BEST_SPEED) != Z_OK) {
+		free(c->window);
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "Can't save gzip window");
+		return (ARCHIVE_FATAL);
+	}
+	c->in = in;
+	c->out = state->total_out;
+	c->bits = state->stream.data_type & 7;
+	c->window_size = window_size;
+	c->window_compressed = compressed;
+	index->count++;
+	return (ARCHIVE_OK);
+nomem:
+	archive_set_error(&self->archive->archive, ENOMEM,
+	    "Can't allocate gzip index");
+	return (ARCHIVE_FATAL);
+}
+#endif
+
+/*
+ * Decompress into the space described by stream.next_out and
+ * stream.avail_out until it is full or the data ends.  While an index
+ * is being built, inflate() also stops at every block boundary so that
+ * a checkpoint can be taken once a span of output has gone by.  When
+ * decoding in parallel, it returns early at a block boundary, where
+ * the next batch can start.
+ */
+static int
+gzip_inflate(struct archive_read_filter *self)
 {
 	struct private_data *state;
-	size_t decompressed;
 	ssize_t avail_in;
-	int ret;
+	uInt avail_out;
+	int building, ret;
+	int flush = 0;
+#ifdef GZIP_PARALLEL_SUPPORTED
+	const unsigned char *out_start;
+	int parallel;
+#endif
 
 	state = (struct private_data *)self->data;
+	building = state->indexed && !state->index.complete;
+#ifdef GZIP_INDEX_SUPPORTED
+	if (building)
+		flush = Z_BLOCK;
+#endif
+#ifdef GZIP_PARALLEL_SUPPORTED
+	parallel = state->threads > 1 && !building;
+	if (parallel)
+		flush = Z_BLOCK;
+	out_start = state->stream.next_out;
+#endif
 
-	/* Empty our output buffer. */
-	state->stream.next_out = state->out_block;
-	state->stream.avail_out = (uInt)state->out_block_size;
-
-	/* Try to fill the output buffer. */
 	while (state->stream.avail_out > 0 && !state->eof) {
 		/* If we're not in a stream, read a header
 		 * and initialize the decompression library. */
@@ -411,15 +774,48 @@ gzip_filter_read(struct archive_read_filter *self, const void **p)
 		state->stream.avail_in = (uInt)avail_in;
 
 		/* Decompress and consume some of that data. */
-		ret = inflate(&(state->stream), 0);
+		avail_out = state->stream.avail_out;
+		ret = inflate(&(state->stream), flush);
+		state->total_out += avail_out - state->stream.avail_out;
+		gzip_member_update(state, state->stream.next_out -
+		    (avail_out - state->stream.avail_out),
+		    avail_out - state->stream.avail_out);
 		switch (ret) {
 		case Z_OK: /* Decompressor made some progress. */
+#ifdef GZIP_INDEX_SUPPORTED
+			/* At a block boundary, other than the end? */
+			if (building && (state->stream.data_type & 128) &&
+			    !(state->stream.data_type & 64) &&
+			    state->total_out - (state->index.count ?
+			      state->index.checkpoints[
+			      state->index.count - 1].out : 0) >=
+			    state->index.span) {
+				ret = gzip_add_checkpoint(self,
+				    self->upstream->position +
+				    avail_in - state->stream.avail_in);
+				if (ret != ARCHIVE_OK)
+					return (ret);
+			}
+#endif
 			__archive_read_filter_consume(self->upstream,
 			    avail_in - state->stream.avail_in);
+#ifdef GZIP_PARALLEL_SUPPORTED
+			state->at_boundary =
+			    (state->stream.data_type & 128) &&
+			    !(state->stream.data_type & 64);
+			if (parallel && state->at_boundary &&
+			    state->stream.next_out != out_start &&
+			    self->upstream->position >=
+			    state->parallel_resume)
+				return (ARCHIVE_OK);
+#endif
 			break;
 		case Z_STREAM_END: /* Found end of stream. */
 			__archive_read_filter_consume(self->upstream,
 			    avail_in - state->stream.avail_in);
+#ifdef GZIP_PARALLEL_SUPPORTED
+			state->at_boundary = 0;
+#endif
 			/* Consume the stream trailer; release the
 			 * decompression library. */
 			ret = consume_trailer(self);
@@ -435,9 +831,46 @@ gzip_filter_read(struct archive_read_filter *self, const void **p)
 		}
 	}
 
+	/* The index covers everything once decoding has reached the end,
+	 * since it never skips ahead of the last checkpoint. */
+	if (building && state->eof) {
+		state->index.complete = 1;
+		state->index.total_out = state->total_out;
+		state->index.total_in = self->upstream->position - state->start;
+		state->index_built = 1;
+	}
+	return (ARCHIVE_OK);
+}
+
+static ssize_t
+gzip_filter_read(struct archive_read_filter *self, const void **p)
+{
+	struct private_data *state;
+	size_t decompressed;
+	int ret;
+
+	state = (struct private_data *)self->data;
+
+#ifdef GZIP_PARALLEL_SUPPORTED
+	if (state->threads > 1) {
+		ssize_t bytes = gzip_parallel_read(self, p);
+
+		if (bytes != 0)
+			return (bytes);
+	}
+#endif
+
+	/* Empty our output buffer. */
+	state->stream.next_out = state->out_block;
+	state->stream.avail_out = (uInt)state->out_block_size;
+
+	/* Try to fill the output buffer. */
+	ret = gzip_inflate(self);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+
 	/* We've read as much as we can. */
 	decompressed = state->stream.next_out - state->out_block;
-	state->total_out += decompressed;
 	if (decompressed == 0)
 		*p = NULL;
 	else
@@ -445,6 +878,893 @@ gzip_filter_read(struct archive_read_filter *self, const void **p)
 	return (decompressed);
 }
 
+#ifdef GZIP_INDEX_SUPPORTED
+/*
+ * Return the last checkpoint at or before offset, or NULL if there is
+ * none and decompression has to start from the beginning.
+ */
+static const struct gzip_checkpoint *
+gzip_find_checkpoint(struct private_data *state, int64_t offset)
+{
+	const struct gzip_checkpoint *c = state->index.checkpoints;
+	size_t lo = 0, hi = state->index.count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (c[mid].out <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo == 0 ? NULL : &c[lo - 1]);
+}
+
+/*
+ * Restart decompression at checkpoint c, or at the beginning of the
+ * data if c is NULL.  If the upstream filter can't seek, nothing has
+ * changed when this returns ARCHIVE_FAILED.
+ */
+static int
+gzip_restore(struct archive_read_filter *self, const struct gzip_checkpoint *c)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	const unsigned char *p;
+	uLongf window_size;
+	int64_t offset, r;
+	int byte = 0;
+
+	offset = c == NULL ? state->start : c->in - (c->bits ? 1 : 0);
+	r = __archive_read_filter_seek(self->upstream, offset, SEEK_SET);
+	if (r < 0)
+		return ((int)r);
+	if (r != offset) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "truncated gzip input");
+		return (ARCHIVE_FATAL);
+	}
+
+	if (state->in_stream) {
+		inflateEnd(&(state->stream));
+		state->in_stream = 0;
+	}
+	state->eof = 0;
+#ifdef GZIP_PARALLEL_SUPPORTED
+	gzip_parallel_discard(state);
+	state->at_boundary = c != NULL;
+	state->parallel_resume = 0;
+#endif
+	if (c == NULL) {
+		state->total_out = 0;
+		return (ARCHIVE_OK);
+	}
+
+	/* The block starts part way through the byte before c->in. */
+	if (c->bits) {
+		p = __archive_read_filter_ahead(self->upstream, 1, NULL);
+		if (p == NULL) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "truncated gzip input");
+			return (ARCHIVE_FATAL);
+		}
+		byte = p[0];
+		__archive_read_filter_consume(self->upstream, 1);
+	}
+	state->stream.next_in = NULL;
+	state->stream.avail_in = 0;
+	if (inflateInit2(&(state->stream), -15) != Z_OK) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC,
+		    "Internal error initializing compression library");
+		return (ARCHIVE_FATAL);
+	}
+	state->in_stream = 1;
+	if (c->bits)
+		inflatePrime(&(state->stream), c->bits, byte >> (8 - c->bits));
+	window_size = GZIP_WINDOW_SIZE;
+	if (uncompress(state->window, &window_size, c->window,
+	    (uLong)c->window_compressed) != Z_OK ||
+	    window_size != c->window_size ||
+	    (window_size > 0 && inflateSetDictionary(&(state->stream),
+	      state->window, (uInt)window_size) != Z_OK)) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "Corrupt gzip index");
+		return (ARCHIVE_FATAL);
+	}
+	state->total_out = c->out;
+	state->member_whole = 0;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Skip forward by restarting at the last checkpoint within reach.
+ * Whatever is left is decompressed and discarded by our caller.
+ */
+static int64_t
+gzip_filter_skip(struct archive_read_filter *self, int64_t request)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	const struct gzip_checkpoint *c;
+	int64_t old_total_out = state->total_out;
+	int r;
+
+	c = gzip_find_checkpoint(state, old_total_out + request);
+	/* Not worth a seek unless it saves more than a block of output. */
+	if (c == NULL ||
+	    c->out - old_total_out <= (int64_t)state->out_block_size)
+		return (0);
+	r = gzip_restore(self, c);
+	if (r == ARCHIVE_FAILED)
+		return (0);
+	if (r != ARCHIVE_OK)
+		return (r);
+	return (c->out - old_total_out);
+}
+
+static int64_t
+gzip_filter_seek(struct archive_read_filter *self, int64_t offset, int whence)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	const struct gzip_checkpoint *c;
+	int r;
+
+	switch (whence) {
+	case SEEK_SET:
+		break;
+	case SEEK_END:
+		if (!state->index.complete) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC,
+			    "Can't seek from the end of gzip data "
+			    "before it has been read");
+			return (ARCHIVE_FAILED);
+		}
+		offset += state->index.total_out;
+		break;
+	default:
+		return (ARCHIVE_FATAL);
+	}
+	if (offset < 0)
+		return (ARCHIVE_FAILED);
+
+	/* Restart at a checkpoint unless offset lies ahead, with no
+	 * checkpoint between here and there. */
+	c = gzip_find_checkpoint(state, offset);
+	if (offset < state->total_out ||
+	    (c != NULL && c->out > state->total_out)
+#ifdef GZIP_PARALLEL_SUPPORTED
+	    /* The main stream is ahead of what has been returned. */
+	    || state->chunks_returned < state->chunks_decoded
+#endif
+	    ) {
+		r = gzip_restore(self, c);
+		if (r == ARCHIVE_FAILED)
+			return (r);
+		if (r != ARCHIVE_OK) {
+			self->fatal = 1;
+			return (r);
+		}
+	}
+
+	/* Decompress and discard the rest of the way. */
+	while (state->total_out < offset && !state->eof) {
+		state->stream.next_out = state->out_block;
+		if (offset - state->total_out <
+		    (int64_t)state->out_block_size)
+			state->stream.avail_out =
+			    (uInt)(offset - state->total_out);
+		else
+			state->stream.avail_out =
+			    (uInt)state->out_block_size;
+		r = gzip_inflate(self);
+		if (r != ARCHIVE_OK) {
+			self->fatal = 1;
+			return (r);
+		}
+	}
+	return (state->total_out);
+}
+
+/*
+ * The index file holds a header of the magic number, span, size of the
+ * output, number of checkpoints, size of the input and its last gzip
+ * trailer, followed by each checkpoint and its compressed window.  All
+ * numbers are little-endian.
+ */
+#define GZIP_INDEX_HEADER_SIZE		48
+#define GZIP_CHECKPOINT_HEADER_SIZE	32
+
+/*
+ * Check that the index was built from the data being read, which must
+ * be as long and end with the same gzip trailer.  Returns 1 if so, 0 if
+ * not or if the input can't seek, or ARCHIVE_FATAL.  The input is left
+ * at the start of the data.
+ */
+static int
+gzip_index_matches(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct gzip_index *index = &state->index;
+	const unsigned char *p;
+	int64_t end;
+	int match;
+
+	end = __archive_read_filter_seek(self->upstream, 0, SEEK_END);
+	if (end == ARCHIVE_FAILED)
+		return (0);
+	if (end < 0)
+		return (ARCHIVE_FATAL);
+	match = end == state->start + index->total_in &&
+	    index->total_in >= 8 &&
+	    __archive_read_filter_seek(self->upstream, end - 8,
+	      SEEK_SET) == end - 8 &&
+	    (p = __archive_read_filter_ahead(self->upstream, 8,
+	      NULL)) != NULL &&
+	    memcmp(p, index->trailer, 8) == 0;
+	if (__archive_read_filter_seek(self->upstream, state->start,
+	    SEEK_SET) != state->start)
+		return (ARCHIVE_FATAL);
+	return (match);
+}
+
+static int
+gzip_index_load(struct archive_read_filter *self, const char *path)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct gzip_index *index = &state->index;
+	unsigned char h[GZIP_INDEX_HEADER_SIZE];
+	struct gzip_checkpoint *c;
+	uint64_t count, i;
+	int64_t last_out = 0, span = index->span;
+	FILE *f;
+	int r;
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		/* Build it as we go, and save it on close. */
+		if (errno == ENOENT)
+			return (ARCHIVE_OK);
+		archive_set_error(&self->archive->archive, errno,
+		    "Can't open gzip index %s", path);
+		return (ARCHIVE_FATAL);
+	}
+	if (fread(h, sizeof(h), 1, f) != 1 ||
+	    memcmp(h, GZIP_INDEX_MAGIC, 8) != 0)
+		goto invalid;
+	index->span = (int64_t)archive_le64dec(h + 8);
+	index->total_out = (int64_t)archive_le64dec(h + 16);
+	count = archive_le64dec(h + 24);
+	index->total_in = (int64_t)archive_le64dec(h + 32);
+	memcpy(index->trailer, h + 40, 8);
+	if (index->span <= 0 || index->total_out < 0 ||
+	    index->total_in < 0 ||
+	    count > (uint64_t)index->total_out / index->span + 1)
+		goto invalid;
+	if (count > 0) {
+		index->checkpoints = (struct gzip_checkpoint *)calloc(
+		    (size_t)count, sizeof(*index->checkpoints));
+		if (index->checkpoints == NULL) {
+			fclose(f);
+			archive_set_error(&self->archive->archive, ENOMEM,
+			    "Can't allocate gzip index");
+			return (ARCHIVE_FATAL);
+		}
+		index->allocated = (size_t)count;
+	}
+	for (i = 0; i < count; i++) {
+		unsigned char ch[GZIP_CHECKPOINT_HEADER_SIZE];
+
+		c = &index->checkpoints[i];
+		if (fread(ch, sizeof(ch), 1, f) != 1)
+			goto invalid;
+		c->in = (int64_t)archive_le64dec(ch);
+		c->out = (int64_t)archive_le64dec(ch + 8);
+		c->bits = (int)archive_le32dec(ch + 16);
+		c->window_size = archive_le32dec(ch + 20);
+		c->window_compressed = archive_le64dec(ch + 24);
+		if (c->in <= 0 || c->out <= last_out ||
+		    c->out > index->total_out || c->bits > 7 ||
+		    c->window_size > GZIP_WINDOW_SIZE ||
+		    c->window_compressed == 0 ||
+		    c->window_compressed > compressBound(GZIP_WINDOW_SIZE))
+			goto invalid;
+		last_out = c->out;
+		c->window = (unsigned char *)malloc(c->window_compressed);
+		if (c->window == NULL) {
+			fclose(f);
+			archive_set_error(&self->archive->archive, ENOMEM,
+			    "Can't allocate gzip index");
+			return (ARCHIVE_FATAL);
+		}
+		index->count++;
+		if (fread(c->window, c->window_compressed, 1, f) != 1)
+			goto invalid;
+	}
+	if (fgetc(f) != EOF)
+		goto invalid;
+	fclose(f);
+
+	r = gzip_index_matches(self);
+	if (r < 0)
+		return (r);
+	if (r == 0) {
+		/* Stale; build a new one and save that on close. */
+		while (index->count > 0)
+			free(index->checkpoints[--index->count].window);
+		free(index->checkpoints);
+		index->checkpoints = NULL;
+		index->allocated = 0;
+		index->span = span;
+		return (ARCHIVE_OK);
+	}
+	index->complete = 1;
+	return (ARCHIVE_OK);
+invalid:
+	fclose(f);
+	archive_set_error(&self->archive->archive, ARCHIVE_ERRNO_FILE_FORMAT,
+	    "Invalid gzip index %s", path);
+	return (ARCHIVE_FATAL);
+}
+
+static int
+gzip_index_save(struct archive_read_filter *self, const char *path)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct gzip_index *index = &state->index;
+	unsigned char h[GZIP_INDEX_HEADER_SIZE];
+	const struct gzip_checkpoint *c;
+	size_t i;
+	FILE *f;
+	int ok;
+
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		archive_set_error(&self->archive->archive, errno,
+		    "Can't create gzip index %s", path);
+		return (ARCHIVE_WARN);
+	}
+	memcpy(h, GZIP_INDEX_MAGIC, 8);
+	archive_le64enc(h + 8, (uint64_t)index->span);
+	archive_le64enc(h + 16, (uint64_t)index->total_out);
+	archive_le64enc(h + 24, (uint64_t)index->count);
+	archive_le64enc(h + 32, (uint64_t)index->total_in);
+	memcpy(h + 40, index->trailer, 8);
+	ok = fwrite(h, sizeof(h), 1, f) == 1;
+	for (i = 0; ok && i < index->count; i++) {
+		unsigned char ch[GZIP_CHECKPOINT_HEADER_SIZE];
+
+		c = &index->checkpoints[i];
+		archive_le64enc(ch, (uint64_t)c->in);
+		archive_le64enc(ch + 8, (uint64_t)c->out);
+		archive_le32enc(ch + 16, (uint32_t)c->bits);
+		archive_le32enc(ch + 20, (uint32_t)c->window_size);
+		archive_le64enc(ch + 24, (uint64_t)c->window_compressed);
+		ok = fwrite(ch, sizeof(ch), 1, f) == 1 &&
+		    fwrite(c->window, c->window_compressed, 1, f) == 1;
+	}
+	if (fclose(f) != 0)
+		ok = 0;
+	if (!ok) {
+		archive_set_error(&self->archive->archive, errno,
+		    "Can't write gzip index %s", path);
+		remove(path);
+		return (ARCHIVE_WARN);
+	}
+	return (ARCHIVE_OK);
+}
+#endif /* GZIP_INDEX_SUPPORTED */
+
+#ifdef GZIP_PARALLEL_SUPPORTED
+/*
+ * Parallel decoding.
+ *
+ * Whenever the main stream is between two blocks, a batch of input is
+ * split into chunks of GZIP_CHUNK_SIZE bytes, twice that for the first.
+ * The first chunk is decoded by the main stream on the calling thread.
+ * For each of the others, a thread searches for the start of a block
+ * near the beginning of the chunk, then decodes from there up to the
+ * block boundary at or past the start of the next chunk.  Back-references
+ * into the output of earlier chunks can't be resolved while decoding, so
+ * each chunk is decoded twice, with marker dictionaries that together
+ * identify every byte copied from before the chunk.  Once all are done,
+ * the windows are filled in from the first chunk onwards.
+ *
+ * A search can land on something that merely looks like the start of a
+ * block.  A chunk is only used if the chunk before it, which is known to
+ * be right, stopped exactly where it starts; that makes the start a real
+ * block boundary.  Otherwise the batch ends early and the main stream
+ * takes over from where the last good chunk stopped, so the output never
+ * depends on the search.
+ */
+
+/*
+ * markers[0] holds the low byte of each window position, and
+ * markers[1] the same byte XORed with one more than its high bits, so
+ * that a byte copied from position k decodes differently in the two,
+ * and a literal alike.
+ */
+static int
+gzip_parallel_init(struct archive_read_filter *self, int threads)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	int i, k;
+
+	state->chunks = (struct gzip_chunk *)calloc(threads + 1,
+	    sizeof(*state->chunks));
+	state->markers[0] = (unsigned char *)malloc(GZIP_WINDOW_SIZE);
+	state->markers[1] = (unsigned char *)malloc(GZIP_WINDOW_SIZE);
+	if (state->chunks == NULL || state->markers[0] == NULL ||
+	    state->markers[1] == NULL) {
+		archive_set_error(&self->archive->archive, ENOMEM,
+		    "Can't allocate data for gzip decompression");
+		return (ARCHIVE_FATAL);
+	}
+	for (k = 0; k < GZIP_WINDOW_SIZE; k++) {
+		state->markers[0][k] = (unsigned char)(k & 0xff);
+		state->markers[1][k] =
+		    (unsigned char)((k & 0xff) ^ ((k >> 8) + 1));
+	}
+	for (i = 0; i <= threads; i++)
+		state->chunks[i].state = state;
+	state->threads = threads;
+	return (ARCHIVE_OK);
+}
+
+/* Forget the output of the last batch that hasn't been returned. */
+static void
+gzip_parallel_discard(struct private_data *state)
+{
+	state->chunks_decoded = 0;
+	state->chunks_returned = 0;
+}
+
+static void
+gzip_parallel_free(struct private_data *state)
+{
+	int i;
+
+	if (state->chunks != NULL) {
+		for (i = 0; i <= state->threads; i++) {
+			free(state->chunks[i].out[0]);
+			free(state->chunks[i].out[1]);
+		}
+		free(state->chunks);
+	}
+	free(state->markers[0]);
+	free(state->markers[1]);
+}
+
+/* Return n <= 16 bits starting at bit offset b, least significant first. */
+static unsigned
+gzip_bits(const unsigned char *in, int64_t b, int n)
+{
+	const unsigned char *q = in + (b >> 3);
+	uint32_t v;
+
+	v = q[0] | ((uint32_t)q[1] << 8) | ((uint32_t)q[2] << 16);
+	return ((unsigned)(v >> (b & 7)) & ((1U << n) - 1));
+}
+
+/*
+ * Cheaply rule out most bit offsets as the start of a block: it must
+ * have dynamic Huffman codes, not be the last block, have valid counts
+ * and a complete code length code.
+ */
+static int
+gzip_maybe_block(const unsigned char *in, int64_t b)
+{
+	unsigned hclen, i, len, kraft = 0;
+
+	if (gzip_bits(in, b, 3) != 4)
+		return (0);
+	if (gzip_bits(in, b + 3, 5) > 29 || gzip_bits(in, b + 8, 5) > 29)
+		return (0);
+	hclen = gzip_bits(in, b + 13, 4) + 4;
+	for (i = 0; i < hclen; i++) {
+		len = gzip_bits(in, b + 17 + 3 * i, 3);
+		if (len != 0)
+			kraft += 128 >> len;
+	}
+	return (kraft == 128);
+}
+
+/* Point s at bit offset b of the first size bytes of in. */
+static int
+gzip_prime(z_stream *s, const unsigned char *in, size_t size, int64_t b)
+{
+	size_t i = (size_t)(b >> 3);
+	int bits = (int)(b & 7);
+
+	if (bits != 0) {
+		if (inflatePrime(s, 8 - bits, in[i] >> bits) != Z_OK)
+			return (ARCHIVE_FATAL);
+		i++;
+	}
+	s->next_in = (unsigned char *)(uintptr_t)(in + i);
+	s->avail_in = (uInt)(size - i);
+	return (ARCHIVE_OK);
+}
+
+/* Whether a whole block decodes from bit offset b. */
+static int
+gzip_try_block(z_stream *s, struct gzip_chunk *chunk, int64_t b,
+    unsigned char *scratch)
+{
+	size_t size = chunk->in_size;
+	int ret;
+
+	if ((size_t)(b >> 3) + GZIP_CHUNK_SIZE < size)
+		size = (size_t)(b >> 3) + GZIP_CHUNK_SIZE;
+	if (inflateReset(s) != Z_OK ||
+	    gzip_prime(s, chunk->in, size, b) != ARCHIVE_OK)
+		return (0);
+	s->next_out = scratch;
+	s->avail_out = GZIP_WINDOW_SIZE;
+	/* The header first, which needs no dictionary. */
+	ret = inflate(s, Z_TREES);
+	if (ret != Z_OK || !(s->data_type & 256))
+		return (0);
+	if (inflateSetDictionary(s, chunk->state->markers[0],
+	    GZIP_WINDOW_SIZE) != Z_OK)
+		return (0);
+	for (;;) {
+		ret = inflate(s, Z_BLOCK);
+		if (ret == Z_STREAM_END)
+			return (1);
+		if (ret != Z_OK)
+			return (0);
+		if (s->data_type & 128)
+			return (1);
+		if (s->avail_out == 0) {
+			s->next_out = scratch;
+			s->avail_out = GZIP_WINDOW_SIZE;
+		}
+	}
+}
+
+/*
+ * Find the first block that starts in the chunk: one that looks like a
+ * dynamic block, or follows the empty stored block of a flush point,
+ * and decodes.
+ */
+static void *
+gzip_search_thread(void *arg)
+{
+	struct gzip_chunk *chunk = (struct gzip_chunk *)arg;
+	unsigned char *scratch;
+	int64_t b, last;
+	z_stream s;
+
+	/* Leave room for the longest block header. */
+	last = (int64_t)chunk->search + GZIP_CHUNK_SIZE;
+	if (last > (int64_t)chunk->in_size - 64)
+		last = (int64_t)chunk->in_size - 64;
+	memset(&s, 0, sizeof(s));
+	scratch = (unsigned char *)malloc(GZIP_WINDOW_SIZE);
+	if (scratch == NULL || inflateInit2(&s, -15) != Z_OK) {
+		free(scratch);
+		return (NULL);
+	}
+	for (b = (int64_t)chunk->search * 8; b < last * 8; b++) {
+		if (!gzip_maybe_block(chunk->in, b) &&
+		    ((b & 7) != 0 || b < 32 ||
+		     memcmp(chunk->in + (b >> 3) - 4, "\0\0\377\377", 4) != 0))
+			continue;
+		if (gzip_try_block(&s, chunk, b, scratch)) {
+			chunk->start = b;
+			chunk->found = 1;
+			break;
+		}
+	}
+	inflateEnd(&s);
+	free(scratch);
+	return (NULL);
+}
+
+static int
+gzip_chunk_grow(struct gzip_chunk *chunk, int which)
+{
+	size_t size = chunk->out_allocated[which];
+	unsigned char *p;
+
+	size = size == 0 ? 4 * GZIP_CHUNK_SIZE : size * 2;
+	p = (unsigned char *)realloc(chunk->out[which], size);
+	if (p == NULL)
+		return (ARCHIVE_FATAL);
+	chunk->out[which] = p;
+	chunk->out_allocated[which] = size;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Decode into chunk->out[which] until the first block boundary at or
+ * past chunk->target, or past GZIP_CHUNK_OUTPUT_MAX bytes of output,
+ * or the end of the deflate stream.  Bit offsets count from chunk->in.
+ */
+static void
+gzip_chunk_decode(z_stream *s, struct gzip_chunk *chunk, int which)
+{
+	int64_t pos;
+	int ret;
+
+	for (;;) {
+		if (chunk->out_size[which] == chunk->out_allocated[which] &&
+		    gzip_chunk_grow(chunk, which) != ARCHIVE_OK)
+			break;
+		s->next_out = chunk->out[which] + chunk->out_size[which];
+		s->avail_out = (uInt)(chunk->out_allocated[which] -
+		    chunk->out_size[which]);
+		ret = inflate(s, Z_BLOCK);
+		chunk->out_size[which] = s->next_out - chunk->out[which];
+		if (ret == Z_STREAM_END) {
+			/* The trailer starts at the next byte. */
+			chunk->end = (s->next_in - chunk->in) * (int64_t)8;
+			chunk->stream_end = 1;
+			return;
+		}
+		if (ret != Z_OK)
+			break;
+		if (s->data_type & 128) {
+			pos = (s->next_in - chunk->in) * (int64_t)8 -
+			    (s->data_type & 7);
+			if (pos >= chunk->target ||
+			    chunk->out_size[which] >= GZIP_CHUNK_OUTPUT_MAX) {
+				chunk->end = pos;
+				return;
+			}
+		}
+	}
+	chunk->failed = 1;
+}
+
+/* Decode a chunk with each marker dictionary. */
+static void *
+gzip_decode_thread(void *arg)
+{
+	struct gzip_chunk *chunk = (struct gzip_chunk *)arg;
+	int64_t end = 0;
+	int which;
+	z_stream s;
+
+	for (which = 0; which < 2 && !chunk->failed; which++) {
+		memset(&s, 0, sizeof(s));
+		if (inflateInit2(&s, -15) != Z_OK) {
+			chunk->failed = 1;
+			break;
+		}
+		if (gzip_prime(&s, chunk->in, chunk->in_size, chunk->start)
+		    != ARCHIVE_OK ||
+		    inflateSetDictionary(&s, chunk->state->markers[which],
+		      GZIP_WINDOW_SIZE) != Z_OK)
+			chunk->failed = 1;
+		else
+			gzip_chunk_decode(&s, chunk, which);
+		inflateEnd(&s);
+		/* The dictionary can't change where blocks end. */
+		if (which == 0)
+			end = chunk->end;
+		else if (chunk->end != end ||
+		    chunk->out_size[1] != chunk->out_size[0])
+			chunk->failed = 1;
+	}
+	return (NULL);
+}
+
+/*
+ * Run fn on chunks first to last on threads of their own, or on this
+ * one if a thread can't be created.
+ */
+static void
+gzip_threads_start(struct gzip_chunk *chunks, int first, int last,
+    void *(*fn)(void *), char *started)
+{
+	int i;
+
+	for (i = first; i <= last; i++) {
+		started[i] = pthread_create(&chunks[i].thread, NULL, fn,
+		    &chunks[i]) == 0;
+		if (!started[i])
+			fn(&chunks[i]);
+	}
+}
+
+static void
+gzip_threads_join(struct gzip_chunk *chunks, int first, int last,
+    const char *started)
+{
+	int i;
+
+	for (i = first; i <= last; i++)
+		if (started[i])
+			pthread_join(chunks[i].thread, NULL);
+}
+
+/*
+ * Replace the bytes of out that came from before the chunk, which
+ * differ from those in alt, with the window bytes they stand for.
+ */
+static void
+gzip_resolve(unsigned char *out, const unsigned char *alt, size_t size,
+    const unsigned char *window)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (out[i] != alt[i])
+			out[i] = window[out[i] |
+			    ((((out[i] ^ alt[i]) - 1) & 0x7f) << 8)];
+	}
+}
+
+/* Slide the window over the next size bytes of output. */
+static void
+gzip_window_append(unsigned char *window, const unsigned char *p,
+    size_t size)
+{
+	if (size >= GZIP_WINDOW_SIZE) {
+		memcpy(window, p + size - GZIP_WINDOW_SIZE, GZIP_WINDOW_SIZE);
+		return;
+	}
+	memmove(window, window + size, GZIP_WINDOW_SIZE - size);
+	memcpy(window + GZIP_WINDOW_SIZE - size, p, size);
+}
+
+/*
+ * Decode a batch, leaving the main stream where it ends.  Returns 1 if
+ * there is output to return, 0 if the caller should decode serially,
+ * or ARCHIVE_FATAL.
+ */
+static int
+gzip_parallel_batch(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct gzip_chunk *chunks = state->chunks;
+	char started[GZIP_THREADS_MAX + 1];
+	const unsigned char *in;
+	ssize_t avail;
+	uInt window_size;
+	int64_t end;
+	int byte, found, i, m, n, ret;
+
+	n = state->threads;
+	in = __archive_read_filter_ahead(self->upstream,
+	    (size_t)(n + 2) * GZIP_CHUNK_SIZE, &avail);
+	if (in == NULL) {
+		/* Too close to the end to be worth it. */
+		state->parallel_resume = INT64_MAX;
+		return (0);
+	}
+
+	/* The window the first chunk's output follows. */
+	window_size = GZIP_WINDOW_SIZE;
+	if (inflateGetDictionary(&(state->stream), state->window,
+	    &window_size) != Z_OK)
+		return (0);
+	memmove(state->window + GZIP_WINDOW_SIZE - window_size,
+	    state->window, window_size);
+	memset(state->window, 0, GZIP_WINDOW_SIZE - window_size);
+
+	for (i = 0; i <= n; i++) {
+		chunks[i].in = in;
+		chunks[i].in_size = (size_t)avail;
+		chunks[i].search = (size_t)(i + 1) * GZIP_CHUNK_SIZE;
+		chunks[i].start = 0;
+		chunks[i].end = 0;
+		chunks[i].found = i == 0;
+		chunks[i].failed = 0;
+		chunks[i].stream_end = 0;
+		chunks[i].out_size[0] = chunks[i].out_size[1] = 0;
+	}
+
+	/* Find where chunks 1 to n start; chunk n only ends chunk n - 1. */
+	gzip_threads_start(chunks, 1, n, gzip_search_thread, started);
+	gzip_threads_join(chunks, 1, n, started);
+	for (found = 0; found < n && chunks[found + 1].found; found++)
+		chunks[found].target = chunks[found + 1].start;
+	if (found == 0) {
+		state->parallel_resume = self->upstream->position +
+		    2 * GZIP_CHUNK_SIZE;
+		return (0);
+	}
+
+	/* Decode chunks 0 to found - 1. */
+	gzip_threads_start(chunks, 1, found - 1, gzip_decode_thread,
+	    started);
+	state->stream.next_in = (unsigned char *)(uintptr_t)in;
+	state->stream.avail_in = (uInt)avail;
+	gzip_chunk_decode(&(state->stream), &chunks[0], 0);
+	gzip_threads_join(chunks, 1, found - 1, started);
+	if (chunks[0].failed) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "gzip decompression failed");
+		return (ARCHIVE_FATAL);
+	}
+
+	/* Keep the chunks that start where the one before stopped. */
+	for (m = 0; m + 1 < found && !chunks[m].stream_end &&
+	    chunks[m].end == chunks[m + 1].start && !chunks[m + 1].failed;
+	    m++)
+		;
+	gzip_window_append(state->window, chunks[0].out[0],
+	    chunks[0].out_size[0]);
+	for (i = 1; i <= m; i++) {
+		gzip_resolve(chunks[i].out[0], chunks[i].out[1],
+		    chunks[i].out_size[0], state->window);
+		gzip_window_append(state->window, chunks[i].out[0],
+		    chunks[i].out_size[0]);
+	}
+	for (i = 0; i <= m; i++)
+		gzip_member_update(state, chunks[i].out[0],
+		    chunks[i].out_size[0]);
+
+	/* Carry on from the end of chunk m. */
+	end = chunks[m].end;
+	if (m == 0) {
+		__archive_read_filter_consume(self->upstream,
+		    (const unsigned char *)state->stream.next_in - in);
+		/* Speculation failed; give the input a chance to change. */
+		if (found > 1)
+			state->parallel_resume = self->upstream->position +
+			    (int64_t)n * GZIP_CHUNK_SIZE;
+	} else if (chunks[m].stream_end) {
+		__archive_read_filter_consume(self->upstream, end >> 3);
+	} else {
+		byte = in[end >> 3];
+		__archive_read_filter_consume(self->upstream,
+		    (end >> 3) + ((end & 7) != 0));
+		if (inflateReset(&(state->stream)) != Z_OK ||
+		    ((end & 7) != 0 && inflatePrime(&(state->stream),
+		      8 - (int)(end & 7), byte >> (end & 7)) != Z_OK) ||
+		    inflateSetDictionary(&(state->stream), state->window,
+		      GZIP_WINDOW_SIZE) != Z_OK) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "gzip decompression failed");
+			return (ARCHIVE_FATAL);
+		}
+	}
+	state->at_boundary = !chunks[m].stream_end;
+	if (chunks[m].stream_end) {
+		ret = consume_trailer(self);
+		if (ret < ARCHIVE_OK)
+			return (ret);
+	}
+	state->chunks_decoded = m + 1;
+	state->chunks_returned = 0;
+	return (1);
+}
+
+/*
+ * Return the next chunk of output of the current batch, decoding a new
+ * batch if the main stream is at a block boundary.  Returns 0 if the
+ * caller should decode serially.
+ */
+static ssize_t
+gzip_parallel_read(struct archive_read_filter *self, const void **p)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct gzip_chunk *chunk;
+	int ret;
+
+	for (;;) {
+		while (state->chunks_returned < state->chunks_decoded) {
+			chunk = &state->chunks[state->chunks_returned++];
+			if (chunk->out_size[0] > 0) {
+				*p = chunk->out[0];
+				state->total_out += chunk->out_size[0];
+				return ((ssize_t)chunk->out_size[0]);
+			}
+		}
+		if (state->eof || !state->in_stream || !state->at_boundary ||
+		    (state->indexed && !state->index.complete) ||
+		    self->upstream->position < state->parallel_resume)
+			return (0);
+		ret = gzip_parallel_batch(self);
+		if (ret <= 0)
+			return (ret);
+	}
+}
+#endif /* GZIP_PARALLEL_SUPPORTED */
+
 /*
  * Clean up the decompressor.
  */
@@ -469,6 +1789,22 @@ gzip_filter_close(struct archive_read_filter *self)
 		}
 	}
 
+#ifdef GZIP_INDEX_SUPPORTED
+	if (state->index_built) {
+		struct gzip_options *opts =
+		    (struct gzip_options *)self->bidder->data;
+
+		if (opts->index_file != NULL && ret == ARCHIVE_OK)
+			ret = gzip_index_save(self, opts->index_file);
+	}
+	while (state->index.count > 0)
+		free(state->index.checkpoints[--state->index.count].window);
+	free(state->index.checkpoints);
+	free(state->window);
+#endif
+#ifdef GZIP_PARALLEL_SUPPORTED
+	gzip_parallel_free(state);
+#endif
 	free(state->out_block);
 	free(state);
 	return (ret);
@@ -195,6 +195,7 @@ static int	archive_read_format_tar_bid(struct archive_read *, int);
 static int	archive_read_format_tar_options(struct archive_read *,
 		    const char *, const char *);
 static int	archive_read_format_tar_cleanup(struct archive_read *);
+static int	archive_read_format_tar_capabilities(struct archive_read *);
 static int	archive_read_format_tar_read_data(struct archive_read *a,
 		    const void **buff, size_t *size, int64_t *offset);
 static int	archive_read_format_tar_skip(struct archive_read *a);
@@ -261,7 +262,7 @@ archive_read_support_format_tar(struct archive *_a)
 	    archive_read_format_tar_skip,
 	    NULL,
 	    archive_read_format_tar_cleanup,
-	    NULL,
+	    archive_read_format_tar_capabilities,
 	    NULL);
 
 	if (r != ARCHIVE_OK)
@@ -407,6 +408,17 @@ archive_read_format_tar_options(struct archive_read *a,
 	return (ARCHIVE_WARN);
 }
 
+/*
+ * Every entry begins with a header that depends on nothing read
+ * before it, so reading can restart at any header.
+ */
+static int
+archive_read_format_tar_capabilities(struct archive_read *a)
+{
+	(void)a; /* UNUSED */
+	return (ARCHIVE_READ_FORMAT_CAPS_SEEK_HEADER);
+}
+
 /* utility function- this exists to centralize the logic of tracking
  * how much unconsumed data we have floating around, and to consume
  * anything outstanding since we're going to do read_aheads
@@ -110,6 +110,8 @@ struct private_data {
 	int64_t		 total_out;
 	/* the CRC32 value of uncompressed data for lzip */
 	uint32_t	 crc32;
+	/* Options changed after open; start a new xz stream. */
+	int		 restart_stream;
 };
 
 static int	archive_compressor_xz_options(struct archive_write_filter *,
@@ -121,6 +123,8 @@ static int	archive_compressor_xz_close(struct archive_write_filter *);
 static int	archive_compressor_xz_free(struct archive_write_filter *);
 static int	drive_compressor(struct archive_write_filter *,
 		    struct private_data *, int finishing);
+static int	restart_stream(struct archive_write_filter *,
+		    struct private_data *);
 
 struct option_value {
 	uint32_t dict_size;
@@ -176,6 +180,7 @@ archive_write_add_filter_xz(struct archive *_a)
 	if (r == ARCHIVE_OK) {
 		f->code = ARCHIVE_FILTER_XZ;
 		f->name = "xz";
+		f->options_after_open = 1;
 	}
 	return (r);
 }
@@ -364,6 +369,7 @@ archive_compressor_xz_open(struct archive_write_filter *f)
 		data->lzmafilters[0].options = &data->lzma_opt;
 		data->lzmafilters[1].id = LZMA_VLI_UNKNOWN;/* Terminate */
 	}
+	data->restart_stream = 0;
 	ret = archive_compressor_xz_init_stream(f, data);
 	if (ret == LZMA_OK) {
 		f->data = data;
@@ -380,6 +386,8 @@ archive_compressor_xz_options(struct archive_write_filter *f,
     const char *key, const char *value)
 {
 	struct private_data *data = (struct private_data *)f->data;
+	int level = data->compression_level;
+	uint32_t threads = data->threads;
 
 	if (strcmp(key, "compression-level") == 0) {
 		if (value == NULL || !(value[0] >= '0' && value[0] <= '9') ||
@@ -388,7 +396,6 @@ archive_compressor_xz_options(struct archive_write_filter *f,
 		data->compression_level = value[0] - '0';
 		if (data->compression_level > 6)
 			data->compression_level = 6;
-		return (ARCHIVE_OK);
 	} else if (strcmp(key, "threads") == 0) {
 		if (value == NULL)
 			return (ARCHIVE_WARN);
@@ -404,13 +411,18 @@ archive_compressor_xz_options(struct archive_write_filter *f,
 			data->threads = 1;
 #endif
 		}
-		return (ARCHIVE_OK);
+	} else {
+		/* Note: The "warn" return is just to inform the options
+		 * supervisor that we didn't handle it.  It will generate
+		 * a suitable error if no one used this option. */
+		return (ARCHIVE_WARN);
 	}
 
-	/* Note: The "warn" return is just to inform the options
-	 * supervisor that we didn't handle it.  It will generate
-	 * a suitable error if no one used this option. */
-	return (ARCHIVE_WARN);
+	/* Only xz accepts options after open; the change takes effect
+	 * with the next write. */
+	if (data->compression_level != level || data->threads != threads)
+		data->restart_stream = 1;
+	return (ARCHIVE_OK);
 }
 
 /*
@@ -428,6 +440,10 @@ archive_compressor_xz_write(struct archive_write_filter *f,
 	if (f->code == ARCHIVE_FILTER_LZIP)
 		data->crc32 = lzma_crc32(buff, length, data->crc32);
 
+	if (data->restart_stream &&
+	    (ret = restart_stream(f, data)) != ARCHIVE_OK)
+		return (ret);
+
 	/* Compress input data to output buffer */
 	data->stream.next_in = buff;
 	data->stream.avail_in = length;
@@ -438,6 +454,41 @@ archive_compressor_xz_write(struct archive_write_filter *f,
 }
 
 
+/*
+ * Finish the current xz stream and begin another one with the new
+ * compression level and thread count.  xz decoders, including ours,
+ * read concatenated streams as a single one.  Output already in the
+ * buffer is kept.
+ */
+static int
+restart_stream(struct archive_write_filter *f, struct private_data *data)
+{
+	uint8_t *next_out;
+	size_t avail_out;
+	int ret;
+
+	data->stream.avail_in = 0;
+	ret = drive_compressor(f, data, 1);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+	next_out = data->stream.next_out;
+	avail_out = data->stream.avail_out;
+	lzma_end(&(data->stream));
+
+	if (lzma_lzma_preset(&data->lzma_opt, data->compression_level)) {
+		archive_set_error(f->archive, ARCHIVE_ERRNO_MISC,
+		    "Internal error initializing compression library");
+		return (ARCHIVE_FATAL);
+	}
+	ret = archive_compressor_xz_init_stream(f, data);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+	data->stream.next_out = next_out;
+	data->stream.avail_out = avail_out;
+	data->restart_stream = 0;
+	return (ARCHIVE_OK);
+}
+
 /*
  * Finish the compression...
  */
@@ -429,6 +429,10 @@ archive_write_disk_set_options(struct archive *_a, int flags)
 {
 	struct archive_write_disk *a = (struct archive_write_disk *)_a;
 
+#ifdef HAVE_TC_API_H
+	if (_a->magic == ARCHIVE_WRITE_DISK_TC_MAGIC)
+		return (__archive_write_disk_tc_set_options(_a, flags));
+#endif
 	a->flags = flags;
 	return (ARCHIVE_OK);
 }
@@ -745,6 +749,11 @@ int
 archive_write_disk_set_skip_file(struct archive *_a, int64_t d, int64_t i)
 {
 	struct archive_write_disk *a = (struct archive_write_disk *)_a;
+#ifdef HAVE_TC_API_H
+	/* Nothing extracted to tc storage can be the archive itself. */
+	if (_a->magic == ARCHIVE_WRITE_DISK_TC_MAGIC)
+		return (ARCHIVE_OK);
+#endif
 	archive_check_magic(&a->archive, ARCHIVE_WRITE_DISK_MAGIC,
 	    ARCHIVE_STATE_ANY, "archive_write_disk_set_skip_file");
 	a->skip_file_set = 1;
@@ -1694,6 +1703,11 @@ archive_write_disk_set_group_lookup(struct archive *_a,
     void (*cleanup_gid)(void *private))
 {
 	struct archive_write_disk *a = (struct archive_write_disk *)_a;
+#ifdef HAVE_TC_API_H
+	if (_a->magic == ARCHIVE_WRITE_DISK_TC_MAGIC)
+		return (__archive_write_disk_tc_set_lookup(_a, 0,
+		    private_data, lookup_gid, cleanup_gid));
+#endif
 	archive_check_magic(&a->archive, ARCHIVE_WRITE_DISK_MAGIC,
 	    ARCHIVE_STATE_ANY, "archive_write_disk_set_group_lookup");
 
@@ -1713,6 +1727,11 @@ archive_write_disk_set_user_lookup(struct archive *_a,
     void (*cleanup_uid)(void *private))
 {
 	struct archive_write_disk *a = (struct archive_write_disk *)_a;
+#ifdef HAVE_TC_API_H
+	if (_a->magic == ARCHIVE_WRITE_DISK_TC_MAGIC)
+		return (__archive_write_disk_tc_set_lookup(_a, 1,
+		    private_data, lookup_uid, cleanup_uid));
+#endif
 	archive_check_magic(&a->archive, ARCHIVE_WRITE_DISK_MAGIC,
 	    ARCHIVE_STATE_ANY, "archive_write_disk_set_user_lookup");
 
@@ -1729,6 +1748,10 @@ int64_t
 archive_write_disk_gid(struct archive *_a, const char *name, int64_t id)
 {
        struct archive_write_disk *a = (struct archive_write_disk *)_a;
+#ifdef HAVE_TC_API_H
+       if (_a->magic == ARCHIVE_WRITE_DISK_TC_MAGIC)
+               return (__archive_write_disk_tc_id(_a, 0, name, id));
+#endif
        archive_check_magic(&a->archive, ARCHIVE_WRITE_DISK_MAGIC,
            ARCHIVE_STATE_ANY, "archive_write_disk_gid");
        if (a->lookup_gid)
@@ -1740,6 +1763,10 @@ int64_t
 archive_write_disk_uid(struct archive *_a, const char *name, int64_t id)
 {
 	struct archive_write_disk *a = (struct archive_write_disk *)_a;
+#ifdef HAVE_TC_API_H
+	if (_a->magic == ARCHIVE_WRITE_DISK_TC_MAGIC)
+		return (__archive_write_disk_tc_id(_a, 1, name, id));
+#endif
 	archive_check_magic(&a->archive, ARCHIVE_WRITE_DISK_MAGIC,
 	    ARCHIVE_STATE_ANY, "archive_write_disk_uid");
 	if (a->lookup_uid)
@@ -40,4 +40,12 @@ struct archive_write_disk;
 int
 archive_write_disk_set_acls(struct archive *, int /* fd */, const char * /* pathname */, struct archive_acl *);
 
+/* Setters of archive_write_disk_tc, reached through the generic ones. */
+int	__archive_write_disk_tc_set_options(struct archive *, int);
+int	__archive_write_disk_tc_set_lookup(struct archive *, int /* user */,
+	    void *, int64_t (*)(void *, const char *, int64_t),
+	    void (*)(void *));
+int64_t	__archive_write_disk_tc_id(struct archive *, int /* user */,
+	    const char *, int64_t);
+
 #endif
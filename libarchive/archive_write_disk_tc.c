@@ -0,0 +1,1199 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_TC_API_H
+#include <tc_api.h>
+#endif
+
+#include "archive.h"
+
+#ifndef HAVE_TC_API_H
+
+struct archive *
+archive_write_disk_tc_new(void)
+{
+	return (NULL);
+}
+
+int
+archive_write_disk_tc_set_batch_size(struct archive *_a, int max_ops,
+    size_t max_bytes)
+{
+	(void)_a; /* UNUSED */
+	(void)max_ops; /* UNUSED */
+	(void)max_bytes; /* UNUSED */
+	return (ARCHIVE_FATAL);
+}
+
+#else	/* Support tc I/O */
+
+#include "archive_entry.h"
+#include "archive_private.h"
+#include "archive_rb.h"
+#include "archive_write_disk_private.h"
+
+/*
+ * archive_write_disk_tc extracts entries to tc storage, usually a remote
+ * NFS server.  Instead of a sequence of system calls per entry, it queues
+ * the operations needed to create each entry and sends them as a few large
+ * compounds once max_ops operations or max_bytes bytes of file data are
+ * queued, or when the archive is closed.  Within a batch the compounds run
+ * in this order:
+ *
+ *   mkdirs, symlinks, writes, hardlinks, setattrs
+ *
+ * so parents exist before their children, and files are complete before
+ * they are linked and before their metadata is restored.  As with
+ * archive_write_disk_posix, directory metadata is restored on close,
+ * deepest first, so that extracting into a directory is not prevented by
+ * its final permissions.
+ *
+ * Because operations are deferred, an error may be reported by a later
+ * call than the one that queued the failing operation.  Likewise, the
+ * checks of ARCHIVE_EXTRACT_SECURE_SYMLINKS cover the symlinks this
+ * object queues, since looking up every component on the server would
+ * take a compound per entry; symlinks that already exist there are not
+ * detected.  tc has no
+ * interface for ACLs, extended attributes, file flags or device nodes, so
+ * those are not restored.
+ *
+ * Existing files are overwritten in place.  Whether a file exists is only
+ * known once its batch is sent, too late to skip or unlink it, so the
+ * flags that ask for that are refused rather than ignored.
+ */
+
+#define DEFAULT_MAX_OPS		256
+#define DEFAULT_MAX_BYTES	(32 * 1024 * 1024)
+#define DEFAULT_DIR_MODE	0777
+#define MINIMUM_DIR_MODE	0700
+
+/* A growable array of operations of one kind. */
+struct op_list {
+	void		*items;
+	int		 count;
+	int		 size;
+	size_t		 elem_size;
+};
+
+struct known_path {
+	struct archive_rb_node	 node;
+	struct known_path	*next;
+	/* Queued as a symlink rather than a directory. */
+	int			 symlink;
+	char			 name[1];
+};
+
+struct archive_write_disk_tc {
+	struct archive	archive;
+
+	int		 flags;
+	mode_t		 user_umask;
+	int		 max_ops;
+	size_t		 max_bytes;
+	int64_t		 total_bytes_written;
+
+	int64_t		(*lookup_gid)(void *private, const char *gname,
+			    int64_t gid);
+	void		(*cleanup_gid)(void *private);
+	void		*lookup_gid_data;
+	int64_t		(*lookup_uid)(void *private, const char *uname,
+			    int64_t uid);
+	void		(*cleanup_uid)(void *private);
+	void		*lookup_uid_data;
+
+	/* The entry being extracted. */
+	struct archive_entry	*entry;
+	char		*name;
+	int64_t		 filesize;
+	int64_t		 offset;
+	/* Whether the file was created by a write already. */
+	int		 created;
+	/*
+	 * The queued write that data at its end extends, or -1: the index
+	 * of its iovec, of its data in owned, and the size of that data.
+	 */
+	int		 extent;
+	int		 extent_data;
+	size_t		 extent_size;
+
+	/* The operations of the current batch. */
+	struct op_list	 mkdirs;		/* struct tc_attrs */
+	struct op_list	 symlink_targets;	/* const char * */
+	struct op_list	 symlink_paths;		/* const char * */
+	struct op_list	 writes;		/* struct tc_iovec */
+	struct op_list	 hardlink_targets;	/* const char * */
+	struct op_list	 hardlink_paths;	/* const char * */
+	struct op_list	 setattrs;		/* struct tc_attrs */
+	int		 ops;
+	size_t		 bytes;
+	/* Paths and data referenced by the batch, freed once it is sent. */
+	struct op_list	 owned;			/* void * */
+
+	/* Directory metadata restored on close, with owned paths. */
+	struct op_list	 dir_fixups;		/* struct tc_attrs */
+
+	/*
+	 * Directories created or queued, so parents are made only once, and
+	 * symlinks queued, so nothing is extracted through them unawares.
+	 */
+	struct archive_rb_tree	 known_paths;
+	struct known_path	*known_paths_list;
+};
+
+enum op_kind {
+	OP_MKDIR, OP_SYMLINK, OP_WRITE, OP_HARDLINK, OP_SETATTR
+};
+
+static struct archive_vtable *archive_write_disk_tc_vtable(void);
+
+static int	_archive_write_disk_tc_close(struct archive *);
+static int	_archive_write_disk_tc_free(struct archive *);
+static int	_archive_write_disk_tc_header(struct archive *,
+		    struct archive_entry *);
+static int64_t	_archive_write_disk_tc_filter_bytes(struct archive *, int);
+static int	_archive_write_disk_tc_finish_entry(struct archive *);
+static ssize_t	_archive_write_disk_tc_data(struct archive *, const void *,
+		    size_t);
+static ssize_t	_archive_write_disk_tc_data_block(struct archive *,
+		    const void *, size_t, int64_t);
+static int	flush_batch(struct archive_write_disk_tc *);
+
+static struct archive_vtable *
+archive_write_disk_tc_vtable(void)
+{
+	static struct archive_vtable av;
+	static int inited = 0;
+
+	if (!inited) {
+		av.archive_close = _archive_write_disk_tc_close;
+		av.archive_filter_bytes = _archive_write_disk_tc_filter_bytes;
+		av.archive_free = _archive_write_disk_tc_free;
+		av.archive_write_header = _archive_write_disk_tc_header;
+		av.archive_write_finish_entry
+		    = _archive_write_disk_tc_finish_entry;
+		av.archive_write_data = _archive_write_disk_tc_data;
+		av.archive_write_data_block = _archive_write_disk_tc_data_block;
+		inited = 1;
+	}
+	return (&av);
+}
+
+static int
+known_path_cmp_node(const struct archive_rb_node *n1,
+    const struct archive_rb_node *n2)
+{
+	const struct known_path *d1 = (const struct known_path *)n1;
+	const struct known_path *d2 = (const struct known_path *)n2;
+
+	return (strcmp(d2->name, d1->name));
+}
+
+static int
+known_path_cmp_key(const struct archive_rb_node *n, const void *key)
+{
+	const struct known_path *d = (const struct known_path *)n;
+
+	return (strcmp((const char *)key, d->name));
+}
+
+/*
+ * Create a new archive_write_disk object that extracts to tc storage.
+ * tc_init() must have been called by the application.
+ */
+struct archive *
+archive_write_disk_tc_new(void)
+{
+	static const struct archive_rb_tree_ops rb_ops = {
+		known_path_cmp_node, known_path_cmp_key
+	};
+	struct archive_write_disk_tc *a;
+
+	a = (struct archive_write_disk_tc *)calloc(1, sizeof(*a));
+	if (a == NULL)
+		return (NULL);
+	a->archive.magic = ARCHIVE_WRITE_DISK_TC_MAGIC;
+	/* We're ready to write a header immediately. */
+	a->archive.state = ARCHIVE_STATE_HEADER;
+	a->archive.vtable = archive_write_disk_tc_vtable();
+	/* Query and restore the umask. */
+	umask(a->user_umask = umask(0));
+	a->max_ops = DEFAULT_MAX_OPS;
+	a->max_bytes = DEFAULT_MAX_BYTES;
+	a->extent = -1;
+	a->mkdirs.elem_size = sizeof(struct tc_attrs);
+	a->symlink_targets.elem_size = sizeof(const char *);
+	a->symlink_paths.elem_size = sizeof(const char *);
+	a->writes.elem_size = sizeof(struct tc_iovec);
+	a->hardlink_targets.elem_size = sizeof(const char *);
+	a->hardlink_paths.elem_size = sizeof(const char *);
+	a->setattrs.elem_size = sizeof(struct tc_attrs);
+	a->owned.elem_size = sizeof(void *);
+	a->dir_fixups.elem_size = sizeof(struct tc_attrs);
+	__archive_rb_tree_init(&a->known_paths, &rb_ops);
+	return (&a->archive);
+}
+
+/*
+ * Send the queued operations once @max_ops of them, or @max_bytes bytes of
+ * file data, are queued.
+ */
+int
+archive_write_disk_tc_set_batch_size(struct archive *_a, int max_ops,
+    size_t max_bytes)
+{
+	struct archive_write_disk_tc *a = (struct archive_write_disk_tc *)_a;
+
+	archive_check_magic(&a->archive, ARCHIVE_WRITE_DISK_TC_MAGIC,
+	    ARCHIVE_STATE_ANY, "archive_write_disk_tc_set_batch_size");
+	if (max_ops < 1 || max_bytes < 1) {
+		archive_set_error(&a->archive, EINVAL,
+		    "Invalid batch size");
+		return (ARCHIVE_FAILED);
+	}
+	a->max_ops = max_ops;
+	a->max_bytes = max_bytes;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * The generic archive_write_disk setters forward here when given an
+ * archive_write_disk_tc object.
+ */
+int
+__archive_write_disk_tc_set_options(struct archive *_a, int flags)
+{
+	struct archive_write_disk_tc *a = (struct archive_write_disk_tc *)_a;
+
+	if (flags & (ARCHIVE_EXTRACT_NO_OVERWRITE |
+	    ARCHIVE_EXTRACT_NO_OVERWRITE_NEWER | ARCHIVE_EXTRACT_UNLINK)) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "tc extraction always overwrites existing files");
+		return (ARCHIVE_FAILED);
+	}
+	a->flags = flags;
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_write_disk_tc_set_lookup(struct archive *_a, int user,
+    void *private_data, int64_t (*lookup)(void *, const char *, int64_t),
+    void (*cleanup)(void *))
+{
+	struct archive_write_disk_tc *a = (struct archive_write_disk_tc *)_a;
+
+	if (user) {
+		if (a->cleanup_uid != NULL && a->lookup_uid_data != NULL)
+			(a->cleanup_uid)(a->lookup_uid_data);
+		a->lookup_uid = lookup;
+		a->cleanup_uid = cleanup;
+		a->lookup_uid_data = private_data;
+	} else {
+		if (a->cleanup_gid != NULL && a->lookup_gid_data != NULL)
+			(a->cleanup_gid)(a->lookup_gid_data);
+		a->lookup_gid = lookup;
+		a->cleanup_gid = cleanup;
+		a->lookup_gid_data = private_data;
+	}
+	return (ARCHIVE_OK);
+}
+
+int64_t
+__archive_write_disk_tc_id(struct archive *_a, int user, const char *name,
+    int64_t id)
+{
+	struct archive_write_disk_tc *a = (struct archive_write_disk_tc *)_a;
+
+	if (user && a->lookup_uid)
+		return (a->lookup_uid)(a->lookup_uid_data, name, id);
+	if (!user && a->lookup_gid)
+		return (a->lookup_gid)(a->lookup_gid_data, name, id);
+	return (id);
+}
+
+static int64_t
+_archive_write_disk_tc_filter_bytes(struct archive *_a, int n)
+{
+	struct archive_write_disk_tc *a = (struct archive_write_disk_tc *)_a;
+
+	if (n == -1 || n == 0)
+		return (a->total_bytes_written);
+	return (-1);
+}
+
+/* Append a zeroed element to @l. */
+static void *
+op_list_add(struct archive_write_disk_tc *a, struct op_list *l)
+{
+	void *p;
+	int size;
+
+	if (l->count == l->size) {
+		size = l->size < 16 ? 16 : l->size * 2;
+		p = realloc(l->items, size * l->elem_size);
+		if (p == NULL) {
+			archive_set_error(&a->archive, ENOMEM, "No memory");
+			return (NULL);
+		}
+		l->items = p;
+		l->size = size;
+	}
+	p = (char *)l->items + l->count++ * l->elem_size;
+	memset(p, 0, l->elem_size);
+	return (p);
+}
+
+/* Allocate memory that lives until the current batch is sent. */
+static void *
+batch_alloc(struct archive_write_disk_tc *a, size_t size)
+{
+	void **slot;
+	void *p;
+
+	slot = (void **)op_list_add(a, &a->owned);
+	if (slot == NULL)
+		return (NULL);
+	p = malloc(size > 0 ? size : 1);
+	if (p == NULL) {
+		a->owned.count--;
+		archive_set_error(&a->archive, ENOMEM, "No memory");
+		return (NULL);
+	}
+	*slot = p;
+	return (p);
+}
+
+static char *
+batch_strdup(struct archive_write_disk_tc *a, const char *s)
+{
+	char *p = (char *)batch_alloc(a, strlen(s) + 1);
+
+	if (p != NULL)
+		strcpy(p, s);
+	return (p);
+}
+
+/* Fill @attrs with the metadata to restore from the current entry. */
+static void
+entry_attrs(struct archive_write_disk_tc *a, struct tc_attrs *attrs,
+    const char *path)
+{
+	struct archive_entry *entry = a->entry;
+	mode_t mode = archive_entry_mode(entry);
+
+	attrs->file = tc_file_from_path(path);
+	attrs->masks = TC_ATTRS_MASK_NONE;
+	attrs->masks.has_mode = 1;
+	if (a->flags & ARCHIVE_EXTRACT_PERM)
+		attrs->mode = mode & 07777;
+	else
+		attrs->mode = mode & 0777 & ~a->user_umask;
+	if (a->flags & ARCHIVE_EXTRACT_OWNER) {
+		attrs->masks.has_uid = 1;
+		attrs->uid = (uid_t)__archive_write_disk_tc_id(&a->archive, 1,
+		    archive_entry_uname(entry), archive_entry_uid(entry));
+		attrs->masks.has_gid = 1;
+		attrs->gid = (gid_t)__archive_write_disk_tc_id(&a->archive, 0,
+		    archive_entry_gname(entry), archive_entry_gid(entry));
+	}
+	if (a->flags & ARCHIVE_EXTRACT_TIME) {
+		if (archive_entry_mtime_is_set(entry)) {
+			attrs->masks.has_mtime = 1;
+			attrs->mtime.tv_sec = archive_entry_mtime(entry);
+			attrs->mtime.tv_nsec = archive_entry_mtime_nsec(entry);
+		}
+		if (archive_entry_atime_is_set(entry)) {
+			attrs->masks.has_atime = 1;
+			attrs->atime.tv_sec = archive_entry_atime(entry);
+			attrs->atime.tv_nsec = archive_entry_atime_nsec(entry);
+		}
+	}
+}
+
+/*
+ * Canonicalize @path in place: drop "." components, repeated and trailing
+ * slashes, and reject what the security flags forbid.
+ */
+static int
+cleanup_pathname(struct archive_write_disk_tc *a, char *path)
+{
+	char *src = path, *dest = path;
+
+	if (*src == '\0') {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Invalid empty pathname");
+		return (ARCHIVE_FAILED);
+	}
+	if (*src == '/') {
+		if (a->flags & ARCHIVE_EXTRACT_SECURE_NOABSOLUTEPATHS) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "Path is absolute");
+			return (ARCHIVE_FAILED);
+		}
+		*dest++ = *src++;
+	}
+	while (*src != '\0') {
+		if (*src == '/') {
+			src++;
+			continue;
+		}
+		if (src[0] == '.' && (src[1] == '/' || src[1] == '\0')) {
+			src++;
+			continue;
+		}
+		if (src[0] == '.' && src[1] == '.' &&
+		    (src[2] == '/' || src[2] == '\0') &&
+		    (a->flags & ARCHIVE_EXTRACT_SECURE_NODOTDOT)) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "Path contains '..'");
+			return (ARCHIVE_FAILED);
+		}
+		if (dest > path && dest[-1] != '/')
+			*dest++ = '/';
+		while (*src != '\0' && *src != '/')
+			*dest++ = *src++;
+	}
+	if (dest == path)
+		*dest++ = '.';
+	*dest = '\0';
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Remember @path as a directory, or a symlink; return 0 if it was already
+ * known as either, and -1 if out of memory.
+ */
+static int
+add_known_path(struct archive_write_disk_tc *a, const char *path,
+    int symlink)
+{
+	struct known_path *d;
+
+	if (__archive_rb_tree_find_node(&a->known_paths, path) != NULL)
+		return (0);
+	d = (struct known_path *)malloc(sizeof(*d) + strlen(path));
+	if (d == NULL) {
+		archive_set_error(&a->archive, ENOMEM, "No memory");
+		return (-1);
+	}
+	d->symlink = symlink;
+	strcpy(d->name, path);
+	__archive_rb_tree_insert_node(&a->known_paths, &d->node);
+	d->next = a->known_paths_list;
+	a->known_paths_list = d;
+	return (1);
+}
+
+static int
+queue_mkdir(struct archive_write_disk_tc *a, const char *path, mode_t mode)
+{
+	struct tc_attrs *attrs;
+	char *p;
+
+	if ((p = batch_strdup(a, path)) == NULL ||
+	    (attrs = (struct tc_attrs *)op_list_add(a, &a->mkdirs)) == NULL)
+		return (ARCHIVE_FATAL);
+	attrs->file = tc_file_from_path(p);
+	attrs->masks = TC_ATTRS_MASK_NONE;
+	attrs->masks.has_mode = 1;
+	attrs->mode = mode;
+	a->ops++;
+	return (ARCHIVE_OK);
+}
+
+static int
+is_known_symlink(struct archive_write_disk_tc *a, const char *path)
+{
+	struct known_path *d;
+
+	d = (struct known_path *)__archive_rb_tree_find_node(&a->known_paths,
+	    path);
+	return (d != NULL && d->symlink);
+}
+
+/*
+ * With ARCHIVE_EXTRACT_SECURE_SYMLINKS, refuse @path if it, or with
+ * @parents_only its parent, is or goes through a symlink queued earlier.
+ */
+static int
+check_symlinks(struct archive_write_disk_tc *a, char *path, int parents_only)
+{
+	char *slash;
+	int r = ARCHIVE_OK;
+
+	if (!(a->flags & ARCHIVE_EXTRACT_SECURE_SYMLINKS))
+		return (ARCHIVE_OK);
+	for (slash = strchr(path + 1, '/'); slash != NULL && r == ARCHIVE_OK;
+	    slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		if (is_known_symlink(a, path)) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "Cannot extract through symlink %s", path);
+			r = ARCHIVE_FAILED;
+		}
+		*slash = '/';
+	}
+	if (r == ARCHIVE_OK && !parents_only && is_known_symlink(a, path)) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Cannot extract through symlink %s", path);
+		r = ARCHIVE_FAILED;
+	}
+	return (r);
+}
+
+/*
+ * Queue a mkdir for every ancestor of @path not yet created, so that no
+ * operation of the batch fails for want of its parent.  Ancestors that
+ * already exist on the server make the mkdir fail with EEXIST, which is
+ * ignored.  Ancestors queued as symlinks are left alone: a mkdir would run
+ * before the symlink and take its place.
+ */
+static int
+create_parents(struct archive_write_disk_tc *a, char *path)
+{
+	char *slash;
+	int known, r = ARCHIVE_OK;
+
+	if (a->flags & ARCHIVE_EXTRACT_NO_AUTODIR)
+		return (ARCHIVE_OK);
+	for (slash = strchr(path + 1, '/'); slash != NULL && r == ARCHIVE_OK;
+	    slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		known = add_known_path(a, path, 0);
+		if (known < 0)
+			r = ARCHIVE_FATAL;
+		else if (known)
+			r = queue_mkdir(a, path,
+			    DEFAULT_DIR_MODE & ~a->user_umask);
+		*slash = '/';
+	}
+	return (r);
+}
+
+static int
+queue_link(struct archive_write_disk_tc *a, struct op_list *targets,
+    struct op_list *paths, const char *target)
+{
+	const char **t, **p;
+	char *target_copy, *path_copy;
+
+	if ((target_copy = batch_strdup(a, target)) == NULL ||
+	    (path_copy = batch_strdup(a, a->name)) == NULL ||
+	    (t = (const char **)op_list_add(a, targets)) == NULL ||
+	    (p = (const char **)op_list_add(a, paths)) == NULL)
+		return (ARCHIVE_FATAL);
+	*t = target_copy;
+	*p = path_copy;
+	a->ops++;
+	return (ARCHIVE_OK);
+}
+
+static int
+maybe_flush(struct archive_write_disk_tc *a)
+{
+	if (a->ops >= a->max_ops || a->bytes >= a->max_bytes)
+		return (flush_batch(a));
+	return (ARCHIVE_OK);
+}
+
+static int
+_archive_write_disk_tc_header(struct archive *_a, struct archive_entry *entry)
+{
+	struct archive_write_disk_tc *a = (struct archive_write_disk_tc *)_a;
+	const char *linkname;
+	char *link_copy;
+	mode_t mode;
+	int ret, r;
+
+	archive_check_magic(&a->archive, ARCHIVE_WRITE_DISK_TC_MAGIC,
+	    ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA,
+	    "archive_write_header");
+	archive_clear_error(&a->archive);
+	if (a->archive.state & ARCHIVE_STATE_DATA) {
+		r = _archive_write_disk_tc_finish_entry(&a->archive);
+		if (r == ARCHIVE_FATAL)
+			return (r);
+	}
+
+	/* A header refused earlier leaves its entry behind. */
+	if (a->entry != NULL)
+		archive_entry_free(a->entry);
+	a->entry = archive_entry_clone(entry);
+	free(a->name);
+	a->name = NULL;
+	if (a->entry == NULL || archive_entry_pathname(entry) == NULL ||
+	    (a->name = strdup(archive_entry_pathname(entry))) == NULL) {
+		archive_set_error(&a->archive, ENOMEM, "No memory");
+		return (ARCHIVE_FATAL);
+	}
+	a->filesize = archive_entry_size_is_set(entry) ?
+	    archive_entry_size(entry) : -1;
+	a->offset = 0;
+	a->created = 0;
+	a->extent = -1;
+	mode = archive_entry_mode(entry);
+
+	ret = cleanup_pathname(a, a->name);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+	/* A symlink may replace a symlink, but nothing may write to one. */
+	ret = check_symlinks(a, a->name,
+	    archive_entry_hardlink(entry) == NULL &&
+	    archive_entry_filetype(entry) == AE_IFLNK);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+	ret = create_parents(a, a->name);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+
+	linkname = archive_entry_hardlink(entry);
+	if (linkname != NULL) {
+		if ((link_copy = strdup(linkname)) == NULL) {
+			archive_set_error(&a->archive, ENOMEM, "No memory");
+			return (ARCHIVE_FATAL);
+		}
+		ret = cleanup_pathname(a, link_copy);
+		if (ret == ARCHIVE_OK)
+			ret = check_symlinks(a, link_copy, 0);
+		if (ret == ARCHIVE_OK)
+			ret = queue_link(a, &a->hardlink_targets,
+			    &a->hardlink_paths, link_copy);
+		free(link_copy);
+		if (ret != ARCHIVE_OK)
+			return (ret);
+		/*
+		 * Data following a hard link entry goes to the linked
+		 * file, so the link must exist before it is written.
+		 */
+		a->created = 1;
+		if (a->filesize > 0)
+			ret = flush_batch(a);
+		else
+			a->filesize = 0;
+	} else switch (archive_entry_filetype(entry)) {
+	case AE_IFDIR:
+		a->filesize = 0;
+		r = add_known_path(a, a->name, 0);
+		if (r < 0)
+			return (ARCHIVE_FATAL);
+		if (r)
+			ret = queue_mkdir(a, a->name,
+			    ((mode & 0777) | MINIMUM_DIR_MODE) &
+			    ~a->user_umask);
+		if (ret == ARCHIVE_OK) {
+			char *p = strdup(a->name);
+			struct tc_attrs *attrs = (struct tc_attrs *)
+			    op_list_add(a, &a->dir_fixups);
+			if (p == NULL || attrs == NULL) {
+				free(p);
+				archive_set_error(&a->archive, ENOMEM,
+				    "No memory");
+				return (ARCHIVE_FATAL);
+			}
+			entry_attrs(a, attrs, p);
+		}
+		break;
+	case AE_IFLNK:
+		a->filesize = 0;
+		if (add_known_path(a, a->name, 1) < 0)
+			return (ARCHIVE_FATAL);
+		ret = queue_link(a, &a->symlink_targets, &a->symlink_paths,
+		    archive_entry_symlink(entry));
+		break;
+	case AE_IFREG:
+		break;
+	default:
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Can't create '%s': tc does not support this file type",
+		    a->name);
+		a->filesize = 0;
+		ret = ARCHIVE_WARN;
+		break;
+	}
+	if (ret == ARCHIVE_FATAL)
+		return (ret);
+	a->archive.state = ARCHIVE_STATE_DATA;
+	r = maybe_flush(a);
+	return (r < ret ? r : ret);
+}
+
+/*
+ * Extend the queued write at the end of which the data goes by up to
+ * @size bytes, growing its buffer if need be, and return how many.
+ * Returns 0 if there is no such write, and -1 if out of memory.
+ */
+static ssize_t
+extend_write(struct archive_write_disk_tc *a, const char *buff, size_t size)
+{
+	struct tc_iovec *iov;
+	size_t room, length, new_size;
+	char *data;
+
+	if (a->extent < 0)
+		return (0);
+	iov = (struct tc_iovec *)a->writes.items + a->extent;
+	if ((int64_t)(iov->offset + iov->length) != a->offset)
+		return (0);
+	/* maybe_flush() sends the batch once it holds max_bytes. */
+	room = a->max_bytes - a->bytes;
+	length = size < room ? size : room;
+	if (iov->length + length > a->extent_size) {
+		new_size = a->extent_size * 2;
+		if (new_size < iov->length + length)
+			new_size = iov->length + length;
+		if (new_size > iov->length + room)
+			new_size = iov->length + room;
+		data = (char *)realloc(iov->data, new_size);
+		if (data == NULL) {
+			archive_set_error(&a->archive, ENOMEM, "No memory");
+			return (-1);
+		}
+		((void **)a->owned.items)[a->extent_data] = data;
+		iov->data = data;
+		a->extent_size = new_size;
+	}
+	memcpy(iov->data + iov->length, buff, length);
+	iov->length += length;
+	return (length);
+}
+
+/*
+ * Queue the data in chunks of at most max_bytes.  Data that continues the
+ * previous chunk of the file is added to it, so that a file written in
+ * many small pieces still takes one operation per batch.
+ */
+static ssize_t
+write_data_block(struct archive_write_disk_tc *a, const char *buff,
+    size_t size)
+{
+	struct tc_iovec *iov;
+	size_t start_size = size;
+	size_t length, capacity;
+	ssize_t extended;
+	char *path, *data;
+	int r;
+
+	if (a->filesize == 0)
+		return (0);
+	if (a->filesize >= 0) {
+		if (a->offset > a->filesize)
+			a->offset = a->filesize;
+		if (a->offset + (int64_t)size > a->filesize)
+			start_size = size = (size_t)(a->filesize - a->offset);
+	}
+
+	while (size > 0) {
+		extended = extend_write(a, buff, size);
+		if (extended < 0)
+			return (ARCHIVE_FATAL);
+		length = (size_t)extended;
+		if (length == 0) {
+			length = size;
+			if (length > a->max_bytes)
+				length = a->max_bytes;
+			/*
+			 * Make room for the rest of the file that fits in
+			 * this batch, so it need not be copied again.
+			 */
+			capacity = length;
+			if (a->filesize >= 0 && a->bytes < a->max_bytes) {
+				capacity = a->max_bytes - a->bytes;
+				if ((int64_t)capacity > a->filesize - a->offset)
+					capacity =
+					    (size_t)(a->filesize - a->offset);
+				if (capacity < length)
+					capacity = length;
+			}
+			if ((path = batch_strdup(a, a->name)) == NULL ||
+			    (data = (char *)batch_alloc(a, capacity)) == NULL ||
+			    (iov = (struct tc_iovec *)op_list_add(a,
+			    &a->writes)) == NULL)
+				return (ARCHIVE_FATAL);
+			memcpy(data, buff, length);
+			iov->file = tc_file_from_path(path);
+			iov->offset = a->offset;
+			iov->length = length;
+			iov->data = data;
+			iov->is_creation = !a->created;
+			a->created = 1;
+			a->extent = a->writes.count - 1;
+			a->extent_data = a->owned.count - 1;
+			a->extent_size = capacity;
+			a->ops++;
+		}
+		a->bytes += length;
+		a->offset += length;
+		a->total_bytes_written += length;
+		buff += length;
+		size -= length;
+		r = maybe_flush(a);
+		if (r != ARCHIVE_OK)
+			return (r);
+	}
+	return (start_size);
+}
+
+static ssize_t
+_archive_write_disk_tc_data_block(struct archive *_a,
+    const void *buff, size_t size, int64_t offset)
+{
+	struct archive_write_disk_tc *a = (struct archive_write_disk_tc *)_a;
+	ssize_t r;
+
+	archive_check_magic(&a->archive, ARCHIVE_WRITE_DISK_TC_MAGIC,
+	    ARCHIVE_STATE_DATA, "archive_write_data_block");
+
+	a->offset = offset;
+	r = write_data_block(a, (const char *)buff, size);
+	if (r < ARCHIVE_OK)
+		return (r);
+	if ((size_t)r < size) {
+		archive_set_error(&a->archive, 0,
+		    "Too much data: Truncating file at %ju bytes",
+		    (uintmax_t)a->filesize);
+		return (ARCHIVE_WARN);
+	}
+#if ARCHIVE_VERSION_NUMBER < 3999000
+	return (ARCHIVE_OK);
+#else
+	return (size);
+#endif
+}
+
+static ssize_t
+_archive_write_disk_tc_data(struct archive *_a, const void *buff, size_t size)
+{
+	struct archive_write_disk_tc *a = (struct archive_write_disk_tc *)_a;
+
+	archive_check_magic(&a->archive, ARCHIVE_WRITE_DISK_TC_MAGIC,
+	    ARCHIVE_STATE_DATA, "archive_write_data");
+
+	return (write_data_block(a, (const char *)buff, size));
+}
+
+/*
+ * A regular file that got no data is created by an empty write.  Its size
+ * is then set explicitly, which both extends a file ending in a hole and
+ * cuts off what an older, longer file left past the end.
+ */
+static int
+_archive_write_disk_tc_finish_entry(struct archive *_a)
+{
+	struct archive_write_disk_tc *a = (struct archive_write_disk_tc *)_a;
+	struct tc_attrs *attrs;
+	struct tc_iovec *iov;
+	char *path;
+	int ret = ARCHIVE_OK;
+
+	archive_check_magic(&a->archive, ARCHIVE_WRITE_DISK_TC_MAGIC,
+	    ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA,
+	    "archive_write_finish_entry");
+	if (a->archive.state & ARCHIVE_STATE_HEADER)
+		return (ARCHIVE_OK);
+
+	if (archive_entry_hardlink(a->entry) == NULL &&
+	    archive_entry_filetype(a->entry) == AE_IFREG) {
+		if (!a->created) {
+			if ((path = batch_strdup(a, a->name)) == NULL ||
+			    (iov = (struct tc_iovec *)
+			    op_list_add(a, &a->writes)) == NULL)
+				return (ARCHIVE_FATAL);
+			iov->file = tc_file_from_path(path);
+			iov->data = path;
+			iov->is_creation = 1;
+			a->ops++;
+		}
+		if ((path = batch_strdup(a, a->name)) == NULL ||
+		    (attrs = (struct tc_attrs *)
+		    op_list_add(a, &a->setattrs)) == NULL)
+			return (ARCHIVE_FATAL);
+		entry_attrs(a, attrs, path);
+		if (a->filesize >= 0) {
+			attrs->masks.has_size = 1;
+			attrs->size = a->filesize;
+		}
+		a->ops++;
+		ret = maybe_flush(a);
+	}
+
+	archive_entry_free(a->entry);
+	a->entry = NULL;
+	a->archive.state = ARCHIVE_STATE_HEADER;
+	return (ret);
+}
+
+static const char *
+op_path(struct archive_write_disk_tc *a, enum op_kind kind, int i)
+{
+	switch (kind) {
+	case OP_MKDIR:
+		return (((struct tc_attrs *)a->mkdirs.items)[i].file.path);
+	case OP_SYMLINK:
+		return (((const char **)a->symlink_paths.items)[i]);
+	case OP_WRITE:
+		return (((struct tc_iovec *)a->writes.items)[i].file.path);
+	case OP_HARDLINK:
+		return (((const char **)a->hardlink_paths.items)[i]);
+	case OP_SETATTR:
+	default:
+		return (((struct tc_attrs *)a->setattrs.items)[i].file.path);
+	}
+}
+
+static tc_res
+issue_ops(struct archive_write_disk_tc *a, enum op_kind kind, int from,
+    int count)
+{
+	switch (kind) {
+	case OP_MKDIR:
+		return (tc_mkdirv((struct tc_attrs *)a->mkdirs.items + from,
+		    count, false));
+	case OP_SYMLINK:
+		return (tc_symlinkv(
+		    (const char **)a->symlink_targets.items + from,
+		    (const char **)a->symlink_paths.items + from, count,
+		    false));
+	case OP_WRITE:
+		return (tc_writev((struct tc_iovec *)a->writes.items + from,
+		    count, false));
+	case OP_HARDLINK:
+		return (tc_hardlinkv(
+		    (const char **)a->hardlink_targets.items + from,
+		    (const char **)a->hardlink_paths.items + from, count,
+		    false));
+	case OP_SETATTR:
+	default:
+		return (tc_setattrsv(
+		    (struct tc_attrs *)a->setattrs.items + from, count, false));
+	}
+}
+
+/*
+ * Send the @count queued operations of @kind as one compound.  A compound
+ * stops at the first failing operation; if that failure is not fatal, the
+ * rest is sent again.  Existing directories are expected, existing link
+ * names and failures to restore metadata only warrant a warning, like
+ * they do in archive_write_disk_posix.
+ */
+static int
+run_ops(struct archive_write_disk_tc *a, enum op_kind kind, int count)
+{
+	static const char *verbs[] = {
+		"create directory", "create symlink", "write",
+		"create hard link", "restore metadata of"
+	};
+	int done = 0, ret = ARCHIVE_OK;
+	tc_res res;
+
+	while (done < count) {
+		res = issue_ops(a, kind, done, count - done);
+		if (tc_okay(res))
+			break;
+		if (res.index < 0 || res.index >= count - done)
+			res.index = 0;
+		if (!(kind == OP_MKDIR && res.err_no == EEXIST)) {
+			archive_set_error(&a->archive, res.err_no,
+			    "Can't %s '%s'", verbs[kind],
+			    op_path(a, kind, done + res.index));
+			if (kind != OP_SETATTR && (res.err_no != EEXIST ||
+			    kind == OP_MKDIR || kind == OP_WRITE))
+				return (ARCHIVE_FATAL);
+			ret = ARCHIVE_WARN;
+		}
+		done += res.index + 1;
+	}
+	return (ret);
+}
+
+static void
+free_owned(struct archive_write_disk_tc *a)
+{
+	int i;
+
+	for (i = 0; i < a->owned.count; i++)
+		free(((void **)a->owned.items)[i]);
+	a->owned.count = 0;
+}
+
+static int
+flush_batch(struct archive_write_disk_tc *a)
+{
+	int ret = ARCHIVE_OK, r;
+
+	if (a->ops == 0)
+		return (ARCHIVE_OK);
+	r = run_ops(a, OP_MKDIR, a->mkdirs.count);
+	if (r < ret)
+		ret = r;
+	if (ret != ARCHIVE_FATAL) {
+		r = run_ops(a, OP_SYMLINK, a->symlink_paths.count);
+		if (r < ret)
+			ret = r;
+	}
+	if (ret != ARCHIVE_FATAL) {
+		r = run_ops(a, OP_WRITE, a->writes.count);
+		if (r < ret)
+			ret = r;
+	}
+	if (ret != ARCHIVE_FATAL) {
+		r = run_ops(a, OP_HARDLINK, a->hardlink_paths.count);
+		if (r < ret)
+			ret = r;
+	}
+	if (ret != ARCHIVE_FATAL) {
+		r = run_ops(a, OP_SETATTR, a->setattrs.count);
+		if (r < ret)
+			ret = r;
+	}
+
+	a->mkdirs.count = 0;
+	a->symlink_targets.count = a->symlink_paths.count = 0;
+	a->writes.count = 0;
+	a->hardlink_targets.count = a->hardlink_paths.count = 0;
+	a->setattrs.count = 0;
+	a->ops = 0;
+	a->bytes = 0;
+	a->extent = -1;
+	free_owned(a);
+	if (ret == ARCHIVE_FATAL)
+		a->archive.state = ARCHIVE_STATE_FATAL;
+	return (ret);
+}
+
+/* Deepest directories first, so parents are restored after children. */
+static int
+dir_fixup_cmp(const void *p1, const void *p2)
+{
+	const struct tc_attrs *a1 = (const struct tc_attrs *)p1;
+	const struct tc_attrs *a2 = (const struct tc_attrs *)p2;
+
+	return (strcmp(a2->file.path, a1->file.path));
+}
+
+static int
+_archive_write_disk_tc_close(struct archive *_a)
+{
+	struct archive_write_disk_tc *a = (struct archive_write_disk_tc *)_a;
+	struct tc_attrs *fixups;
+	int i, count, ret, r;
+	tc_res res;
+
+	archive_check_magic(&a->archive, ARCHIVE_WRITE_DISK_TC_MAGIC,
+	    ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA,
+	    "archive_write_disk_close");
+	ret = _archive_write_disk_tc_finish_entry(&a->archive);
+	if (ret != ARCHIVE_FATAL) {
+		r = flush_batch(a);
+		if (r < ret)
+			ret = r;
+	}
+
+	fixups = (struct tc_attrs *)a->dir_fixups.items;
+	if (ret != ARCHIVE_FATAL && a->dir_fixups.count > 0) {
+		qsort(fixups, a->dir_fixups.count, sizeof(*fixups),
+		    dir_fixup_cmp);
+		for (i = 0; i < a->dir_fixups.count; i += count) {
+			count = a->dir_fixups.count - i;
+			if (count > a->max_ops)
+				count = a->max_ops;
+			res = tc_setattrsv(fixups + i, count, false);
+			if (!tc_okay(res)) {
+				if (res.index < 0 || res.index >= count)
+					res.index = 0;
+				archive_set_error(&a->archive, res.err_no,
+				    "Can't restore metadata of '%s'",
+				    fixups[i + res.index].file.path);
+				ret = ARCHIVE_WARN;
+				count = res.index + 1;
+			}
+		}
+	}
+	for (i = 0; i < a->dir_fixups.count; i++)
+		free((char *)fixups[i].file.path);
+	a->dir_fixups.count = 0;
+	if (a->archive.state != ARCHIVE_STATE_FATAL)
+		a->archive.state = ARCHIVE_STATE_CLOSED;
+	return (ret);
+}
+
+static int
+_archive_write_disk_tc_free(struct archive *_a)
+{
+	struct archive_write_disk_tc *a;
+	struct known_path *d, *next;
+	int i, ret = ARCHIVE_OK;
+
+	if (_a == NULL)
+		return (ARCHIVE_OK);
+	archive_check_magic(_a, ARCHIVE_WRITE_DISK_TC_MAGIC,
+	    ARCHIVE_STATE_ANY | ARCHIVE_STATE_FATAL,
+	    "archive_write_disk_free");
+	a = (struct archive_write_disk_tc *)_a;
+	if (a->archive.state & (ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA))
+		ret = _archive_write_disk_tc_close(&a->archive);
+	__archive_write_disk_tc_set_lookup(&a->archive, 0, NULL, NULL, NULL);
+	__archive_write_disk_tc_set_lookup(&a->archive, 1, NULL, NULL, NULL);
+	if (a->entry)
+		archive_entry_free(a->entry);
+	free(a->name);
+	free_owned(a);
+	for (d = a->known_paths_list; d != NULL; d = next) {
+		next = d->next;
+		free(d);
+	}
+	free(a->mkdirs.items);
+	free(a->symlink_targets.items);
+	free(a->symlink_paths.items);
+	free(a->writes.items);
+	free(a->hardlink_targets.items);
+	free(a->hardlink_paths.items);
+	free(a->setattrs.items);
+	free(a->owned.items);
+	for (i = 0; i < a->dir_fixups.count; i++)
+		free((char *)((struct tc_attrs *)a->dir_fixups.items)[i]
+		    .file.path);
+	free(a->dir_fixups.items);
+	archive_string_free(&a->archive.error_string);
+	a->archive.magic = 0;
+	__archive_clean(&a->archive);
+	free(a);
+	return (ret);
+}
+
+#endif	/* Support tc I/O */
@@ -0,0 +1,209 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_TC_API_H
+#include <tc_api.h>
+#endif
+
+#include "archive.h"
+
+#ifndef HAVE_TC_API_H
+
+int
+archive_write_open_tc(struct archive *a, const char *path)
+{
+	(void)path; /* UNUSED */
+	archive_set_error(a, ARCHIVE_ERRNO_MISC,
+	    "tc I/O not supported on this platform");
+	return (ARCHIVE_FATAL);
+}
+
+#else	/* Support tc I/O */
+
+/*
+ * Whatever block size libarchive writes in, the archive is coalesced into
+ * TC_WRITE_SEGMENTS segments of TC_WRITE_SEGMENT_SIZE bytes, which are all
+ * written by one tc_writev compound once they are full.
+ */
+#define TC_WRITE_SEGMENTS	8
+#define TC_WRITE_SEGMENT_SIZE	(4 * 1024 * 1024)
+
+struct write_tc_data {
+	char		*path;
+	/* Archive offset of the first buffered byte. */
+	int64_t		 offset;
+	size_t		 filled;
+	char		*buffer;
+};
+
+static int	file_close(struct archive *, void *);
+static int	file_open(struct archive *, void *);
+static ssize_t	file_write(struct archive *, void *, const void *buff, size_t);
+static int	flush_segments(struct archive *, struct write_tc_data *);
+
+/*
+ * Write an archive to @path on tc storage.  tc_init() must have been called
+ * by the application.
+ */
+int
+archive_write_open_tc(struct archive *a, const char *path)
+{
+	struct write_tc_data *mine;
+
+	mine = (struct write_tc_data *)calloc(1, sizeof(*mine));
+	if (mine != NULL) {
+		mine->path = strdup(path);
+		mine->buffer = (char *)malloc(
+		    TC_WRITE_SEGMENTS * TC_WRITE_SEGMENT_SIZE);
+	}
+	if (mine == NULL || mine->path == NULL || mine->buffer == NULL) {
+		archive_set_error(a, ENOMEM, "No memory");
+		if (mine != NULL) {
+			free(mine->path);
+			free(mine->buffer);
+			free(mine);
+		}
+		return (ARCHIVE_FATAL);
+	}
+	return (archive_write_open(a, mine,
+		    file_open, file_write, file_close));
+}
+
+static int
+file_open(struct archive *a, void *client_data)
+{
+	(void)client_data; /* UNUSED */
+
+	/*
+	 * tc storage only holds regular files, so unless the client has
+	 * set the last block handling, leave the last block unpadded.
+	 */
+	if (archive_write_get_bytes_in_last_block(a) < 0)
+		archive_write_set_bytes_in_last_block(a, 1);
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Write out the buffered segments.  At least one, possibly empty, write is
+ * always issued so that the file exists even if the archive is empty.
+ */
+static int
+flush_segments(struct archive *a, struct write_tc_data *mine)
+{
+	struct tc_iovec iovs[TC_WRITE_SEGMENTS];
+	size_t pos = 0;
+	int count = 0;
+	tc_res res;
+
+	do {
+		memset(&iovs[count], 0, sizeof(iovs[count]));
+		iovs[count].file = tc_file_from_path(mine->path);
+		iovs[count].offset = mine->offset + pos;
+		iovs[count].length = mine->filled - pos;
+		if (iovs[count].length > TC_WRITE_SEGMENT_SIZE)
+			iovs[count].length = TC_WRITE_SEGMENT_SIZE;
+		iovs[count].data = mine->buffer + pos;
+		iovs[count].is_creation = 1;
+		pos += iovs[count].length;
+		count++;
+	} while (pos < mine->filled);
+
+	res = tc_writev(iovs, count, false);
+	if (!tc_okay(res)) {
+		archive_set_error(a, res.err_no, "Write error on %s",
+		    mine->path);
+		return (ARCHIVE_FATAL);
+	}
+	mine->offset += mine->filled;
+	mine->filled = 0;
+	return (ARCHIVE_OK);
+}
+
+static ssize_t
+file_write(struct archive *a, void *client_data, const void *buff, size_t length)
+{
+	struct write_tc_data *mine = (struct write_tc_data *)client_data;
+	const size_t capacity = TC_WRITE_SEGMENTS * TC_WRITE_SEGMENT_SIZE;
+	const char *p = (const char *)buff;
+	size_t remaining = length;
+	size_t n;
+
+	while (remaining > 0) {
+		n = capacity - mine->filled;
+		if (n > remaining)
+			n = remaining;
+		memcpy(mine->buffer + mine->filled, p, n);
+		mine->filled += n;
+		p += n;
+		remaining -= n;
+		if (mine->filled == capacity &&
+		    flush_segments(a, mine) != ARCHIVE_OK)
+			return (-1);
+	}
+	return (length);
+}
+
+static int
+file_close(struct archive *a, void *client_data)
+{
+	struct write_tc_data *mine = (struct write_tc_data *)client_data;
+	struct tc_attrs attrs;
+	tc_res res;
+	int r;
+
+	r = flush_segments(a, mine);
+	if (r == ARCHIVE_OK) {
+		/* Cut off what an older, longer file left past the end. */
+		memset(&attrs, 0, sizeof(attrs));
+		attrs.file = tc_file_from_path(mine->path);
+		attrs.masks = TC_ATTRS_MASK_NONE;
+		attrs.masks.has_size = 1;
+		attrs.size = mine->offset;
+		res = tc_setattrsv(&attrs, 1, false);
+		if (!tc_okay(res)) {
+			archive_set_error(a, res.err_no,
+			    "Can't truncate %s", mine->path);
+			r = ARCHIVE_FATAL;
+		}
+	}
+	free(mine->path);
+	free(mine->buffer);
+	free(mine);
+	return (r);
+}
+
+#endif	/* Support tc I/O */
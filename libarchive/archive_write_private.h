@@ -55,6 +55,8 @@ struct archive_write_filter {
 	int	  code;
 	int	  bytes_per_block;
 	int	  bytes_in_last_block;
+	/* Non-zero if options() may also be called after open. */
+	int	  options_after_open;
 };
 
 #if ARCHIVE_VERSION < 4000000
@@ -33,6 +33,8 @@ static int	archive_set_format_option(struct archive *a,
 		    const char *m, const char *o, const char *v);
 static int	archive_set_filter_option(struct archive *a,
 		    const char *m, const char *o, const char *v);
+static int	archive_set_open_filter_option(struct archive *a,
+		    const char *m, const char *o, const char *v);
 static int	archive_set_option(struct archive *a,
 		    const char *m, const char *o, const char *v);
 
@@ -49,6 +51,9 @@ int
 archive_write_set_filter_option(struct archive *a, const char *m, const char *o,
     const char *v)
 {
+	if (a->magic == ARCHIVE_WRITE_MAGIC &&
+	    (a->state & (ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA)))
+		return archive_set_open_filter_option(a, m, o, v);
 	return _archive_set_option(a, m, o, v,
 	    ARCHIVE_WRITE_MAGIC, "archive_write_set_filter_option",
 	    archive_set_filter_option);
@@ -120,6 +125,53 @@ archive_set_filter_option(struct archive *_a, const char *m, const char *o,
 	return (rv);
 }
 
+/*
+ * Once the archive is open, only filters that can apply a new setting
+ * to the rest of the output are offered the option.
+ */
+static int
+archive_set_open_filter_option(struct archive *_a, const char *m,
+    const char *o, const char *v)
+{
+	struct archive_write *a = (struct archive_write *)_a;
+	struct archive_write_filter *filter;
+	int r, rv = ARCHIVE_WARN;
+
+	archive_check_magic(_a, ARCHIVE_WRITE_MAGIC,
+	    ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA,
+	    "archive_write_set_filter_option");
+
+	if (m != NULL && m[0] == '\0')
+		m = NULL;
+	if (v != NULL && v[0] == '\0')
+		v = NULL;
+	if (o == NULL || o[0] == '\0') {
+		archive_set_error(_a, ARCHIVE_ERRNO_MISC, "Empty option");
+		return (ARCHIVE_FAILED);
+	}
+
+	for (filter = a->filter_first; filter != NULL; filter = filter->next_filter) {
+		if (filter->options == NULL || !filter->options_after_open)
+			continue;
+		if (m != NULL && strcmp(filter->name, m) != 0)
+			continue;
+
+		r = filter->options(filter, o, v);
+
+		if (r == ARCHIVE_FATAL)
+			return (ARCHIVE_FATAL);
+		if (r == ARCHIVE_OK)
+			rv = ARCHIVE_OK;
+	}
+	if (rv == ARCHIVE_WARN) {
+		archive_set_error(_a, ARCHIVE_ERRNO_MISC,
+		    "Option `%s%s%s' can't be changed after the archive "
+		    "is opened", m ? m : "", m ? ":" : "", o);
+		return (ARCHIVE_FAILED);
+	}
+	return (rv);
+}
+
 static int
 archive_set_option(struct archive *a, const char *m, const char *o,
     const char *v)
@@ -0,0 +1,281 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmark of the read-ahead layer (__archive_read_filter_ahead).
+ *
+ * Archives of many small stored entries are built in memory and read
+ * back through client blocks of awkward sizes, so that the headers the
+ * formats look ahead at keep straddling block boundaries.  For each
+ * format and block size this prints the throughput and the bytes the
+ * client filter copied versus handed out in place, as reported by
+ * archive_read_filter_bytes_copied() and archive_read_filter_bytes_passed().
+ *
+ * usage: read_ahead_bench [-n entries] [-r rounds] [-s max_size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "archive.h"
+#include "archive_entry.h"
+
+struct memory_client {
+	const char	*buff;
+	size_t		 size;
+	size_t		 block_size;
+	size_t		 offset;
+};
+
+struct format {
+	const char	*name;
+	int		(*write_format)(struct archive *);
+	int		(*read_format)(struct archive *);
+	int		 seekable;
+	/* Write entries without their size, for zip data descriptors;
+	 * only deflated entries may have it. */
+	int		 unknown_size;
+	const char	*options;
+};
+
+static const struct format formats[] = {
+	{ "tar", archive_write_set_format_pax_restricted,
+	  archive_read_support_format_tar, 0, 0, NULL },
+	{ "cpio", archive_write_set_format_cpio_newc,
+	  archive_read_support_format_cpio, 0, 0, NULL },
+	{ "zip", archive_write_set_format_zip,
+	  archive_read_support_format_zip_streamable, 0, 0,
+	  "zip:compression=store" },
+	{ "zip-desc", archive_write_set_format_zip,
+	  archive_read_support_format_zip_streamable, 0, 1,
+	  "zip:compression=deflate" },
+	{ "zip-seek", archive_write_set_format_zip,
+	  archive_read_support_format_zip_seekable, 1, 0,
+	  "zip:compression=store" },
+	{ "7zip", archive_write_set_format_7zip,
+	  archive_read_support_format_7zip, 1, 0, "7zip:compression=store" },
+	{ NULL, NULL, NULL, 0, 0, NULL }
+};
+
+static const size_t block_sizes[] = { 509, 4093, 10240, 65536, 0 };
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static ssize_t
+memory_read(struct archive *a, void *client_data, const void **buff)
+{
+	struct memory_client *mine = (struct memory_client *)client_data;
+	size_t size = mine->size - mine->offset;
+
+	(void)a; /* UNUSED */
+	if (size > mine->block_size)
+		size = mine->block_size;
+	*buff = mine->buff + mine->offset;
+	mine->offset += size;
+	return ((ssize_t)size);
+}
+
+static int64_t
+memory_seek(struct archive *a, void *client_data, int64_t offset, int whence)
+{
+	struct memory_client *mine = (struct memory_client *)client_data;
+
+	(void)a; /* UNUSED */
+	if (whence == SEEK_CUR)
+		offset += mine->offset;
+	else if (whence == SEEK_END)
+		offset += mine->size;
+	if (offset < 0 || (size_t)offset > mine->size)
+		return (ARCHIVE_FATAL);
+	mine->offset = (size_t)offset;
+	return (offset);
+}
+
+/* Write entries whose sizes cycle through [0, max_size). */
+static char *
+build_archive(const struct format *f, int entries, size_t max_size,
+    size_t *used)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *buff, *data;
+	size_t size, entry_size;
+	unsigned seed;
+	char path[32];
+	int i;
+
+	size = (size_t)entries * (max_size + 1024) + 1024 * 1024;
+	buff = malloc(size);
+	data = malloc(max_size + 1);
+	if (buff == NULL || data == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	/* Incompressible, so that deflated entries keep their size. */
+	for (i = 0, seed = 1; (size_t)i <= max_size; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = (char)(seed >> 16);
+	}
+	a = archive_write_new();
+	archive_write_set_bytes_in_last_block(a, 1);
+	if (f->write_format(a) != ARCHIVE_OK ||
+	    (f->options != NULL &&
+	     archive_write_set_options(a, f->options) != ARCHIVE_OK) ||
+	    archive_write_open_memory(a, buff, size, used) != ARCHIVE_OK) {
+		fprintf(stderr, "%s: %s\n", f->name, archive_error_string(a));
+		exit(1);
+	}
+	for (i = 0; i < entries; i++) {
+		snprintf(path, sizeof(path), "dir%d/file%d", i % 10, i);
+		ae = archive_entry_new();
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		entry_size = (i * 7919) % (max_size + 1);
+		if (!f->unknown_size)
+			archive_entry_set_size(ae, entry_size);
+		if (archive_write_header(a, ae) != ARCHIVE_OK ||
+		    archive_write_data(a, data, entry_size) < 0) {
+			fprintf(stderr, "%s: %s\n", f->name,
+			    archive_error_string(a));
+			exit(1);
+		}
+		archive_entry_free(ae);
+	}
+	if (archive_write_free(a) != ARCHIVE_OK) {
+		fprintf(stderr, "%s: can't finish archive\n", f->name);
+		exit(1);
+	}
+	free(data);
+	return (buff);
+}
+
+/* Read every entry and its data; return the bytes of data read. */
+static int64_t
+read_archive(const struct format *f, struct memory_client *client,
+    int64_t *copied, int64_t *passed)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	const void *block;
+	size_t size;
+	int64_t offset, total = 0;
+	int r;
+
+	client->offset = 0;
+	a = archive_read_new();
+	f->read_format(a);
+	archive_read_set_read_callback(a, memory_read);
+	if (f->seekable)
+		archive_read_set_seek_callback(a, memory_seek);
+	archive_read_set_callback_data(a, client);
+	if (archive_read_open1(a) != ARCHIVE_OK) {
+		fprintf(stderr, "%s: %s\n", f->name, archive_error_string(a));
+		exit(1);
+	}
+	while ((r = archive_read_next_header(a, &ae)) == ARCHIVE_OK) {
+		while ((r = archive_read_data_block(a, &block, &size,
+		    &offset)) == ARCHIVE_OK)
+			total += size;
+		if (r != ARCHIVE_EOF)
+			break;
+	}
+	if (r != ARCHIVE_EOF) {
+		fprintf(stderr, "%s: %s\n", f->name, archive_error_string(a));
+		exit(1);
+	}
+	*copied += archive_read_filter_bytes_copied(a, -1);
+	*passed += archive_read_filter_bytes_passed(a, -1);
+	archive_read_free(a);
+	return (total);
+}
+
+int
+main(int argc, char **argv)
+{
+	const struct format *f;
+	struct memory_client client;
+	int64_t copied, passed;
+	double start, seconds;
+	size_t max_size = 2000, used;
+	char *buff;
+	int entries = 20000, rounds = 5;
+	int i, j, opt;
+
+	while ((opt = getopt(argc, argv, "n:r:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			entries = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 's':
+			max_size = (size_t)atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n entries] [-r rounds]"
+			    " [-s max_size]\n", argv[0]);
+			return (1);
+		}
+	}
+	if (entries <= 0 || rounds <= 0) {
+		fprintf(stderr, "entries and rounds must be positive\n");
+		return (1);
+	}
+
+	printf("%-9s %6s %9s %8s %12s %12s %7s\n", "format", "block",
+	    "MB", "MB/s", "copied", "passed", "copy%");
+	for (f = formats; f->name != NULL; f++) {
+		buff = build_archive(f, entries, max_size, &used);
+		client.buff = buff;
+		client.size = used;
+		for (i = 0; block_sizes[i] != 0; i++) {
+			client.block_size = block_sizes[i];
+			copied = passed = 0;
+			start = now();
+			for (j = 0; j < rounds; j++)
+				read_archive(f, &client, &copied, &passed);
+			seconds = now() - start;
+			printf("%-9s %6zu %9.1f %8.1f %12jd %12jd %6.1f%%\n",
+			    f->name, block_sizes[i], used / 1048576.0,
+			    used * (double)rounds / 1048576.0 / seconds,
+			    (intmax_t)(copied / rounds),
+			    (intmax_t)(passed / rounds),
+			    100.0 * copied / (copied + passed + 1));
+		}
+		free(buff);
+	}
+	return (0);
+}
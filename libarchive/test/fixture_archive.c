@@ -0,0 +1,142 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+#include <stdlib.h>
+
+/*
+ * Archives of generated files, for tests that read the same data back
+ * in different ways.  File i is named "file%02d" and its contents are
+ * determined by i alone, so a reader can check any entry on its own.
+ */
+
+size_t
+fixture_file_size(const struct fixture *f, int i)
+{
+	return (f->base + (size_t)i * f->step);
+}
+
+/* Half-compressible data, so deflate emits blocks of varying size. */
+void
+fixture_fill(char *buff, size_t size, int i)
+{
+	uint32_t x = (uint32_t)i * 2654435761U;
+	size_t j;
+
+	for (j = 0; j < size; j++) {
+		x = x * 1103515245 + 12345;
+		buff[j] = (char)('a' + ((x >> 16) & 15));
+	}
+}
+
+static void
+fill(const struct fixture *f, char *buff, int i)
+{
+	if (f->fill != NULL)
+		f->fill(buff, fixture_file_size(f, i), i);
+	else
+		fixture_fill(buff, fixture_file_size(f, i), i);
+}
+
+/*
+ * Write the files to name.  Returns ARCHIVE_OK, or whatever add_filter
+ * returned if it failed, in which case nothing is written.
+ */
+int
+fixture_write(const struct fixture *f, const char *name,
+    int (*set_format)(struct archive *), int (*add_filter)(struct archive *))
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16];
+	char *buff;
+	int i, r;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, set_format(a));
+	r = add_filter(a);
+	if (r != ARCHIVE_OK) {
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return (r);
+	}
+	buff = malloc(fixture_file_size(f, f->nfiles));
+	if (!assert(buff != NULL)) {
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return (ARCHIVE_FATAL);
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_open_filename(a, name));
+	for (i = 0; i < f->nfiles; i++) {
+		sprintf(path, "file%02d", i);
+		fill(f, buff, i);
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, S_IFREG | 0644);
+		archive_entry_set_size(ae, fixture_file_size(f, i));
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualIntA(a, (int)fixture_file_size(f, i),
+		    archive_write_data(a, buff, fixture_file_size(f, i)));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	free(buff);
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Read the next header and check that it is file i, and if read_data is
+ * set, its data too.  Otherwise the data is left to be skipped.  A
+ * failure() set by the caller applies to reading the header.
+ */
+void
+fixture_verify_entry(const struct fixture *f, struct archive *a, int i,
+    int read_data)
+{
+	struct archive_entry *ae;
+	size_t size = fixture_file_size(f, i);
+	char path[16];
+	char *buff, *expect;
+
+	sprintf(path, "file%02d", i);
+	if (!assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae)))
+		return;
+	assertEqualString(path, archive_entry_pathname(ae));
+	assertEqualInt(size, archive_entry_size(ae));
+	if (!read_data)
+		return;
+	buff = malloc(size + 1);
+	expect = malloc(size);
+	if (assert(buff != NULL && expect != NULL)) {
+		fill(f, expect, i);
+		failure("Reading %s", path);
+		assertEqualIntA(a, (int)size,
+		    archive_read_data(a, buff, size + 1));
+		assertEqualMem(buff, expect, size);
+	}
+	free(buff);
+	free(expect);
+}
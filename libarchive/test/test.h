@@ -346,6 +346,19 @@ int read_open_memory_minimal(struct archive *, const void *, size_t, size_t);
 /* _seek version produces a seekable file. */
 int read_open_memory_seek(struct archive *, const void *, size_t, size_t);
 
+/* Archives of generated files named file00, file01, ... */
+struct fixture {
+	int	 nfiles;
+	size_t	 base;		/* File i holds base + i * step bytes. */
+	size_t	 step;
+	void	(*fill)(char *, size_t, int);	/* NULL for fixture_fill(). */
+};
+size_t fixture_file_size(const struct fixture *, int);
+void fixture_fill(char *, size_t, int);
+int fixture_write(const struct fixture *, const char *,
+    int (*)(struct archive *), int (*)(struct archive *));
+void fixture_verify_entry(const struct fixture *, struct archive *, int, int);
+
 /* Versions of above that accept an archive argument for additional info. */
 #define assertA(e)   assertion_assert(__FILE__, __LINE__, (e), #e, (a))
 #define assertEqualIntA(a,v1,v2)   \
@@ -0,0 +1,212 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+
+#ifdef HAVE_TC_API_H
+#include <tc_api.h>
+
+#define BIG_SIZE	(5 * 1024 * 1024 + 123)
+
+/* Walk "dir" and check what is found, and the data of every file. */
+static void
+walk(struct archive *a, const char *big, int logical)
+{
+	struct archive_entry *ae;
+	const void *p;
+	size_t size;
+	int64_t offset;
+	int found = 0, r;
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_disk_open(a, "dir"));
+	assert((ae = archive_entry_new()) != NULL);
+	while ((r = archive_read_next_header2(a, ae)) != ARCHIVE_EOF) {
+		const char *name = archive_entry_pathname(ae);
+
+		if (!assertEqualIntA(a, ARCHIVE_OK, r))
+			break;
+		if (archive_read_disk_can_descend(a))
+			archive_read_disk_descend(a);
+		if (strcmp(name, "dir") == 0) {
+			assertEqualInt(AE_IFDIR, archive_entry_filetype(ae));
+			found |= 1;
+		} else if (strcmp(name, "dir/file") == 0) {
+			assertEqualInt(AE_IFREG, archive_entry_filetype(ae));
+			assertEqualInt(0644, archive_entry_perm(ae));
+			assertEqualInt(8, archive_entry_size(ae));
+			assertEqualIntA(a, ARCHIVE_OK,
+			    archive_read_data_block(a, &p, &size, &offset));
+			assertEqualInt(0, offset);
+			assertEqualInt(8, size);
+			assertEqualMem(p, "contents", 8);
+			assertEqualIntA(a, ARCHIVE_EOF,
+			    archive_read_data_block(a, &p, &size, &offset));
+			found |= 2;
+		} else if (strcmp(name, "dir/sub") == 0) {
+			assertEqualInt(AE_IFDIR, archive_entry_filetype(ae));
+			found |= 4;
+		} else if (strcmp(name, "dir/sub/big") == 0) {
+			int64_t total = 0;
+
+			assertEqualInt(BIG_SIZE, archive_entry_size(ae));
+			while (archive_read_data_block(a, &p, &size,
+			    &offset) == ARCHIVE_OK) {
+				assertEqualInt(total, offset);
+				assertEqualMem(p, big + offset, size);
+				total += size;
+			}
+			assertEqualInt(BIG_SIZE, total);
+			found |= 8;
+		} else if (strcmp(name, "dir/link") == 0) {
+			if (logical) {
+				/* Archived as the file it points to. */
+				assertEqualInt(AE_IFREG,
+				    archive_entry_filetype(ae));
+				assertEqualInt(8, archive_entry_size(ae));
+			} else {
+				assertEqualInt(AE_IFLNK,
+				    archive_entry_filetype(ae));
+				assertEqualString("file",
+				    archive_entry_symlink(ae));
+			}
+			found |= 16;
+		} else if (strcmp(name, "dir/sub/up") == 0) {
+			found |= 32;
+		} else if (strcmp(name, "dir/sub/self") == 0) {
+			found |= 64;
+		} else {
+			failure("Unexpected entry %s", name);
+			assert(0);
+		}
+	}
+	archive_entry_free(ae);
+	assertEqualInt(127, found);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+}
+
+static void
+test_read_disk_tc_walk(void)
+{
+	struct archive *a, *m;
+	struct archive_entry *ae;
+	char *big;
+	int i, r;
+
+	assertMakeDir("dir", 0755);
+	assertMakeFile("dir/file", 0644, "contents");
+	assertMakeDir("dir/sub", 0755);
+	assertMakeFile("dir/sub/excluded", 0644, "no");
+	assertMakeSymlink("dir/link", "file");
+	/* Loops, which the logical walk must not follow forever. */
+	assertMakeSymlink("dir/sub/up", "..");
+	assertMakeSymlink("dir/sub/self", ".");
+	big = malloc(BIG_SIZE);
+	assert(big != NULL);
+	for (i = 0; i < BIG_SIZE; i++)
+		big[i] = (char)(i % 253);
+	assertMakeBinFile("dir/sub/big", 0644, BIG_SIZE, big);
+
+	assert((m = archive_match_new()) != NULL);
+	assertEqualIntA(m, ARCHIVE_OK,
+	    archive_match_exclude_pattern(m, "*/excluded"));
+
+	assert((a = archive_read_disk_tc_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_disk_set_matching(a, m, NULL, NULL));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_disk_set_symlink_physical(a));
+	walk(a, big, 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+
+	/*
+	 * Logically, dir/sub/up is dir again and dir/sub/self is dir/sub
+	 * again, whose contents are skipped.
+	 */
+	assert((a = archive_read_disk_tc_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_disk_set_matching(a, m, NULL, NULL));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_disk_set_symlink_logical(a));
+	walk(a, big, 1);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+	assertEqualInt(ARCHIVE_OK, archive_match_free(m));
+
+	/* A symlink as the starting point is archived as itself. */
+	assertMakeSymlink("rootlink", "dir");
+	assert((a = archive_read_disk_tc_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_disk_set_symlink_physical(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_disk_open(a, "rootlink"));
+	assert((ae = archive_entry_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header2(a, ae));
+	assertEqualString("rootlink", archive_entry_pathname(ae));
+	assertEqualInt(AE_IFLNK, archive_entry_filetype(ae));
+	assertEqualString("dir", archive_entry_symlink(ae));
+	assertEqualInt(0, archive_read_disk_can_descend(a));
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header2(a, ae));
+	archive_entry_free(ae);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+
+	/* Unless it is to be followed. */
+	assert((a = archive_read_disk_tc_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_disk_set_symlink_hybrid(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_disk_open(a, "rootlink"));
+	assert((ae = archive_entry_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header2(a, ae));
+	assertEqualString("rootlink", archive_entry_pathname(ae));
+	assertEqualInt(AE_IFDIR, archive_entry_filetype(ae));
+	archive_entry_free(ae);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+
+	/* A missing starting point fails that entry only. */
+	assert((a = archive_read_disk_tc_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_disk_open(a, "nonexistent"));
+	assert((ae = archive_entry_new()) != NULL);
+	r = archive_read_next_header2(a, ae);
+	assertEqualIntA(a, ARCHIVE_FAILED, r);
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header2(a, ae));
+	archive_entry_free(ae);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+	free(big);
+}
+#endif
+
+DEFINE_TEST(test_read_disk_tc)
+{
+#ifdef HAVE_TC_API_H
+	void *context;
+
+	/* Without a config file, tc runs on its local POSIX backend. */
+	context = tc_init(NULL, "test_read_disk_tc.log", 77);
+	if (context == NULL) {
+		skipping("tc could not be initialized");
+		return;
+	}
+	test_read_disk_tc_walk();
+	tc_deinit(context);
+#else
+	skipping("tc I/O is not supported on this platform");
+	assert(archive_read_disk_tc_new() == NULL);
+#endif
+}
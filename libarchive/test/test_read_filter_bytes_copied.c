@@ -0,0 +1,162 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * archive_read_filter_bytes_copied() and archive_read_filter_bytes_passed()
+ * on a tar archive read through client blocks of different sizes.  Blocks
+ * smaller than a tar header make every header straddle two of them, and
+ * each must then be copied exactly once.
+ */
+
+#define	NFILES	64
+
+struct block_client {
+	const char	*buff;
+	size_t		 size;
+	size_t		 block_size;
+	size_t		 offset;
+};
+
+static ssize_t
+block_read(struct archive *a, void *client_data, const void **buff)
+{
+	struct block_client *mine = (struct block_client *)client_data;
+	size_t size = mine->size - mine->offset;
+
+	(void)a; /* UNUSED */
+	if (size > mine->block_size)
+		size = mine->block_size;
+	*buff = mine->buff + mine->offset;
+	mine->offset += size;
+	return ((ssize_t)size);
+}
+
+static void
+read_archive(struct block_client *client, int64_t *copied, int64_t *passed)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char buff[1024], expect[1024];
+	char path[16];
+	int i;
+
+	client->offset = 0;
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_tar(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open(a, client, NULL, block_read, NULL));
+	for (i = 0; i < NFILES; i++) {
+		sprintf(path, "file%02d", i);
+		failure("Reading %s in blocks of %d bytes", path,
+		    (int)client->block_size);
+		if (!assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae)))
+			break;
+		assertEqualString(path, archive_entry_pathname(ae));
+		memset(expect, 'a' + i % 26, i * 13);
+		assertEqualIntA(a, i * 13, archive_read_data(a, buff, i * 13));
+		assertEqualMem(buff, expect, i * 13);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	*copied = archive_read_filter_bytes_copied(a, -1);
+	*passed = archive_read_filter_bytes_passed(a, -1);
+	assertEqualInt(*copied, archive_read_filter_bytes_copied(a, 0));
+	assertEqualInt(-1, archive_read_filter_bytes_copied(a, 1));
+	assertEqualInt(-1, archive_read_filter_bytes_passed(a, 1));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_filter_bytes_copied)
+{
+	struct block_client client;
+	struct archive_entry *ae;
+	struct archive *a;
+	char data[1024];
+	char path[16];
+	size_t used;
+	int64_t copied, passed;
+	char *buff;
+	int i;
+
+	/* Create a tar archive in memory. */
+	buff = malloc(256 * 1024);
+	if (!assert(buff != NULL))
+		return;
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_bytes_in_last_block(a, 1));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, 256 * 1024, &used));
+	for (i = 0; i < NFILES; i++) {
+		sprintf(path, "file%02d", i);
+		memset(data, 'a' + i % 26, i * 13);
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, i * 13);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualIntA(a, i * 13, archive_write_data(a, data, i * 13));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	client.buff = buff;
+	client.size = used;
+
+	/* Blocks larger than the archive are handed out in place. */
+	client.block_size = used + 1;
+	read_archive(&client, &copied, &passed);
+	assertEqualInt(0, copied);
+	assert(passed > 0 && passed <= (int64_t)used);
+
+	/*
+	 * With blocks smaller than a header, each header is copied once,
+	 * and the copy buffer never moves the bytes it holds.
+	 */
+	client.block_size = 509;
+	read_archive(&client, &copied, &passed);
+	assert(copied >= NFILES * 512);
+	assert(copied <= NFILES * 512 + 1024);
+	assert(passed > 0);
+
+	/* With a few headers straddling blocks, only those are copied. */
+	client.block_size = 4093;
+	read_archive(&client, &copied, &passed);
+	assert(copied > 0);
+	assert(copied < NFILES * 512);
+
+	/* Statistics of an archive not yet opened. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualInt(-1, archive_read_filter_bytes_copied(a, 0));
+	assertEqualInt(-1, archive_read_filter_bytes_passed(a, -1));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	free(buff);
+}
@@ -0,0 +1,283 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Build a seek index for a .tar.gz with the "gzip:index-file" option,
+ * then use it to jump straight to entries with
+ * archive_read_seek_header() and to skip over entry data.
+ */
+
+#define	NFILES	40
+#define	SPAN	"16384"
+
+static const struct fixture files = { NFILES, 1, 4099, NULL };
+/* Another archive, which starts the same. */
+static const struct fixture shorter = { NFILES - 1, 1, 4099, NULL };
+
+/* A seekable client that counts the bytes it hands over. */
+struct counting_reader {
+	const char	*data;
+	size_t		 size;
+	int64_t		 pos;
+	int64_t		 delivered;
+};
+
+static la_ssize_t
+counting_read(struct archive *a, void *client, const void **buff)
+{
+	struct counting_reader *r = (struct counting_reader *)client;
+	size_t n = 4096;
+
+	(void)a; /* UNUSED */
+	if (r->pos >= (int64_t)r->size)
+		return (0);
+	if (n > r->size - (size_t)r->pos)
+		n = r->size - (size_t)r->pos;
+	*buff = r->data + r->pos;
+	r->pos += n;
+	r->delivered += n;
+	return ((la_ssize_t)n);
+}
+
+static la_int64_t
+counting_seek(struct archive *a, void *client, la_int64_t offset, int whence)
+{
+	struct counting_reader *r = (struct counting_reader *)client;
+
+	(void)a; /* UNUSED */
+	if (whence == SEEK_CUR)
+		offset += r->pos;
+	else if (whence == SEEK_END)
+		offset += r->size;
+	if (offset < 0 || offset > (int64_t)r->size)
+		return (ARCHIVE_FATAL);
+	r->pos = offset;
+	return (offset);
+}
+
+static struct archive *
+open_archive(const char *name, const char *options)
+{
+	struct archive *a;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_tar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename(a, name, 10240));
+	return (a);
+}
+
+/* Jump around the archive, finishing at the last entry. */
+static void
+verify_seeks(struct archive *a, const int64_t *positions)
+{
+	static const int order[] = { 37, 5, 6, 20, 0, 19, 38, NFILES - 1 };
+	struct archive_entry *ae;
+	size_t i;
+
+	for (i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_seek_header(a, positions[order[i]]));
+		fixture_verify_entry(&files, a, order[i], 1);
+	}
+	/* Leave an entry unread, and seek back once past the end. */
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_header(a, positions[12]));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_header(a, positions[NFILES - 1]));
+	fixture_verify_entry(&files, a, NFILES - 1, 1);
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_header(a, positions[3]));
+	fixture_verify_entry(&files, a, 3, 1);
+	fixture_verify_entry(&files, a, 4, 1);
+}
+
+DEFINE_TEST(test_read_filter_gzip_index)
+{
+	const char *options = "gzip:index-file=test.idx,gzip:index-span=" SPAN;
+	struct counting_reader reader;
+	struct archive_entry *ae;
+	struct archive *a;
+	int64_t positions[NFILES];
+	int i, r;
+
+	r = fixture_write(&files, "test.tar.gz",
+	    archive_write_set_format_ustar, archive_write_add_filter_gzip);
+	if (r != ARCHIVE_OK) {
+		skipping("gzip writing not supported on this platform");
+		return;
+	}
+
+	/* The index options need a recent enough zlib. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_gzip(a));
+	r = archive_read_set_options(a, options);
+	if (r != ARCHIVE_OK) {
+		skipping("gzip seek index not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_options(a, "gzip:index-span=0"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_options(a, "gzip:index-span=abc"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_options(a, "gzip:nonexistent-option"));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* Without an index, gzip data can only be read in order. */
+	a = open_archive("test.tar.gz", "");
+	assert(archive_read_format_capabilities(a)
+	    & ARCHIVE_READ_FORMAT_CAPS_SEEK_HEADER);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_FAILED, archive_read_seek_header(a, 0));
+	fixture_verify_entry(&files, a, 1, 1);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* The first pass builds the index and records the headers. */
+	a = open_archive("test.tar.gz", options);
+	for (i = 0; i < NFILES; i++) {
+		fixture_verify_entry(&files, a, i, 1);
+		positions[i] = archive_read_header_position(a);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	assertFileExists("test.idx");
+
+	/* Later ones load it. */
+	a = open_archive("test.tar.gz", options);
+	verify_seeks(a, positions);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* Skipping entry data jumps over checkpoints. */
+	a = open_archive("test.tar.gz", options);
+	for (i = 0; i < NFILES; i++) {
+		if (i % 7 == 0) {
+			fixture_verify_entry(&files, a, i, 1);
+			continue;
+		}
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		assertEqualInt(positions[i], archive_read_header_position(a));
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* An index kept in memory serves seeks once it has been built. */
+	a = open_archive("test.tar.gz", "gzip:index,gzip:index-span=" SPAN);
+	for (i = 0; i < NFILES; i++)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	verify_seeks(a, positions);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* Seeking to the last entry reads a fraction of the input. */
+	memset(&reader, 0, sizeof(reader));
+	reader.data = slurpfile(&reader.size, "test.tar.gz");
+	assert(reader.data != NULL);
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_gzip(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_tar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_read_callback(a, counting_read));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_seek_callback(a, counting_seek));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_callback_data(a, &reader));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open1(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_header(a, positions[NFILES - 1]));
+	fixture_verify_entry(&files, a, NFILES - 1, 1);
+	failure("Read %jd of %jd bytes", (intmax_t)reader.delivered,
+	    (intmax_t)reader.size);
+	assert(reader.delivered < (int64_t)reader.size / 4);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free((void *)(uintptr_t)reader.data);
+
+	/* Plain tar input seeks through the client. */
+	fixture_write(&files, "test.tar", archive_write_set_format_ustar,
+	    archive_write_add_filter_none);
+	a = open_archive("test.tar", "");
+	verify_seeks(a, positions);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* An index built from other data is ignored and rebuilt. */
+	fixture_write(&shorter, "test2.tar.gz",
+	    archive_write_set_format_ustar, archive_write_add_filter_gzip);
+	for (r = 0; r < 2; r++) {
+		a = open_archive("test2.tar.gz", options);
+		for (i = 0; i < shorter.nfiles; i++) {
+			if (i % 7 == 0) {
+				fixture_verify_entry(&shorter, a, i, 1);
+				continue;
+			}
+			assertEqualIntA(a, ARCHIVE_OK,
+			    archive_read_next_header(a, &ae));
+			assertEqualInt(positions[i],
+			    archive_read_header_position(a));
+		}
+		assertEqualIntA(a, ARCHIVE_EOF,
+		    archive_read_next_header(a, &ae));
+		assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+		assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	}
+	a = open_archive("test2.tar.gz", options);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_header(a, positions[NFILES - 2]));
+	fixture_verify_entry(&shorter, a, NFILES - 2, 1);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* A gzip trailer that doesn't match the data is an error. */
+	reader.data = slurpfile(&reader.size, "test.tar.gz");
+	assert(reader.data != NULL);
+	((char *)(uintptr_t)reader.data)[reader.size - 8] ^= 1;
+	assertMakeBinFile("badcrc.tar.gz", 0644, reader.size, reader.data);
+	free((void *)(uintptr_t)reader.data);
+	a = open_archive("badcrc.tar.gz", "");
+	while ((r = archive_read_next_header(a, &ae)) == ARCHIVE_OK)
+		;
+	assertEqualIntA(a, ARCHIVE_FATAL, r);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* A damaged index is an error, not a silent rebuild. */
+	assertMakeFile("bad.idx", 0644, "LAGZIDX2 is not enough");
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_gzip(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_tar(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_options(a, "gzip:index-file=bad.idx"));
+	assertEqualIntA(a, ARCHIVE_FATAL,
+	    archive_read_open_filename(a, "test.tar.gz", 10240));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
@@ -0,0 +1,147 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Read a .tar.gz large enough for several batches with the
+ * "gzip:threads" option and check that the output is exactly that of
+ * the serial decoder, whether entry data is read, skipped or sought.
+ */
+
+#define	NFILES	24
+
+/*
+ * Half-compressible data in which every other 4 KiB recurs a few KiB
+ * later, so that blocks refer back across the ends of chunks.
+ */
+static void
+fill(char *buff, size_t size, int i)
+{
+	uint32_t x = (uint32_t)i * 2654435761U;
+	size_t j;
+
+	for (j = 0; j < size; j++) {
+		if (j % 8192 == 0)
+			x = (uint32_t)(j / 8192 % 5);
+		else if (j % 8192 == 4096)
+			x += (uint32_t)(i + j);
+		x = x * 1103515245 + 12345;
+		buff[j] = (char)('a' + ((x >> 16) & 15));
+	}
+}
+
+static const struct fixture files = { NFILES, 512 * 1024, 40961, fill };
+
+static struct archive *
+open_archive(const char *options)
+{
+	struct archive *a;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_tar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename(a, "test.tar.gz", 10240));
+	return (a);
+}
+
+/* Read every entry, or only every third one with skip set. */
+static void
+verify_archive(const char *options, int skip)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	int i;
+
+	a = open_archive(options);
+	for (i = 0; i < NFILES; i++)
+		fixture_verify_entry(&files, a, i, !skip || i % 3 == 1);
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_filter_gzip_parallel)
+{
+	static const int order[] = { 20, 3, 4, NFILES - 1, 0, 11 };
+	struct archive_entry *ae;
+	struct archive *a;
+	int64_t positions[NFILES];
+	size_t k;
+	int i, indexed, r;
+
+	r = fixture_write(&files, "test.tar.gz",
+	    archive_write_set_format_ustar, archive_write_add_filter_gzip);
+	if (r != ARCHIVE_OK) {
+		skipping("gzip writing not supported on this platform");
+		return;
+	}
+
+	/* Only accepted in range, and only where supported. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_gzip(a));
+	if (archive_read_set_options(a, "gzip:threads=64") != ARCHIVE_OK) {
+		assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+		skipping("parallel gzip decoding not supported on this "
+		    "platform");
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_options(a, "gzip:threads=0"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_options(a, "gzip:threads=65"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_options(a, "gzip:threads=abc"));
+	indexed = archive_read_set_options(a, "gzip:index") == ARCHIVE_OK;
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	verify_archive("", 0);
+	verify_archive("gzip:threads=2", 0);
+	verify_archive("gzip:threads=4", 0);
+	verify_archive("gzip:threads=3", 1);
+
+	/* Seeks drop output decoded ahead and carry on in parallel. */
+	if (!indexed) {
+		skipping("gzip seek index not supported on this platform");
+		return;
+	}
+	a = open_archive("gzip:threads=4,gzip:index");
+	for (i = 0; i < NFILES; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		positions[i] = archive_read_header_position(a);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	for (k = 0; k < sizeof(order) / sizeof(order[0]); k++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_seek_header(a, positions[order[k]]));
+		fixture_verify_entry(&files, a, order[k], 1);
+		if (order[k] + 1 < NFILES)
+			fixture_verify_entry(&files, a, order[k] + 1, 1);
+	}
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
@@ -0,0 +1,112 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Read archives through archive_read_open_filename() and
+ * archive_read_open_fd() with the "read:prefetch" option.  Small
+ * blocks and shallow rings make skips land both inside and beyond the
+ * blocks read ahead, and the seeking zip reader restarts it.
+ */
+
+static const struct fixture files = { 24, 1, 3001, NULL };
+
+/*
+ * Read every entry, skipping the data of every third one, from the
+ * file or, if fd is not -1, from the descriptor.
+ */
+static void
+read_archive(const char *name, int fd,
+    int (*support_format)(struct archive *), const char *options)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	int i;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, support_format(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	if (fd == -1)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_open_filename(a, name, 512));
+	else
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_open_fd(a, fd, 1024));
+	for (i = 0; i < files.nfiles; i++) {
+		failure("Reading %s with %s", name, options);
+		fixture_verify_entry(&files, a, i, i % 3 != 2);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+static void
+read_archives(const char *name, int (*support_format)(struct archive *),
+    const char *options)
+{
+	int fd;
+
+	read_archive(name, -1, support_format, options);
+	fd = open(name, O_RDONLY | O_BINARY);
+	if (!assert(fd >= 0))
+		return;
+	read_archive(name, fd, support_format, options);
+	close(fd);
+}
+
+DEFINE_TEST(test_read_prefetch)
+{
+	static const char *options[] = {
+		"!prefetch", "read:prefetch=1", "read:prefetch=2",
+		"prefetch=16", "read:prefetch=4,read:mmap", NULL
+	};
+	struct archive *a;
+	int i;
+
+	fixture_write(&files, "test.tar", archive_write_set_format_ustar,
+	    archive_write_add_filter_none);
+	fixture_write(&files, "test.zip", archive_write_set_format_zip,
+	    archive_write_add_filter_none);
+	for (i = 0; options[i] != NULL; i++) {
+		read_archives("test.tar", archive_read_support_format_tar,
+		    options[i]);
+		read_archives("test.zip",
+		    archive_read_support_format_zip_seekable, options[i]);
+	}
+
+	/* Invalid values. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_option(a, "read", "prefetch", "abc"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_option(a, "read", "prefetch", "-1"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_option(a, "read", "prefetch", "1025"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_option(a, "read", "prefetch", "1024"));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
@@ -0,0 +1,242 @@
+/*-
+ * Copyright (c) 2016 Stony Brook University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+
+#ifdef HAVE_TC_API_H
+#include <tc_api.h>
+
+static void
+write_entry(struct archive *a, const char *pathname, mode_t mode,
+    const char *data, int64_t size)
+{
+	struct archive_entry *ae;
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, pathname);
+	archive_entry_set_mode(ae, mode);
+	archive_entry_set_mtime(ae, 123456789, 0);
+	if (size >= 0)
+		archive_entry_set_size(ae, size);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+	if (data != NULL)
+		assertEqualIntA(a, size,
+		    archive_write_data(a, data, (size_t)size));
+}
+
+static void
+test_write_disk_tc_extract(void)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char blocks[300];
+	char *big;
+	int i;
+
+	/* Small batches, so that extraction spans several flushes. */
+	assert((a = archive_write_disk_tc_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_disk_tc_set_batch_size(a, 4, 100000));
+	/* Existing files can only be overwritten in place. */
+	assertEqualIntA(a, ARCHIVE_FAILED, archive_write_disk_set_options(a,
+	    ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_NO_OVERWRITE));
+	assertEqualIntA(a, ARCHIVE_FAILED, archive_write_disk_set_options(a,
+	    ARCHIVE_EXTRACT_NO_OVERWRITE_NEWER));
+	assertEqualIntA(a, ARCHIVE_FAILED, archive_write_disk_set_options(a,
+	    ARCHIVE_EXTRACT_UNLINK));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_disk_set_options(a,
+	    ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_TIME |
+	    ARCHIVE_EXTRACT_SECURE_NODOTDOT));
+
+	/* A read-only directory still receives its contents. */
+	write_entry(a, "dir", AE_IFDIR | 0555, NULL, -1);
+	write_entry(a, "dir/file", AE_IFREG | 0640, "contents", 8);
+	/* Parents missing from the archive are created. */
+	write_entry(a, "a/b/c/file", AE_IFREG | 0644, "deep", 4);
+	write_entry(a, "empty", AE_IFREG | 0644, NULL, 0);
+	/* Data larger than a batch is split across flushes. */
+	big = malloc(250000);
+	assert(big != NULL);
+	for (i = 0; i < 250000; i++)
+		big[i] = (char)(i % 251);
+	write_entry(a, "big", AE_IFREG | 0600, big, 250000);
+	/* So is data written in pieces, which go on in the same write. */
+	write_entry(a, "pieces", AE_IFREG | 0644, NULL, 250000);
+	for (i = 0; i < 250000; i += 999)
+		assertEqualIntA(a, i + 999 > 250000 ? 250000 - i : 999,
+		    archive_write_data(a, big + i, 999));
+	/* Blocks that leave a hole start another write. */
+	write_entry(a, "blocks", AE_IFREG | 0644, NULL, 300);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_data_block(a, "ab", 2, 0));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_data_block(a, "cd", 2, 2));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_data_block(a, "ef", 2, 298));
+	/* A file ending in a hole is extended by its size. */
+	write_entry(a, "sparse", AE_IFREG | 0644, "xyz", 4096);
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "./dir//symlink");
+	archive_entry_set_mode(ae, AE_IFLNK | 0777);
+	archive_entry_copy_symlink(ae, "file");
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "hardlink");
+	archive_entry_copy_hardlink(ae, "big");
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+
+	/* '..' is refused before anything is queued. */
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "../escape");
+	archive_entry_set_mode(ae, AE_IFREG | 0644);
+	archive_entry_set_size(ae, 0);
+	assertEqualIntA(a, ARCHIVE_FAILED, archive_write_header(a, ae));
+	archive_entry_free(ae);
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	assertIsDir("dir", 0555);
+	assertIsReg("dir/file", 0640);
+	assertFileContents("contents", 8, "dir/file");
+	assertIsDir("a/b/c", -1);
+	assertFileContents("deep", 4, "a/b/c/file");
+	assertIsReg("empty", 0644);
+	assertFileSize("empty", 0);
+	assertIsSymlink("dir/symlink", "file");
+	assertIsReg("big", 0600);
+	assertFileContents(big, 250000, "big");
+	assertFileContents(big, 250000, "pieces");
+	memset(blocks, 0, sizeof(blocks));
+	memcpy(blocks, "abcd", 4);
+	memcpy(blocks + 298, "ef", 2);
+	assertFileContents(blocks, 300, "blocks");
+	assertIsHardlink("big", "hardlink");
+	assertFileSize("sparse", 4096);
+	assertFileMtime("sparse", 123456789, 0);
+	assertFileNLinks("big", 2);
+	assertFileNotExists("../escape");
+	free(big);
+}
+
+static void
+write_symlink(struct archive *a, const char *pathname, const char *target)
+{
+	struct archive_entry *ae;
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, pathname);
+	archive_entry_set_mode(ae, AE_IFLNK | 0777);
+	archive_entry_copy_symlink(ae, target);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+}
+
+static void
+refuse_entry(struct archive *a, const char *pathname, mode_t mode)
+{
+	struct archive_entry *ae;
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, pathname);
+	archive_entry_set_mode(ae, mode);
+	archive_entry_set_size(ae, 0);
+	failure("Extracting %s", pathname);
+	assertEqualIntA(a, ARCHIVE_FAILED, archive_write_header(a, ae));
+	archive_entry_free(ae);
+}
+
+/*
+ * A symlink from the archive must not be extracted through, whether or
+ * not it has been created on the server by the time the entries using it
+ * are queued.
+ */
+static void
+test_write_disk_tc_secure_symlinks(int max_ops)
+{
+	struct archive *a;
+
+	assertMakeDir("outside", 0755);
+	assert((a = archive_write_disk_tc_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_disk_tc_set_batch_size(a, max_ops, 100000));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_disk_set_options(a,
+	    ARCHIVE_EXTRACT_SECURE_SYMLINKS));
+	write_symlink(a, "lnk", "outside");
+	refuse_entry(a, "lnk/file", AE_IFREG | 0644);
+	refuse_entry(a, "lnk/dir/file", AE_IFREG | 0644);
+	refuse_entry(a, "lnk", AE_IFREG | 0644);
+	refuse_entry(a, "lnk", AE_IFDIR | 0755);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	assertIsSymlink("lnk", "outside");
+	assertFileNotExists("outside/file");
+	assertFileNotExists("outside/dir");
+
+	/* Otherwise the symlink is followed, but never made a directory. */
+	assert((a = archive_write_disk_tc_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_disk_tc_set_batch_size(a, max_ops, 100000));
+	write_symlink(a, "lnk2", "outside");
+	write_entry(a, "lnk2/file", AE_IFREG | 0644, "x", 1);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	assertIsSymlink("lnk2", "outside");
+	assertFileContents("x", 1, "outside/file");
+}
+#endif
+
+DEFINE_TEST(test_write_disk_tc)
+{
+#ifdef HAVE_TC_API_H
+	void *context;
+
+	/* Without a config file, tc runs on its local POSIX backend. */
+	context = tc_init(NULL, "test_write_disk_tc.log", 77);
+	if (context == NULL) {
+		skipping("tc could not be initialized");
+		return;
+	}
+	test_write_disk_tc_extract();
+	assertMakeDir("batch1", 0755);
+	assertChdir("batch1");
+	test_write_disk_tc_secure_symlinks(1);
+	assertChdir("..");
+	assertMakeDir("batched", 0755);
+	assertChdir("batched");
+	test_write_disk_tc_secure_symlinks(256);
+	assertChdir("..");
+	tc_deinit(context);
+#else
+	skipping("tc I/O is not supported on this platform");
+	assert(archive_write_disk_tc_new() == NULL);
+#endif
+}
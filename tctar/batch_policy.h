@@ -0,0 +1,106 @@
+#ifndef TCTAR_BATCH_POLICY_H
+#define TCTAR_BATCH_POLICY_H
+
+#include <algorithm>
+#include <mutex>
+
+#define BATCH_INITIAL_SCALE (1.0 / 16)
+#define BATCH_MIN_SCALE (1.0 / 256)
+#define BATCH_OP_COST 4096
+#define BATCH_MIN_OPS ((size_t)8)
+#define BATCH_MIN_BYTES ((size_t)64 * 1024)
+#define BATCH_MIN_AGE 0.001
+
+/*
+ * Decides when a batch is closed and sent as one compound: once it holds
+ * target_ops operations, target_bytes bytes of file data, or has been open
+ * for longer than max_age seconds.
+ *
+ * When adaptive, the targets are retuned after every compound by hill
+ * climbing on its measured throughput: the batch size keeps moving in the
+ * same direction (growing by default) while throughput improves and turns
+ * around when it drops.  Each operation counts as BATCH_OP_COST bytes, so a
+ * tree of tiny files is tuned on operations and a tree of huge files on bytes.
+ * max_age follows the average compound latency: once a batch has waited as
+ * long as a round trip takes and nothing else is in flight, sending it beats
+ * waiting for more entries.
+ *
+ * record() is called by the thread issuing compounds while full() is called
+ * by the thread filling batches, so the state is protected by a mutex.
+ */
+class batch_policy
+{
+public:
+	batch_policy(size_t ops_limit, size_t bytes_limit, bool adaptive)
+	    : ops_limit(ops_limit), bytes_limit(bytes_limit),
+	      adaptive(adaptive),
+	      scale(adaptive ? BATCH_INITIAL_SCALE : 1.0), growing(true),
+	      last_rate(0), latency(0)
+	{
+		retarget();
+	}
+
+	/* Whether a batch must be sent before it grows to @ops and @bytes. */
+	bool full(size_t ops, size_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return ops > target_ops || bytes > target_bytes;
+	}
+
+	/*
+	 * Whether a batch opened at @opened has waited long enough that it
+	 * should be sent as is.  Only worth asking while the stage consuming
+	 * batches is idle.
+	 */
+	bool stale(double opened, double now)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return adaptive && now - opened > max_age;
+	}
+
+	/* Account for one compound of @ops operations and @bytes bytes. */
+	void record(size_t ops, size_t bytes, double seconds)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		double rate;
+
+		if (!adaptive) {
+			return;
+		}
+		rate = (bytes + ops * BATCH_OP_COST) / std::max(seconds, 1e-6);
+		latency = latency == 0 ? seconds : 0.8 * latency + 0.2 * seconds;
+		if (rate < last_rate * 0.9) {
+			growing = !growing;
+		}
+		last_rate = rate;
+		scale = std::min(1.0, std::max(BATCH_MIN_SCALE,
+					       scale * (growing ? 1.5 : 0.75)));
+		retarget();
+	}
+
+private:
+	void retarget()
+	{
+		target_ops = std::min(
+		    ops_limit,
+		    std::max(BATCH_MIN_OPS, (size_t)(ops_limit * scale)));
+		target_bytes = std::min(
+		    bytes_limit,
+		    std::max(BATCH_MIN_BYTES, (size_t)(bytes_limit * scale)));
+		max_age = std::max(BATCH_MIN_AGE, latency);
+	}
+
+	const size_t ops_limit;
+	const size_t bytes_limit;
+	const bool adaptive;
+	double scale;
+	bool growing;
+	double last_rate;
+	double latency;
+	size_t target_ops;
+	size_t target_bytes;
+	double max_age;
+	std::mutex mutex;
+};
+
+#endif /* TCTAR_BATCH_POLICY_H */
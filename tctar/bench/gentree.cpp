@@ -0,0 +1,195 @@
+/*
+ * Generate a synthetic source tree for benchmarking tctar and tcuntar.
+ *
+ * The tree is a deterministic function of the distribution, the file count,
+ * the maximum file size and the seed, so runs on different machines archive
+ * the same data.  Files are spread over two levels of directories holding
+ * FILES_PER_DIR files each, and one in SYMLINK_EVERY files is a symlink.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../util.h"
+
+#define FILES_PER_DIR 256
+#define DIRS_PER_DIR 16
+#define SYMLINK_EVERY 64
+#define WRITE_SIZE (1024 * 1024)
+
+/*
+ * tiny:  many files of up to 4 KiB, dominated by per-file operations.
+ * mixed: sizes spread log-uniformly from 64 bytes to the maximum size.
+ * huge:  a few files of the maximum size, dominated by data transfer.
+ */
+struct distribution
+{
+	const char *name;
+	size_t files;
+	size_t max_size;
+};
+
+static const struct distribution distributions[] = {
+	{ "tiny", 20000, 4096 },
+	{ "mixed", 2000, 1024 * 1024 },
+	{ "huge", 4, 128UL * 1024 * 1024 },
+};
+
+static size_t file_size(const struct distribution *dist, size_t max_size,
+			std::mt19937_64 &rng)
+{
+	if (strcmp(dist->name, "tiny") == 0) {
+		std::uniform_int_distribution<size_t> size(0, max_size);
+		return size(rng);
+	} else if (strcmp(dist->name, "mixed") == 0) {
+		std::uniform_real_distribution<double> exponent(
+		    std::log(64.0), std::log(std::max(max_size, (size_t)64)));
+		return (size_t)std::exp(exponent(rng));
+	}
+	return max_size;
+}
+
+static bool make_dir(const std::string &path)
+{
+	if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+		printf("mkdir: %s (%s)\n", strerror(errno), path.c_str());
+		return false;
+	}
+	return true;
+}
+
+/* Fill a file with incompressible pseudo-random data. */
+static bool write_file(const std::string &path, size_t size,
+		       std::mt19937_64 &rng, std::vector<uint64_t> &buf)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0) {
+		printf("open: %s (%s)\n", strerror(errno), path.c_str());
+		return false;
+	}
+	while (size > 0) {
+		size_t length = std::min(size, (size_t)WRITE_SIZE);
+		for (size_t i = 0; i < (length + 7) / 8; i++) {
+			buf[i] = rng();
+		}
+		if (write(fd, buf.data(), length) != (ssize_t)length) {
+			printf("write: %s (%s)\n", strerror(errno),
+			       path.c_str());
+			close(fd);
+			return false;
+		}
+		size -= length;
+	}
+	close(fd);
+	return true;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [--files=N] [--max-size=SIZE] [--seed=N] "
+		"<tiny|mixed|huge> <dir>\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "files", required_argument, NULL, 'f' },
+		{ "max-size", required_argument, NULL, 'x' },
+		{ "seed", required_argument, NULL, 's' },
+		{ NULL, 0, NULL, 0 },
+	};
+	const struct distribution *dist = NULL;
+	size_t files = 0;
+	size_t max_size = 0;
+	unsigned long seed = 1;
+	size_t total = 0;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'f':
+			files = strtoull(optarg, NULL, 10);
+			break;
+		case 'x':
+			max_size = parse_size(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2) {
+		usage(argv[0]);
+	}
+	for (auto &d : distributions) {
+		if (strcmp(d.name, argv[optind]) == 0) {
+			dist = &d;
+		}
+	}
+	if (dist == NULL) {
+		usage(argv[0]);
+	}
+	if (files == 0) {
+		files = dist->files;
+	}
+	if (max_size == 0) {
+		max_size = dist->max_size;
+	}
+
+	std::string root = argv[optind + 1];
+	std::mt19937_64 rng(seed);
+	std::vector<uint64_t> buf(WRITE_SIZE / 8);
+	char name[64];
+
+	if (!make_dir(root)) {
+		return 1;
+	}
+	for (size_t i = 0; i < files; i++) {
+		size_t dir = i / FILES_PER_DIR;
+		snprintf(name, sizeof(name), "/d%02zu", dir / DIRS_PER_DIR);
+		std::string top = root + name;
+		snprintf(name, sizeof(name), "/d%04zu", dir);
+		std::string parent = top + name;
+
+		if (i % FILES_PER_DIR == 0 &&
+		    (!make_dir(top) || !make_dir(parent))) {
+			return 1;
+		}
+		if (i % SYMLINK_EVERY == SYMLINK_EVERY - 1) {
+			char target[64];
+			snprintf(target, sizeof(target), "f%06zu", i - 1);
+			snprintf(name, sizeof(name), "/l%06zu", i);
+			if (symlink(target, (parent + name).c_str()) != 0) {
+				printf("symlink: %s (%s%s)\n",
+				       strerror(errno), parent.c_str(), name);
+				return 1;
+			}
+			continue;
+		}
+		snprintf(name, sizeof(name), "/f%06zu", i);
+		size_t size = file_size(dist, max_size, rng);
+		if (!write_file(parent + name, size, rng, buf)) {
+			return 1;
+		}
+		total += size;
+	}
+	printf("%zu entries, %.1f MiB in %s\n", files, total / 1048576.0,
+	       root.c_str());
+	return 0;
+}
@@ -0,0 +1,100 @@
+#!/bin/sh
+# Benchmark tctar/tcuntar on the POSIX tc backend against bsdtar.
+#
+# A synthetic tree is generated for each file-size distribution, archived and
+# extracted by tctar/tcuntar with an injected per-compound latency standing
+# in for the NFS round trip, then by bsdtar on the same tree.  Archives are
+# uncompressed so the numbers reflect batching and pipelining, not xz.
+
+usage()
+{
+	echo "usage: $0 [-d \"tiny mixed huge\"] [-l latency_usec] [-n files]" \
+	     "[-w workdir] <bindir>" >&2
+	echo "  <bindir> holds tctar, tcuntar, tc_gentree and bsdtar" >&2
+	exit 1
+}
+
+dists="tiny mixed huge"
+latency=1000
+files=
+work=/tmp/tcbench
+while getopts d:l:n:w: opt; do
+	case $opt in
+	d) dists=$OPTARG ;;
+	l) latency=$OPTARG ;;
+	n) files="--files=$OPTARG" ;;
+	w) work=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+test $# -eq 1 || usage
+bin=$(cd "$1" && pwd) || exit 1
+for tool in tctar tcuntar tc_gentree bsdtar; do
+	test -x "$bin/$tool" || { echo "missing $bin/$tool" >&2; exit 1; }
+done
+mkdir -p "$work" || exit 1
+cd "$work" || exit 1
+
+now()
+{
+	date +%s.%N
+}
+
+# report <tool> <operation> <start> <end> <files> <bytes> <compounds>
+report()
+{
+	awk -v tool="$1" -v op="$2" -v start="$3" -v end="$4" -v files="$5" \
+	    -v bytes="$6" -v compounds="$7" 'BEGIN {
+		secs = end - start
+		if (secs <= 0) secs = 1e-6
+		printf "%-8s %-8s %9.2f %12.0f %10.1f %10s\n", tool, op, secs,
+		       files / secs, bytes / 1048576 / secs, compounds
+	}'
+}
+
+# compounds <stderr file>
+compounds()
+{
+	sed -n 's/^compounds: //p' "$1"
+}
+
+echo "latency: ${latency}us per compound"
+for dist in $dists; do
+	src=src-$dist${files:+-${files#--files=}}
+	if [ ! -d $src ]; then
+		"$bin/tc_gentree" $files $dist $src || exit 1
+	fi
+	nfiles=$(find $src | wc -l)
+	nbytes=$(find $src -type f -printf '%s\n' |
+	    awk '{ s += $1 } END { print s + 0 }')
+	echo
+	echo "$dist: $nfiles entries, $nbytes bytes"
+	printf "%-8s %-8s %9s %12s %10s %10s\n" tool op seconds files/s MB/s \
+	       compounds
+	rm -rf tc.tar tc-out bsd.tar bsd-out
+	mkdir tc-out bsd-out
+
+	start=$(now)
+	"$bin/tctar" --posix --no-compress --inject-latency=$latency --stats \
+	    tc.tar $src 2>tc.err >tc.log || { cat tc.log tc.err; exit 1; }
+	report tctar create $start $(now) $nfiles $nbytes $(compounds tc.err)
+
+	start=$(now)
+	(cd tc-out && "$bin/tcuntar" --posix --inject-latency=$latency \
+	    --stats ../tc.tar 2>../tc.err >../tc.log) ||
+	    { cat tc.log tc.err; exit 1; }
+	report tcuntar extract $start $(now) $nfiles $nbytes $(compounds tc.err)
+
+	start=$(now)
+	"$bin/bsdtar" -cf bsd.tar $src || exit 1
+	report bsdtar create $start $(now) $nfiles $nbytes -
+
+	start=$(now)
+	"$bin/bsdtar" -xf bsd.tar -C bsd-out || exit 1
+	report bsdtar extract $start $(now) $nfiles $nbytes -
+
+	diff -r $src tc-out/$src >/dev/null ||
+	    echo "warning: tcuntar output differs from $src"
+done
+rm -rf tc.tar tc-out bsd.tar bsd-out tc.err tc.log
@@ -0,0 +1,86 @@
+#ifndef TCTAR_BOUNDED_QUEUE_H
+#define TCTAR_BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/*
+ * A fixed-capacity FIFO connecting two pipeline stages.  push() blocks while
+ * the queue is full and pop() blocks while it is empty.  After close(), push()
+ * fails and pop() drains the remaining items before returning false.
+ */
+template <typename T> class bounded_queue
+{
+public:
+	explicit bounded_queue(size_t capacity)
+	    : capacity(capacity > 0 ? capacity : 1), closed(false)
+	{
+	}
+
+	bool push(const T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [this] {
+			return closed || items.size() < capacity;
+		});
+		if (closed) {
+			return false;
+		}
+		items.push_back(item);
+		not_empty.notify_one();
+		return true;
+	}
+
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [this] {
+			return closed || !items.empty();
+		});
+		if (items.empty()) {
+			return false;
+		}
+		item = items.front();
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+
+	/* Like pop(), but fails instead of blocking when the queue is empty. */
+	bool try_pop(T &item)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (items.empty()) {
+			return false;
+		}
+		item = items.front();
+		items.pop_front();
+		not_full.notify_one();
+		return true;
+	}
+
+	bool empty()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return items.empty();
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		not_empty.notify_all();
+		not_full.notify_all();
+	}
+
+private:
+	const size_t capacity;
+	bool closed;
+	std::deque<T> items;
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+};
+
+#endif /* TCTAR_BOUNDED_QUEUE_H */
@@ -0,0 +1,150 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "compound.h"
+#include "stats.h"
+#include "util.h"
+
+static unsigned long latency_usec;
+static std::atomic<unsigned long> compounds(0);
+
+void compound_set_latency(unsigned long usec)
+{
+	latency_usec = usec;
+}
+
+unsigned long compound_count()
+{
+	return compounds;
+}
+
+/* Account for one compound about to be sent and return its start time. */
+static double compound_begin()
+{
+	double start = now_seconds();
+
+	compounds++;
+	if (latency_usec > 0) {
+		std::this_thread::sleep_for(
+		    std::chrono::microseconds(latency_usec));
+	}
+	return start;
+}
+
+static void compound_end(enum stats_call call, size_t ops, size_t bytes,
+			 double start)
+{
+	stats_record_compound(call, ops, bytes, now_seconds() - start);
+}
+
+static size_t iovec_bytes(const struct tc_iovec *iovs, int count)
+{
+	size_t bytes = 0;
+
+	for (int i = 0; i < count; i++) {
+		bytes += iovs[i].length;
+	}
+	return bytes;
+}
+
+tc_res compound_readv(struct tc_iovec *reads, int count, bool is_transaction)
+{
+	double start = compound_begin();
+	tc_res res = tc_readv(reads, count, is_transaction);
+
+	compound_end(STATS_READV, count, iovec_bytes(reads, count), start);
+	return res;
+}
+
+tc_res compound_writev(struct tc_iovec *writes, int count,
+		       bool is_transaction)
+{
+	double start = compound_begin();
+	tc_res res = tc_writev(writes, count, is_transaction);
+
+	compound_end(STATS_WRITEV, count, iovec_bytes(writes, count), start);
+	return res;
+}
+
+/* Counts the entries a listdir compound passes to the real callback. */
+struct listdir_counter
+{
+	tc_listdirv_cb cb;
+	void *cbarg;
+	size_t entries;
+};
+
+static bool count_entry(const struct tc_attrs *entry, const char *dir,
+			void *cbarg)
+{
+	struct listdir_counter *counter = (struct listdir_counter *)cbarg;
+
+	counter->entries++;
+	return counter->cb(entry, dir, counter->cbarg);
+}
+
+/* The operations recorded for a listdir compound are the entries listed. */
+tc_res compound_listdirv(const char **dirs, int count,
+			 struct tc_attrs_masks masks, int max_entries,
+			 bool recursive, tc_listdirv_cb cb, void *cbarg,
+			 bool is_transaction)
+{
+	struct listdir_counter counter = { cb, cbarg, 0 };
+	double start = compound_begin();
+	tc_res res = tc_listdirv(dirs, count, masks, max_entries, recursive,
+				 count_entry, &counter, is_transaction);
+
+	compound_end(STATS_LISTDIRV, counter.entries, 0, start);
+	return res;
+}
+
+tc_res compound_readlinkv(const char **paths, char **bufs, size_t *bufsizes,
+			  int count, bool is_transaction)
+{
+	double start = compound_begin();
+	tc_res res =
+	    tc_readlinkv(paths, bufs, bufsizes, count, is_transaction);
+
+	compound_end(STATS_READLINKV, count, 0, start);
+	return res;
+}
+
+tc_res compound_mkdirv(struct tc_attrs *dirs, int count, bool is_transaction)
+{
+	double start = compound_begin();
+	tc_res res = tc_mkdirv(dirs, count, is_transaction);
+
+	compound_end(STATS_MKDIRV, count, 0, start);
+	return res;
+}
+
+tc_res compound_symlinkv(const char **oldpaths, const char **newpaths,
+			 int count, bool is_transaction)
+{
+	double start = compound_begin();
+	tc_res res = tc_symlinkv(oldpaths, newpaths, count, is_transaction);
+
+	compound_end(STATS_SYMLINKV, count, 0, start);
+	return res;
+}
+
+tc_res compound_hardlinkv(const char **oldpaths, const char **newpaths,
+			  int count, bool is_transaction)
+{
+	double start = compound_begin();
+	tc_res res = tc_hardlinkv(oldpaths, newpaths, count, is_transaction);
+
+	compound_end(STATS_HARDLINKV, count, 0, start);
+	return res;
+}
+
+tc_res compound_setattrsv(struct tc_attrs *attrs, int count,
+			  bool is_transaction)
+{
+	double start = compound_begin();
+	tc_res res = tc_setattrsv(attrs, count, is_transaction);
+
+	compound_end(STATS_SETATTRSV, count, 0, start);
+	return res;
+}
@@ -0,0 +1,34 @@
+#ifndef TCTAR_COMPOUND_H
+#define TCTAR_COMPOUND_H
+
+#include "tc_api.h"
+
+/*
+ * tctar and tcuntar issue every tc compound through these wrappers, which
+ * take the same arguments as the tc_*v() calls they forward to.
+ *
+ * They count the compounds issued, record their statistics (see stats.h),
+ * and can delay each one by a fixed latency, which makes a run on the POSIX
+ * tc backend behave like one against an NFS server that far away.
+ */
+void compound_set_latency(unsigned long usec);
+unsigned long compound_count();
+
+tc_res compound_readv(struct tc_iovec *reads, int count, bool is_transaction);
+tc_res compound_writev(struct tc_iovec *writes, int count,
+		       bool is_transaction);
+tc_res compound_listdirv(const char **dirs, int count,
+			 struct tc_attrs_masks masks, int max_entries,
+			 bool recursive, tc_listdirv_cb cb, void *cbarg,
+			 bool is_transaction);
+tc_res compound_readlinkv(const char **paths, char **bufs, size_t *bufsizes,
+			  int count, bool is_transaction);
+tc_res compound_mkdirv(struct tc_attrs *dirs, int count, bool is_transaction);
+tc_res compound_symlinkv(const char **oldpaths, const char **newpaths,
+			 int count, bool is_transaction);
+tc_res compound_hardlinkv(const char **oldpaths, const char **newpaths,
+			  int count, bool is_transaction);
+tc_res compound_setattrsv(struct tc_attrs *attrs, int count,
+			  bool is_transaction);
+
+#endif /* TCTAR_COMPOUND_H */
@@ -0,0 +1,134 @@
+#ifndef TCTAR_COMPRESSION_POLICY_H
+#define TCTAR_COMPRESSION_POLICY_H
+
+#include <algorithm>
+#include <mutex>
+
+/* libarchive's xz filter clamps higher levels to 6. */
+#define COMPRESSION_MIN_LEVEL 0
+#define COMPRESSION_MAX_LEVEL 6
+/* The rates are compared once the compressor has been measured this long. */
+#define COMPRESSION_WINDOW_SECONDS 0.5
+#define COMPRESSION_MAX_WINDOW_SCALE 16
+/* Rates within this factor of each other are balanced. */
+#define COMPRESSION_SLACK 1.2
+
+/*
+ * Chooses the xz compression level and thread count so that the compressor
+ * and the link draining its output are both kept busy.
+ *
+ * The compressor rate is archive bytes compressed per second spent inside
+ * libarchive.  The drain rate is compressed bytes per second of tc_writev,
+ * scaled by the compression ratio measured over the same window into the
+ * archive bytes the link could carry.  Both count busy time only, so the
+ * stage that waits on the other still reports what it could sustain.
+ *
+ * When adaptive, the rates are compared after every window: while the link
+ * is faster, a thread is added or, once max_threads are running, the level is
+ * lowered; while the compressor is faster, the spare CPU goes to a higher
+ * level, which shrinks the output.  Each change restarts the xz stream, so
+ * the window doubles whenever the direction reverses, which keeps a pair of
+ * settings straddling the balance point from being swapped at every window.
+ *
+ * compressed() and retune() are called by the writer thread and drained()
+ * by the thread issuing tc_writev, so the state is protected by a mutex.
+ */
+class compression_policy
+{
+public:
+	compression_policy(int level, int threads, int max_threads,
+			   bool adaptive)
+	    : adaptive(adaptive), max_threads(std::max(max_threads, 1)),
+	      level(level), threads(threads), direction(0), window_scale(1),
+	      drain_rate(0)
+	{
+		reset_window();
+	}
+
+	/* Account for @in archive bytes compressed into @out in @seconds. */
+	void compressed(size_t in, size_t out, double seconds)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		window_in += in;
+		window_out += out;
+		window_seconds += seconds;
+	}
+
+	/* Account for one tc_writev of @bytes that took @seconds. */
+	void drained(size_t bytes, double seconds)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		double rate = bytes / std::max(seconds, 1e-6);
+
+		drain_rate =
+		    drain_rate == 0 ? rate : 0.8 * drain_rate + 0.2 * rate;
+	}
+
+	/*
+	 * Whether the compression settings should change, in which case the
+	 * new ones are returned in @new_level and @new_threads.
+	 */
+	bool retune(int *new_level, int *new_threads)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		double compress_rate, link_rate;
+		int want = 0;
+
+		if (!adaptive || drain_rate == 0 || window_out == 0 ||
+		    window_seconds < COMPRESSION_WINDOW_SECONDS * window_scale) {
+			return false;
+		}
+		compress_rate = window_in / window_seconds;
+		link_rate = drain_rate * window_in / window_out;
+		reset_window();
+
+		if (compress_rate * COMPRESSION_SLACK < link_rate) {
+			if (threads < max_threads) {
+				threads++;
+			} else if (level > COMPRESSION_MIN_LEVEL) {
+				level--;
+			} else {
+				return false;
+			}
+			want = -1;
+		} else if (link_rate * COMPRESSION_SLACK < compress_rate &&
+			   level < COMPRESSION_MAX_LEVEL) {
+			level++;
+			want = 1;
+		} else {
+			return false;
+		}
+		if (direction != 0 && want != direction) {
+			window_scale = std::min(window_scale * 2,
+						COMPRESSION_MAX_WINDOW_SCALE);
+		}
+		direction = want;
+		*new_level = level;
+		*new_threads = threads;
+		return true;
+	}
+
+private:
+	void reset_window()
+	{
+		window_in = 0;
+		window_out = 0;
+		window_seconds = 0;
+	}
+
+	const bool adaptive;
+	const int max_threads;
+	int level;
+	int threads;
+	/* -1 after trading ratio for speed, 1 after the opposite. */
+	int direction;
+	int window_scale;
+	double drain_rate;
+	size_t window_in;
+	size_t window_out;
+	double window_seconds;
+	std::mutex mutex;
+};
+
+#endif /* TCTAR_COMPRESSION_POLICY_H */
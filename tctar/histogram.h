@@ -0,0 +1,126 @@
+#ifndef TCTAR_HISTOGRAM_H
+#define TCTAR_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+/* Each power of two is split into 2^(HISTOGRAM_SUB_BITS - 1) buckets. */
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_HALF_COUNT (HISTOGRAM_SUB_COUNT / 2)
+
+/*
+ * A log-linear histogram of non-negative integers in the style of
+ * HdrHistogram: values below HISTOGRAM_SUB_COUNT are counted exactly and
+ * larger ones with a relative error below 1 / HISTOGRAM_HALF_COUNT, over the
+ * whole 64-bit range in under a thousand buckets.  Not thread-safe.
+ */
+class histogram
+{
+public:
+	histogram() : total(0), sum(0), min_value(UINT64_MAX), max_value(0)
+	{
+	}
+
+	void record(uint64_t value)
+	{
+		size_t index = bucket_index(value);
+
+		if (index >= counts.size()) {
+			counts.resize(index + 1);
+		}
+		counts[index]++;
+		total++;
+		sum += value;
+		min_value = std::min(min_value, value);
+		max_value = std::max(max_value, value);
+	}
+
+	uint64_t count() const
+	{
+		return total;
+	}
+
+	/* The smallest value at or below which @percent percent fall. */
+	uint64_t percentile(double percent) const
+	{
+		uint64_t rank = (uint64_t)(total * percent / 100 + 0.5);
+		uint64_t seen = 0;
+
+		rank = std::max(rank, (uint64_t)1);
+		for (size_t i = 0; i < counts.size(); i++) {
+			seen += counts[i];
+			if (seen >= rank) {
+				return std::min(highest_equivalent(i),
+						max_value);
+			}
+		}
+		return max_value;
+	}
+
+	/*
+	 * Print the histogram as a JSON object: summary statistics and the
+	 * non-empty buckets as [highest value, count] pairs.
+	 */
+	void print_json(FILE *out) const
+	{
+		bool first = true;
+
+		fprintf(out,
+			"{\"count\": %llu, \"min\": %llu, \"mean\": %.1f, "
+			"\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+			"\"p99.9\": %llu, \"max\": %llu, \"buckets\": [",
+			(unsigned long long)total,
+			(unsigned long long)(total > 0 ? min_value : 0),
+			total > 0 ? (double)sum / total : 0.0,
+			(unsigned long long)percentile(50),
+			(unsigned long long)percentile(90),
+			(unsigned long long)percentile(99),
+			(unsigned long long)percentile(99.9),
+			(unsigned long long)max_value);
+		for (size_t i = 0; i < counts.size(); i++) {
+			if (counts[i] == 0) {
+				continue;
+			}
+			fprintf(out, "%s[%llu, %llu]", first ? "" : ", ",
+				(unsigned long long)highest_equivalent(i),
+				(unsigned long long)counts[i]);
+			first = false;
+		}
+		fprintf(out, "]}");
+	}
+
+private:
+	/* Values in [sub << shift, (sub + 1) << shift) share a bucket. */
+	static size_t bucket_index(uint64_t value)
+	{
+		int shift = 0;
+
+		while ((value >> shift) >= HISTOGRAM_SUB_COUNT) {
+			shift++;
+		}
+		return shift * HISTOGRAM_HALF_COUNT + (value >> shift);
+	}
+
+	static uint64_t highest_equivalent(size_t index)
+	{
+		int shift = 0;
+
+		if (index >= HISTOGRAM_SUB_COUNT) {
+			shift = (index - HISTOGRAM_HALF_COUNT) /
+				HISTOGRAM_HALF_COUNT;
+		}
+		uint64_t sub = index - shift * HISTOGRAM_HALF_COUNT;
+		return ((sub + 1) << shift) - 1;
+	}
+
+	std::vector<uint64_t> counts;
+	uint64_t total;
+	uint64_t sum;
+	uint64_t min_value;
+	uint64_t max_value;
+};
+
+#endif /* TCTAR_HISTOGRAM_H */
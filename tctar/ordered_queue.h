@@ -0,0 +1,67 @@
+#ifndef TCTAR_ORDERED_QUEUE_H
+#define TCTAR_ORDERED_QUEUE_H
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+/*
+ * Reassembles items produced out of order by several threads.  Every item
+ * carries a sequence number, starting at 0 with no gaps, and pop() returns
+ * them strictly in sequence order.  push() blocks while its item is capacity
+ * or more ahead of the next one to be popped, so a slow producer holding up
+ * the sequence cannot make the others buffer without bound.  After close(),
+ * pop() returns false once the next item in sequence is missing.
+ */
+template <typename T> class ordered_queue
+{
+public:
+	explicit ordered_queue(size_t capacity)
+	    : capacity(capacity > 0 ? capacity : 1), next(0), closed(false)
+	{
+	}
+
+	void push(size_t seq, const T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cond.wait(lock, [this, seq] {
+			return closed || seq < next + capacity;
+		});
+		items[seq] = item;
+		cond.notify_all();
+	}
+
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cond.wait(lock, [this] {
+			return closed || items.count(next) > 0;
+		});
+		auto it = items.find(next);
+		if (it == items.end()) {
+			return false;
+		}
+		item = it->second;
+		items.erase(it);
+		next++;
+		cond.notify_all();
+		return true;
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		cond.notify_all();
+	}
+
+private:
+	const size_t capacity;
+	size_t next;
+	bool closed;
+	std::map<size_t, T> items;
+	std::mutex mutex;
+	std::condition_variable cond;
+};
+
+#endif /* TCTAR_ORDERED_QUEUE_H */
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <string.h>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "compound.h"
+#include "parallel_listdir.h"
+
+/*
+ * The top of the trees is expanded until there are SUBTREES_PER_THREAD
+ * subtrees per thread, so uneven subtrees still balance out, or until the
+ * expansion reaches MAX_SPLIT_DEPTH levels.
+ */
+#define SUBTREES_PER_THREAD 4
+#define MAX_SPLIT_DEPTH 3
+
+/* A listed entry, owning the strings its attributes refer to. */
+struct list_entry
+{
+	std::string path;
+	std::string dir;
+	struct tc_attrs attrs;
+};
+
+/*
+ * A directory at the top of the trees.  It is either expanded, with its
+ * entries listed and its subdirectories as children (NULL for other
+ * entries), or listed recursively by a task.
+ */
+struct list_node
+{
+	std::string path;
+	bool expanded;
+	int task;
+	std::vector<struct list_entry> entries;
+	std::vector<struct list_node *> children;
+};
+
+struct list_task
+{
+	std::string path;
+	std::vector<struct list_entry> entries;
+	tc_res res;
+	bool done;
+};
+
+/*
+ * Workers run tasks in order, at most window tasks ahead of the one being
+ * passed to the callback, which bounds the number of buffered entries.
+ */
+struct listing
+{
+	struct tc_attrs_masks masks;
+	std::vector<struct list_task> tasks;
+	size_t next;
+	size_t emitted;
+	size_t window;
+	bool stop;
+	tc_res res;
+	std::mutex mutex;
+	std::condition_variable cond;
+};
+
+static std::string strip_slashes(std::string path)
+{
+	while (path.size() > 1 && path[path.size() - 1] == '/') {
+		path.erase(path.size() - 1);
+	}
+	return path;
+}
+
+static std::string parent_of(const std::string &path)
+{
+	std::string stripped = strip_slashes(path);
+	size_t slash = stripped.rfind('/');
+
+	if (slash == std::string::npos) {
+		return ".";
+	}
+	return strip_slashes(stripped.substr(0, slash + 1));
+}
+
+static struct list_entry make_entry(const struct tc_attrs *attr,
+				    const char *dir)
+{
+	struct list_entry entry;
+
+	entry.path = attr->file.path;
+	entry.dir = dir != NULL ? dir : "";
+	entry.attrs = *attr;
+	return entry;
+}
+
+static bool collect_cb(const struct tc_attrs *attr, const char *dir,
+		       void *arg)
+{
+	std::vector<struct list_entry> *entries =
+	    (std::vector<struct list_entry> *)arg;
+
+	entries->push_back(make_entry(attr, dir));
+	return true;
+}
+
+/* Route entries of a multi-directory listing to the node they belong to. */
+static bool level_cb(const struct tc_attrs *attr, const char *dir, void *arg)
+{
+	std::map<std::string, struct list_node *> *nodes =
+	    (std::map<std::string, struct list_node *> *)arg;
+	auto it = nodes->end();
+
+	if (dir != NULL) {
+		it = nodes->find(strip_slashes(dir));
+	}
+	if (it == nodes->end()) {
+		it = nodes->find(parent_of(attr->file.path));
+	}
+	if (it == nodes->end()) {
+		printf("listdir: no parent for %s\n", attr->file.path);
+		return true;
+	}
+	it->second->entries.push_back(make_entry(attr, dir));
+	return true;
+}
+
+/* List all directories of one level of the frontier with one compound. */
+static tc_res expand_level(std::vector<struct list_node *> &frontier,
+			   struct tc_attrs_masks masks,
+			   std::vector<struct list_node *> &next)
+{
+	std::map<std::string, struct list_node *> nodes;
+	std::vector<const char *> paths;
+	tc_res res;
+
+	for (auto node : frontier) {
+		nodes[strip_slashes(node->path)] = node;
+		paths.push_back(node->path.c_str());
+	}
+	res = compound_listdirv(paths.data(), paths.size(), masks, 0, false,
+				level_cb, &nodes, false);
+	if (!tc_okay(res)) {
+		return res;
+	}
+	for (auto node : frontier) {
+		node->expanded = true;
+		for (auto &entry : node->entries) {
+			struct list_node *child = NULL;
+			if (S_ISDIR(entry.attrs.mode)) {
+				child = new list_node();
+				child->path = entry.path;
+				child->expanded = false;
+				child->task = -1;
+				next.push_back(child);
+			}
+			node->children.push_back(child);
+		}
+	}
+	return res;
+}
+
+/* Number tasks in the order their entries will be emitted. */
+static void assign_tasks(struct list_node *node, struct listing *l)
+{
+	if (!node->expanded) {
+		struct list_task task;
+		task.path = node->path;
+		task.res = { 0, 0 };
+		task.done = false;
+		node->task = l->tasks.size();
+		l->tasks.push_back(task);
+		return;
+	}
+	for (auto child : node->children) {
+		if (child != NULL) {
+			assign_tasks(child, l);
+		}
+	}
+}
+
+static void list_worker(struct listing *l)
+{
+	std::unique_lock<std::mutex> lock(l->mutex);
+
+	for (;;) {
+		l->cond.wait(lock, [l] {
+			return l->stop || l->next >= l->tasks.size() ||
+			       l->next < l->emitted + l->window;
+		});
+		if (l->stop || l->next >= l->tasks.size()) {
+			return;
+		}
+		struct list_task &task = l->tasks[l->next++];
+		lock.unlock();
+
+		const char *path = task.path.c_str();
+		tc_res res = compound_listdirv(&path, 1, l->masks, 0, true,
+					       collect_cb, &task.entries,
+					       false);
+
+		lock.lock();
+		task.res = res;
+		task.done = true;
+		l->cond.notify_all();
+	}
+}
+
+static bool emit_entries(std::vector<struct list_entry> &entries,
+			 parallel_listdir_cb cb, void *cbarg)
+{
+	for (auto &entry : entries) {
+		entry.attrs.file = tc_file_from_path(entry.path.c_str());
+		if (!cb(&entry.attrs, entry.dir.c_str(), cbarg)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool emit_task(struct listing *l, int index, parallel_listdir_cb cb,
+		      void *cbarg)
+{
+	struct list_task &task = l->tasks[index];
+	bool ok;
+
+	{
+		std::unique_lock<std::mutex> lock(l->mutex);
+		l->cond.wait(lock, [&task] { return task.done; });
+	}
+	if (!tc_okay(task.res)) {
+		printf("listdir: %s (%s)\n", strerror(task.res.err_no),
+		       task.path.c_str());
+		l->res = task.res;
+		return false;
+	}
+	ok = emit_entries(task.entries, cb, cbarg);
+	std::vector<struct list_entry>().swap(task.entries);
+
+	std::lock_guard<std::mutex> lock(l->mutex);
+	l->emitted++;
+	l->cond.notify_all();
+	return ok;
+}
+
+static bool emit_node(struct list_node *node, struct listing *l,
+		      parallel_listdir_cb cb, void *cbarg)
+{
+	if (!node->expanded) {
+		return emit_task(l, node->task, cb, cbarg);
+	}
+	for (size_t i = 0; i < node->entries.size(); i++) {
+		struct list_entry &entry = node->entries[i];
+		entry.attrs.file = tc_file_from_path(entry.path.c_str());
+		if (!cb(&entry.attrs, entry.dir.c_str(), cbarg)) {
+			return false;
+		}
+		if (node->children[i] != NULL &&
+		    !emit_node(node->children[i], l, cb, cbarg)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void free_node(struct list_node *node)
+{
+	for (auto child : node->children) {
+		if (child != NULL) {
+			free_node(child);
+		}
+	}
+	delete node;
+}
+
+tc_res parallel_listdirv(const char **dirs, int count,
+			 struct tc_attrs_masks masks, int nthreads,
+			 parallel_listdir_cb cb, void *cbarg)
+{
+	std::vector<struct list_node *> roots;
+	std::vector<struct list_node *> frontier;
+	std::vector<std::thread> workers;
+	struct listing l;
+	tc_res res = { 0, 0 };
+
+	if (nthreads <= 1) {
+		return compound_listdirv(dirs, count, masks, 0, true, cb,
+					 cbarg, false);
+	}
+
+	for (int i = 0; i < count; i++) {
+		struct list_node *root = new list_node();
+		root->path = dirs[i];
+		root->expanded = false;
+		root->task = -1;
+		roots.push_back(root);
+	}
+
+	frontier = roots;
+	for (int depth = 0; depth < MAX_SPLIT_DEPTH && !frontier.empty() &&
+			    frontier.size() < SUBTREES_PER_THREAD * nthreads;
+	     depth++) {
+		std::vector<struct list_node *> next;
+		res = expand_level(frontier, masks, next);
+		if (!tc_okay(res)) {
+			goto out;
+		}
+		frontier.swap(next);
+	}
+
+	l.masks = masks;
+	l.next = 0;
+	l.emitted = 0;
+	l.window = 2 * nthreads;
+	l.stop = false;
+	l.res = { 0, 0 };
+	for (auto root : roots) {
+		assign_tasks(root, &l);
+	}
+	for (int i = 0; i < nthreads; i++) {
+		workers.push_back(std::thread(list_worker, &l));
+	}
+
+	for (auto root : roots) {
+		if (!emit_node(root, &l, cb, cbarg)) {
+			break;
+		}
+	}
+	res = l.res;
+
+	{
+		std::lock_guard<std::mutex> lock(l.mutex);
+		l.stop = true;
+		l.cond.notify_all();
+	}
+	for (auto &worker : workers) {
+		worker.join();
+	}
+
+out:
+	for (auto root : roots) {
+		free_node(root);
+	}
+	return res;
+}
@@ -0,0 +1,25 @@
+#ifndef TCTAR_PARALLEL_LISTDIR_H
+#define TCTAR_PARALLEL_LISTDIR_H
+
+#include "tc_api.h"
+
+typedef bool (*parallel_listdir_cb)(const struct tc_attrs *entry,
+				    const char *dir, void *cbarg);
+
+/*
+ * Recursively list @dirs like tc_listdirv(), but split the work across
+ * @nthreads outstanding listdir compounds.
+ *
+ * The top levels of the trees are listed breadth-first, one compound per
+ * level, until there are enough subdirectories to keep every thread busy.
+ * Each of those subdirectories is then listed recursively by a worker.  @cb
+ * is always called from the calling thread and in a deterministic order:
+ * depth-first, with @dirs and the entries of each expanded directory in the
+ * order the server returned them.  Returning false from @cb stops the
+ * listing.
+ */
+tc_res parallel_listdirv(const char **dirs, int count,
+			 struct tc_attrs_masks masks, int nthreads,
+			 parallel_listdir_cb cb, void *cbarg);
+
+#endif /* TCTAR_PARALLEL_LISTDIR_H */
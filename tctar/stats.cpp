@@ -0,0 +1,151 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <thread>
+
+#include "histogram.h"
+#include "stats.h"
+#include "util.h"
+
+static const char *call_names[STATS_NCALLS] = {
+	"tc_listdirv", "tc_readv",    "tc_readlinkv", "tc_writev",
+	"tc_mkdirv",   "tc_symlinkv", "tc_hardlinkv", "tc_setattrsv",
+};
+
+struct call_stats
+{
+	uint64_t ops;
+	uint64_t bytes;
+	double seconds;
+	/* Wall time in microseconds and operations of each compound. */
+	histogram latency;
+	histogram ops_per_compound;
+};
+
+static struct
+{
+	std::mutex mutex;
+	struct call_stats calls[STATS_NCALLS];
+	uint64_t libarchive_calls;
+	double libarchive_seconds;
+	double start;
+	const char *path;
+} stats;
+
+/* Time the calling thread has spent in or waiting for compounds. */
+static thread_local double thread_io_time;
+
+void stats_record_compound(enum stats_call call, size_t ops, size_t bytes,
+			   double seconds)
+{
+	thread_io_time += seconds;
+
+	std::lock_guard<std::mutex> lock(stats.mutex);
+	struct call_stats &c = stats.calls[call];
+
+	c.ops += ops;
+	c.bytes += bytes;
+	c.seconds += seconds;
+	c.latency.record((uint64_t)(seconds * 1e6));
+	c.ops_per_compound.record(ops);
+}
+
+void stats_record_wait(double seconds)
+{
+	thread_io_time += seconds;
+}
+
+void stats_libarchive_begin(struct stats_timer *timer)
+{
+	timer->start = now_seconds();
+	timer->io_time = thread_io_time;
+}
+
+void stats_libarchive_end(struct stats_timer *timer)
+{
+	double elapsed = now_seconds() - timer->start;
+	double io_time = thread_io_time - timer->io_time;
+	std::lock_guard<std::mutex> lock(stats.mutex);
+
+	stats.libarchive_calls++;
+	stats.libarchive_seconds += std::max(elapsed - io_time, 0.0);
+}
+
+static void stats_dump(const char *path)
+{
+	FILE *out = stderr;
+
+	if (path != NULL && strcmp(path, "-") != 0) {
+		out = fopen(path, "w");
+		if (out == NULL) {
+			printf("stats: %s (%s)\n", strerror(errno), path);
+			return;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(stats.mutex);
+	fprintf(out, "{\n  \"elapsed_seconds\": %.6f,\n  \"calls\": {",
+		now_seconds() - stats.start);
+	for (int i = 0; i < STATS_NCALLS; i++) {
+		struct call_stats &c = stats.calls[i];
+		fprintf(out,
+			"%s\n    \"%s\": {\"compounds\": %llu, \"ops\": %llu, "
+			"\"bytes\": %llu, \"seconds\": %.6f,\n      "
+			"\"latency_us\": ",
+			i > 0 ? "," : "", call_names[i],
+			(unsigned long long)c.latency.count(),
+			(unsigned long long)c.ops, (unsigned long long)c.bytes,
+			c.seconds);
+		c.latency.print_json(out);
+		fprintf(out, ",\n      \"ops_per_compound\": ");
+		c.ops_per_compound.print_json(out);
+		fprintf(out, "}");
+	}
+	fprintf(out,
+		"\n  },\n  \"libarchive\": {\"calls\": %llu, "
+		"\"seconds\": %.6f}\n}\n",
+		(unsigned long long)stats.libarchive_calls,
+		stats.libarchive_seconds);
+	if (out != stderr) {
+		fclose(out);
+	} else {
+		fflush(out);
+	}
+}
+
+static void stats_atexit()
+{
+	stats_dump(stats.path);
+}
+
+/*
+ * SIGUSR1 is blocked in every thread and consumed here with sigwait(), so
+ * the dump runs in an ordinary thread rather than in a signal handler.
+ */
+static void signal_thread(sigset_t set)
+{
+	int sig;
+
+	while (sigwait(&set, &sig) == 0) {
+		stats_dump(stats.path);
+	}
+}
+
+void stats_init(const char *path)
+{
+	sigset_t set;
+
+	stats.start = now_seconds();
+	stats.path = path;
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	std::thread(signal_thread, set).detach();
+	if (path != NULL) {
+		atexit(stats_atexit);
+	}
+}
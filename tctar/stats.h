@@ -0,0 +1,54 @@
+#ifndef TCTAR_STATS_H
+#define TCTAR_STATS_H
+
+#include <stddef.h>
+
+/* The tc calls instrumented by the compound_*v() wrappers. */
+enum stats_call {
+	STATS_LISTDIRV,
+	STATS_READV,
+	STATS_READLINKV,
+	STATS_WRITEV,
+	STATS_MKDIRV,
+	STATS_SYMLINKV,
+	STATS_HARDLINKV,
+	STATS_SETATTRSV,
+	STATS_NCALLS,
+};
+
+/*
+ * Record one compound of @call carrying @ops operations and @bytes bytes of
+ * file data, which took @seconds of wall time on the calling thread.
+ */
+void stats_record_compound(enum stats_call call, size_t ops, size_t bytes,
+			   double seconds);
+
+/*
+ * Account for @seconds the calling thread spent blocked on compounds issued
+ * by another thread, such as a read-ahead buffer not yet filled.
+ */
+void stats_record_wait(double seconds);
+
+/*
+ * Time spent inside libarchive compressing or decompressing.  libarchive
+ * calls back into tctar/tcuntar for I/O, so the compounds issued and waited
+ * for by the thread between begin and end are not counted.
+ */
+struct stats_timer
+{
+	double start;
+	double io_time;
+};
+
+void stats_libarchive_begin(struct stats_timer *timer);
+void stats_libarchive_end(struct stats_timer *timer);
+
+/*
+ * Dump the statistics as JSON to @path ("-" for stderr) when the process
+ * exits, and to @path, or stderr if NULL, whenever it receives SIGUSR1.
+ * Must be called before any other thread is started, so that SIGUSR1 stays
+ * blocked everywhere but in the thread waiting for it.
+ */
+void stats_init(const char *path);
+
+#endif /* TCTAR_STATS_H */
@@ -1,4 +1,9 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <vector>
 #include <libgen.h>
 
@@ -9,59 +14,184 @@
 #include "tc_helper.h"
 #include "path_utils.h"
 
+#include "batch_policy.h"
+#include "bounded_queue.h"
+#include "compound.h"
+#include "compression_policy.h"
+#include "ordered_queue.h"
+#include "parallel_listdir.h"
+#include "stats.h"
+#include "util.h"
+
 #define DEFAULT_LOG_FILE "/tmp/libarchive-tctar.log"
 
-struct write_cbarg
+/*
+ * Upper bound on the file data held at once, shared by every batch that can
+ * hold data: those being read, those read and waiting for the writer, and
+ * the one being compressed.  Files larger than the chunk size are not read
+ * whole: they are split into chunk-sized ranges which are fetched by
+ * concurrent compounds and reassembled in order.
+ */
+#define DEFAULT_MEM_BUDGET (256UL * 1024 * 1024)
+#define DEFAULT_CHUNK_SIZE (4UL * 1024 * 1024)
+
+/* Number of batches each pipeline stage may run ahead of the next one. */
+#define DEFAULT_QUEUE_DEPTH 2
+
+/* Number of listdir compounds kept in flight while listing the sources. */
+#define DEFAULT_LIST_THREADS 4
+
+/* Number of tc_readv compounds kept in flight. */
+#define DEFAULT_READ_THREADS 4
+
+/*
+ * libarchive hands tc_archive_write() one bytes_per_block (10 KiB) block at a
+ * time.  Rather than copying each block into its own allocation, blocks are
+ * coalesced into OUTPUT_SEGMENTS preallocated segments of OUTPUT_SEGMENT_SIZE
+ * bytes, and one tc_writev is issued once all segments are full.
+ *
+ * The segments form one of OUTPUT_BUFFERS buffers.  Full buffers are written
+ * by the drain thread while libarchive compresses into the next one, so the
+ * compressor and the link work at the same time.  Buffers are reused across
+ * flushes.
+ */
+#define OUTPUT_SEGMENT_SIZE (4UL * 1024 * 1024)
+#define OUTPUT_SEGMENTS 8
+#define OUTPUT_BUFFERS 2
+
+struct output_buffer
 {
-	struct tc_iovec output_file;
-	std::vector<struct tc_iovec> writes;
+	char *data;
+	/* Archive offset of the first byte in data. */
+	size_t offset;
+	size_t filled;
 };
 
-ssize_t tc_archive_write(struct archive *a, void *client_data,
-			 const void *buffer, size_t length)
+struct write_cbarg
 {
-	struct write_cbarg *cbarg = (struct write_cbarg *)client_data;
-	struct tc_iovec *output_file = &cbarg->output_file;
-
-	char *data = (char *)malloc(length);
-	memcpy(data, buffer, length);
-
-	output_file->data = data;
-	output_file->length = length;
+	tc_file file;
+	/* Archive offset of the first byte in buf. */
+	size_t offset;
+	/* Bytes currently buffered, OUTPUT_SEGMENTS * OUTPUT_SEGMENT_SIZE max. */
+	size_t filled;
+	char *buf;
+	/* Full buffers for the drain thread and the empty ones it returns. */
+	bounded_queue<struct output_buffer> *to_drain;
+	bounded_queue<char *> *drained;
+	std::thread drainer;
+	compression_policy *compression;
+	/* Time the writer thread spent waiting for an empty buffer. */
+	double wait_seconds;
+	std::atomic<bool> failed;
+};
 
-	cbarg->writes.push_back(*output_file);
+static tc_res flush_output(tc_file file, const struct output_buffer *out)
+{
+	struct tc_iovec writes[OUTPUT_SEGMENTS];
+	tc_res res = { 0, 0 };
+	int count = 0;
 
-	if (cbarg->writes.size() >= 255) {
-		tc_res res = tc_writev(cbarg->writes.data(),
-				       cbarg->writes.size(), false);
+	for (size_t pos = 0; pos < out->filled; pos += OUTPUT_SEGMENT_SIZE) {
+		writes[count].file = file;
+		writes[count].offset = out->offset + pos;
+		writes[count].length =
+		    std::min(OUTPUT_SEGMENT_SIZE, out->filled - pos);
+		writes[count].data = out->data + pos;
+		writes[count].is_creation = true;
+		count++;
+	}
+	if (count > 0) {
+		res = compound_writev(writes, count, false);
 		if (!tc_okay(res)) {
 			printf("writev: %s\n", strerror(res.err_no));
-			return -1;
 		}
-		for (auto &write : cbarg->writes) {
-			free(write.data);
+	}
+	return res;
+}
+
+static void drain_thread(struct write_cbarg *cbarg)
+{
+	struct output_buffer out;
+
+	while (cbarg->to_drain->pop(out)) {
+		double start = now_seconds();
+		if (cbarg->failed || !tc_okay(flush_output(cbarg->file, &out))) {
+			cbarg->failed = true;
+		} else {
+			cbarg->compression->drained(out.filled,
+						    now_seconds() - start);
 		}
-		cbarg->writes.clear();
+		/* Failed buffers too, or the writer would wait for them. */
+		cbarg->drained->push(out.data);
 	}
+}
+
+/* Hand the current buffer to the drain thread and wait for an empty one. */
+static bool submit_output(struct write_cbarg *cbarg)
+{
+	struct output_buffer out = { cbarg->buf, cbarg->offset, cbarg->filled };
+	double start, wait;
 
-	output_file->offset += length;
+	if (cbarg->failed || !cbarg->to_drain->push(out)) {
+		return false;
+	}
+	cbarg->offset += cbarg->filled;
+	cbarg->filled = 0;
+	start = now_seconds();
+	cbarg->drained->pop(cbarg->buf);
+	wait = now_seconds() - start;
+	cbarg->wait_seconds += wait;
+	stats_record_wait(wait);
+	return !cbarg->failed;
+}
+
+ssize_t tc_archive_write(struct archive *a, void *client_data,
+			 const void *buffer, size_t length)
+{
+	struct write_cbarg *cbarg = (struct write_cbarg *)client_data;
+	const size_t capacity = OUTPUT_SEGMENTS * OUTPUT_SEGMENT_SIZE;
+	const char *p = (const char *)buffer;
+	size_t remaining = length;
+
+	while (remaining > 0) {
+		size_t n = std::min(remaining, capacity - cbarg->filled);
+		memcpy(cbarg->buf + cbarg->filled, p, n);
+		cbarg->filled += n;
+		p += n;
+		remaining -= n;
+		if (cbarg->filled == capacity && !submit_output(cbarg)) {
+			return -1;
+		}
+	}
 	return length;
 }
 
+/* Drain the last buffer, stop the drain thread and free the buffers. */
 int tc_archive_close(struct archive *a, void *client_data)
 {
 	struct write_cbarg *cbarg = (struct write_cbarg *)client_data;
+	struct output_buffer out = { cbarg->buf, cbarg->offset, cbarg->filled };
+	double start = now_seconds();
+	char *buf;
 
-	if (cbarg->writes.size() > 0) {
-		tc_res res = tc_writev(cbarg->writes.data(),
-				       cbarg->writes.size(), false);
-		if (!tc_okay(res)) {
-			printf("writev: %s\n", strerror(res.err_no));
-			return ARCHIVE_FATAL;
-		}
-		cbarg->writes.clear();
+	/* A failed open may already have closed, and main() closes again. */
+	if (!cbarg->drainer.joinable()) {
+		return cbarg->failed ? ARCHIVE_FATAL : ARCHIVE_OK;
 	}
-	return ARCHIVE_OK;
+	if (cbarg->filled > 0 && cbarg->to_drain->push(out)) {
+		cbarg->offset += cbarg->filled;
+		cbarg->filled = 0;
+		cbarg->buf = NULL;
+	}
+	cbarg->to_drain->close();
+	cbarg->drainer.join();
+	stats_record_wait(now_seconds() - start);
+	free(cbarg->buf);
+	cbarg->buf = NULL;
+	while (cbarg->drained->try_pop(buf)) {
+		free(buf);
+	}
+	return cbarg->failed ? ARCHIVE_FATAL : ARCHIVE_OK;
 }
 
 void deinit(int status, void *context)
@@ -69,129 +199,530 @@ void deinit(int status, void *context)
 	tc_deinit(context);
 }
 
+/* Default upper bound on the number of operations in one batch. */
+#define DEFAULT_MAX_OPS 255
+
+/*
+ * One archive entry, or one range of a large regular file, in a batch.  A
+ * file split into several ranges shares its entry between them: the header
+ * is written with the first range and the entry is freed after the last.
+ */
+struct batch_item
+{
+	struct archive_entry *entry;
+	size_t offset;
+	size_t length;
+	char *data;
+	bool first;
+	bool last;
+};
+
+/*
+ * Entries in archive order together with the buffer that backs the file
+ * data of all of their ranges.
+ */
+struct batch
+{
+	std::vector<struct batch_item> items;
+	size_t bytes;
+	char *buf;
+	/* When the first item was added. */
+	double opened;
+	/* Position in archive order. */
+	size_t seq;
+};
+
+/*
+ * tctar is a three-stage pipeline connected by queues: the listdir callback
+ * packs entries into batches, reader threads fill them with
+ * tc_readv/tc_readlinkv, and the writer thread feeds them to libarchive.
+ * While batch N is being compressed, the following batches are already on
+ * the wire, and so is the compressed output of the batches before it.
+ * Several batches, including consecutive ranges of one huge file, are read
+ * concurrently; to_write hands them to the writer in order.
+ */
 struct cbarg
 {
 	struct archive *a;
-	std::vector<struct archive_entry *> files;
-	std::vector<struct archive_entry *> symlinks;
+	struct write_cbarg *output;
+	struct archive_entry_linkresolver *resolver;
+	struct batch *current;
+	batch_policy *policy;
+	size_t chunk_size;
+	bounded_queue<struct batch *> *to_read;
+	ordered_queue<struct batch *> *to_write;
+	size_t next_seq;
+	std::atomic<bool> failed;
 };
 
-tc_res read_files_and_write_to_archive(
-    struct archive *a, std::vector<struct archive_entry *> &files,
-    std::vector<struct archive_entry *> &symlinks, int min_count)
+static struct batch *batch_new()
+{
+	struct batch *b = new batch();
+
+	b->bytes = 0;
+	b->buf = NULL;
+	b->opened = 0;
+	b->seq = 0;
+	return b;
+}
+
+static void batch_free(struct batch *b)
+{
+	for (auto &item : b->items) {
+		if (S_ISLNK(archive_entry_filetype(item.entry))) {
+			free(item.data);
+		}
+		if (item.last) {
+			archive_entry_free(item.entry);
+		}
+	}
+	free(b->buf);
+	delete b;
+}
+
+/* Hand the batch being built to the reader threads. */
+static bool submit_batch(struct cbarg *cbarg)
+{
+	struct batch *b = cbarg->current;
+
+	if (b->items.empty()) {
+		return true;
+	}
+	b->seq = cbarg->next_seq++;
+	cbarg->current = batch_new();
+	if (!cbarg->to_read->push(b)) {
+		batch_free(b);
+		return false;
+	}
+	return true;
+}
+
+static bool add_item(struct cbarg *cbarg, struct archive_entry *entry,
+		     size_t offset, size_t length, bool first, bool last)
 {
+	struct batch_item item;
+	double now = now_seconds();
 
+	if (!cbarg->current->items.empty() &&
+	    (cbarg->policy->full(cbarg->current->items.size() + 1,
+				 cbarg->current->bytes + length) ||
+	     (cbarg->to_read->empty() &&
+	      cbarg->policy->stale(cbarg->current->opened, now)))) {
+		if (!submit_batch(cbarg)) {
+			return false;
+		}
+	}
+	if (cbarg->current->items.empty()) {
+		cbarg->current->opened = now;
+	}
+	item.entry = entry;
+	item.offset = offset;
+	item.length = length;
+	item.data = NULL;
+	item.first = first;
+	item.last = last;
+	cbarg->current->items.push_back(item);
+	cbarg->current->bytes += length;
+	return true;
+}
+
+/*
+ * Files larger than the chunk size are split into chunk-sized ranges, so no
+ * batch ever holds more than its share of mem_budget in file data.
+ */
+static bool add_file(struct cbarg *cbarg, struct archive_entry *entry)
+{
+	size_t size = archive_entry_size(entry);
+	size_t offset = 0;
+
+	do {
+		size_t length = std::min(cbarg->chunk_size, size - offset);
+		if (!add_item(cbarg, entry, offset, length, offset == 0,
+			      offset + length == size)) {
+			return false;
+		}
+		offset += length;
+	} while (offset < size);
+	return true;
+}
+
+/*
+ * Read the file ranges of a batch with one tc_readv and its symlink targets
+ * with one tc_readlinkv.
+ */
+static tc_res read_batch(struct batch *b)
+{
+	std::vector<struct tc_iovec> reads;
+	std::vector<const char *> path_names;
+	std::vector<char *> bufs;
+	std::vector<size_t> bufsizes;
 	tc_res res = { 0, 0 };
-	const char **path_names;
-	struct tc_iovec *reads;
-
-	if (files.size() >= min_count) {
-		reads = (struct tc_iovec *)malloc(sizeof(struct tc_iovec) *
-						  files.size());
-		for (int i = 0; i < files.size(); i++) {
-			reads[i].file =
-			    tc_file_from_path(archive_entry_pathname(files[i]));
-			reads[i].offset = 0;
-			reads[i].length = archive_entry_size(files[i]);
-			reads[i].is_creation = false;
-			char *buf = (char *)malloc(reads[i].length);
-			reads[i].data = buf;
-		}
-		res = tc_readv(reads, files.size(), false);
+	size_t pos = 0;
+
+	b->buf = (char *)malloc(b->bytes > 0 ? b->bytes : 1);
+	for (auto &item : b->items) {
+		mode_t type = archive_entry_filetype(item.entry);
+		if (S_ISREG(type) && item.length > 0) {
+			struct tc_iovec iov;
+			item.data = b->buf + pos;
+			pos += item.length;
+			iov.file = tc_file_from_path(
+			    archive_entry_pathname(item.entry));
+			iov.offset = item.offset;
+			iov.length = item.length;
+			iov.data = item.data;
+			iov.is_creation = false;
+			reads.push_back(iov);
+		} else if (S_ISLNK(type)) {
+			item.data = (char *)malloc(sizeof(char) * PATH_MAX);
+			path_names.push_back(
+			    archive_entry_pathname(item.entry));
+			bufs.push_back(item.data);
+			bufsizes.push_back(PATH_MAX);
+		}
+	}
+
+	if (!reads.empty()) {
+		res = compound_readv(reads.data(), reads.size(), false);
 		if (!tc_okay(res)) {
 			printf("readv: %s\n", strerror(res.err_no));
 			return res;
 		}
-		for (int i = 0; i < files.size(); i++) {
-			archive_write_header(a, files[i]);
-			ssize_t w = archive_write_data(a, reads[i].data,
-						       reads[i].length);
-			if (w != reads[i].length) {
-				printf("could not write all data to archive\n");
+		/* A file that shrank while being read is zero-padded. */
+		auto iov = reads.begin();
+		for (auto &item : b->items) {
+			if (item.data != NULL && iov != reads.end() &&
+			    item.data == iov->data) {
+				item.length = (iov++)->length;
 			}
-			archive_entry_free(files[i]);
-			free(reads[i].data);
-		}
-		free(reads);
-		files.clear();
-	}
-	if (symlinks.size() >= min_count) {
-		path_names = (const char **)malloc(sizeof(const char *) *
-						   symlinks.size());
-		char **bufs = (char **)malloc(sizeof(char *) * symlinks.size());
-		size_t *bufsizes =
-		    (size_t *)malloc(sizeof(size_t) * symlinks.size());
-		for (int i = 0; i < symlinks.size(); i++) {
-			path_names[i] = archive_entry_pathname(symlinks[i]);
-			bufs[i] = (char *)malloc(sizeof(char) * PATH_MAX);
-			bufsizes[i] = PATH_MAX;
-		}
-		res = tc_readlinkv(path_names, bufs, bufsizes, symlinks.size(),
-				   false);
+		}
+	}
+	if (!path_names.empty()) {
+		res = compound_readlinkv(path_names.data(), bufs.data(),
+					 bufsizes.data(), path_names.size(),
+					 false);
 		if (!tc_okay(res)) {
 			printf("readlinkv: %s\n", strerror(res.err_no));
 			return res;
 		}
-		for (int i = 0; i < symlinks.size(); i++) {
-			archive_entry_set_symlink(symlinks[i], bufs[i]);
-			archive_write_header(a, symlinks[i]);
-			archive_entry_free(symlinks[i]);
-			free(bufs[i]);
+		for (auto &item : b->items) {
+			if (S_ISLNK(archive_entry_filetype(item.entry))) {
+				archive_entry_set_symlink(item.entry,
+							  item.data);
+			}
 		}
-		free(bufs);
-		free(bufsizes);
-		symlinks.clear();
 	}
 	return res;
 }
 
-bool listdir_callback(const struct tc_attrs *attr, const char *dir, void *arg)
+static void reader_thread(struct cbarg *cbarg)
 {
-	struct cbarg *cbarg = (struct cbarg *)arg;
-	struct archive_entry *entry = archive_entry_new();
+	struct batch *b;
+
+	while (cbarg->to_read->pop(b)) {
+		double start = now_seconds();
+		if (cbarg->failed || !tc_okay(read_batch(b))) {
+			cbarg->failed = true;
+		} else {
+			cbarg->policy->record(b->items.size(), b->bytes,
+					      now_seconds() - start);
+		}
+		/* Failed batches too, or the writer would wait for them. */
+		cbarg->to_write->push(b->seq, b);
+	}
+}
+
+/* Returns false if an entry could not be written, after saying why. */
+static bool write_batch(struct archive *a, struct batch *b)
+{
+	for (auto &item : b->items) {
+		if (item.first) {
+			int r = archive_write_header(a, item.entry);
+			if (r < ARCHIVE_OK) {
+				printf("%s: %s\n",
+				       archive_entry_pathname(item.entry),
+				       archive_error_string(a));
+			}
+			if (r < ARCHIVE_WARN) {
+				return false;
+			}
+		}
+		if (item.length > 0) {
+			ssize_t w = archive_write_data(a, item.data,
+						       item.length);
+			if (w != item.length) {
+				printf("could not write all data to archive\n");
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static void set_compression(struct archive *a, int level, int threads)
+{
+	char value[16];
 
+	snprintf(value, sizeof(value), "%d", level);
+	if (archive_write_set_filter_option(a, "xz", "compression-level",
+					    value) != ARCHIVE_OK) {
+		printf("compression-level: %s\n", archive_error_string(a));
+	}
+	snprintf(value, sizeof(value), "%d", threads);
+	if (archive_write_set_filter_option(a, "xz", "threads", value) !=
+	    ARCHIVE_OK) {
+		printf("threads: %s\n", archive_error_string(a));
+	}
+}
+
+/*
+ * Feed a batch to libarchive and report to the compression policy how much
+ * was compressed, and in how long, not counting the time spent waiting for
+ * the drain thread to return an empty output buffer.
+ */
+static void compress_batch(struct cbarg *cbarg, struct batch *b)
+{
+	struct archive *a = cbarg->a;
+	int64_t in = archive_filter_bytes(a, 0);
+	int64_t out = archive_filter_bytes(a, -1);
+	double wait = cbarg->output->wait_seconds;
+	double start = now_seconds();
+	int level, threads;
+
+	if (!write_batch(a, b)) {
+		cbarg->failed = true;
+	}
+	cbarg->output->compression->compressed(
+	    archive_filter_bytes(a, 0) - in, archive_filter_bytes(a, -1) - out,
+	    now_seconds() - start - (cbarg->output->wait_seconds - wait));
+	if (cbarg->output->compression->retune(&level, &threads)) {
+		set_compression(a, level, threads);
+	}
+}
+
+static void writer_thread(struct cbarg *cbarg)
+{
+	struct batch *b;
+
+	while (cbarg->to_write->pop(b)) {
+		if (!cbarg->failed) {
+			struct stats_timer timer;
+			stats_libarchive_begin(&timer);
+			compress_batch(cbarg, b);
+			stats_libarchive_end(&timer);
+		}
+		batch_free(b);
+	}
+}
+
+/*
+ * Copy the attributes returned by tc_listdirv into the archive entry, so no
+ * getattr round trip is needed to produce a complete header.
+ */
+static void fill_entry(struct archive_entry *entry,
+		       const struct tc_attrs *attr)
+{
 	archive_entry_copy_pathname(entry, attr->file.path);
 	archive_entry_set_size(entry, attr->size);
 	archive_entry_set_mode(entry, attr->mode);
-
-	if (S_ISDIR(attr->mode)) {
-		archive_write_header(cbarg->a, entry);
-		archive_entry_free(entry);
-	} else if (S_ISREG(attr->mode)) {
-		cbarg->files.push_back(entry);
-	} else if (S_ISLNK(attr->mode)) {
-		cbarg->symlinks.push_back(entry);
-	} else {
-		printf("unsupported file type\n");
+	if (attr->masks.has_uid) {
+		archive_entry_set_uid(entry, attr->uid);
+	}
+	if (attr->masks.has_gid) {
+		archive_entry_set_gid(entry, attr->gid);
+	}
+	if (attr->masks.has_mtime) {
+		archive_entry_set_mtime(entry, attr->mtime.tv_sec,
+					attr->mtime.tv_nsec);
+	}
+	if (attr->masks.has_atime) {
+		archive_entry_set_atime(entry, attr->atime.tv_sec,
+					attr->atime.tv_nsec);
+	}
+	if (attr->masks.has_ctime) {
+		archive_entry_set_ctime(entry, attr->ctime.tv_sec,
+					attr->ctime.tv_nsec);
 	}
+	if (attr->masks.has_nlink) {
+		archive_entry_set_nlink(entry, attr->nlink);
+	}
+	if (attr->masks.has_fileid) {
+		archive_entry_set_ino64(entry, attr->fileid);
+	}
+	if (attr->masks.has_rdev) {
+		archive_entry_set_rdev(entry, attr->rdev);
+	}
+}
 
-	if (!tc_okay(read_files_and_write_to_archive(cbarg->a, cbarg->files,
-						     cbarg->symlinks, 255))) {
-		printf("read_files_and_write_to_archive failed\n");
+bool listdir_callback(const struct tc_attrs *attr, const char *dir, void *arg)
+{
+	struct cbarg *cbarg = (struct cbarg *)arg;
+	struct archive_entry *entry;
+
+	if (cbarg->failed) {
 		return false;
 	}
 
+	entry = archive_entry_new();
+	fill_entry(entry, attr);
+
+	if (S_ISREG(attr->mode)) {
+		struct archive_entry *spare = NULL;
+		/*
+		 * Hard links are detected from the nlink and fileid returned
+		 * by the listing.  Later links to a file become hardlink
+		 * entries without data and are never read.
+		 */
+		archive_entry_linkify(cbarg->resolver, &entry, &spare);
+		if (archive_entry_hardlink(entry) != NULL) {
+			return add_item(cbarg, entry, 0, 0, true, true);
+		}
+		return add_file(cbarg, entry);
+	} else if (S_ISDIR(attr->mode) || S_ISLNK(attr->mode) ||
+		   S_ISCHR(attr->mode) || S_ISBLK(attr->mode) ||
+		   S_ISFIFO(attr->mode)) {
+		return add_item(cbarg, entry, 0, 0, true, true);
+	}
+
+	printf("unsupported file type\n");
+	archive_entry_free(entry);
 	return true;
 }
 
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [--no-compress] [--compression-level=N] "
+		"[--compress-threads=N] [--adaptive-compression] "
+		"[--mem-budget=SIZE] "
+		"[--chunk-size=SIZE] [--queue-depth=N] [--max-ops=N] "
+		"[--no-adaptive] [--list-threads=N] [--read-threads=N] "
+		"[--posix] [--inject-latency=USEC] [--stats] "
+		"[--stats-json=FILE] "
+		"<archive> <dir>...\n",
+		prog);
+	exit(1);
+}
+
 int main(int argc, char **argv)
 {
+	static const struct option long_options[] = {
+		{ "no-compress", no_argument, NULL, 'n' },
+		{ "compression-level", required_argument, NULL, 'z' },
+		{ "compress-threads", required_argument, NULL, 'T' },
+		{ "adaptive-compression", no_argument, NULL, 'a' },
+		{ "mem-budget", required_argument, NULL, 'm' },
+		{ "chunk-size", required_argument, NULL, 'c' },
+		{ "queue-depth", required_argument, NULL, 'q' },
+		{ "max-ops", required_argument, NULL, 'o' },
+		{ "no-adaptive", no_argument, NULL, 'A' },
+		{ "list-threads", required_argument, NULL, 'l' },
+		{ "read-threads", required_argument, NULL, 'R' },
+		{ "posix", no_argument, NULL, 'P' },
+		{ "inject-latency", required_argument, NULL, 'L' },
+		{ "stats", no_argument, NULL, 's' },
+		{ "stats-json", required_argument, NULL, 'j' },
+		{ NULL, 0, NULL, 0 },
+	};
 	char exe_path[PATH_MAX];
 	char tc_config_path[PATH_MAX];
+	bool posix = false;
 	void *context;
 	struct archive *a;
 	int r;
 	tc_res res;
-	struct cbarg *cbarg = (struct cbarg *)malloc(sizeof(struct cbarg));
-	struct write_cbarg *write_cbarg =
-	    (struct write_cbarg *)malloc(sizeof(struct write_cbarg));
+	int opt;
+	bool compress = true;
+	int level = COMPRESSION_MAX_LEVEL;
+	int compress_threads = 0;
+	bool adaptive_compression = false;
+	size_t mem_budget = DEFAULT_MEM_BUDGET;
+	size_t chunk_size = DEFAULT_CHUNK_SIZE;
+	int queue_depth = DEFAULT_QUEUE_DEPTH;
+	int max_ops = DEFAULT_MAX_OPS;
+	bool adaptive = true;
+	int list_threads = DEFAULT_LIST_THREADS;
+	int read_threads = DEFAULT_READ_THREADS;
+	bool print_stats = false;
+	const char *stats_path = NULL;
+	struct stats_timer timer;
+	size_t batch_bytes;
+	struct cbarg *cbarg = new struct cbarg();
+	struct write_cbarg *write_cbarg = new struct write_cbarg();
 
-	readlink("/proc/self/exe", exe_path, PATH_MAX);
-	snprintf(tc_config_path, PATH_MAX,
-		 "%s/../../../../config/tc.ganesha.conf", dirname(exe_path));
-	fprintf(stderr, "using config file: %s\n", tc_config_path);
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			compress = false;
+			break;
+		case 'z':
+			level = atoi(optarg);
+			break;
+		case 'T':
+			compress_threads = atoi(optarg);
+			break;
+		case 'a':
+			adaptive_compression = true;
+			break;
+		case 'm':
+			mem_budget = parse_size(optarg);
+			break;
+		case 'c':
+			chunk_size = parse_size(optarg);
+			break;
+		case 'q':
+			queue_depth = atoi(optarg);
+			break;
+		case 'o':
+			max_ops = atoi(optarg);
+			break;
+		case 'A':
+			adaptive = false;
+			break;
+		case 'l':
+			list_threads = atoi(optarg);
+			break;
+		case 'R':
+			read_threads = atoi(optarg);
+			break;
+		case 'P':
+			posix = true;
+			break;
+		case 'L':
+			compound_set_latency(strtoul(optarg, NULL, 10));
+			break;
+		case 's':
+			print_stats = true;
+			break;
+		case 'j':
+			stats_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind < 2 || mem_budget == 0 || chunk_size == 0 ||
+	    queue_depth <= 0 || max_ops <= 0 || list_threads <= 0 ||
+	    read_threads <= 0 || level < COMPRESSION_MIN_LEVEL ||
+	    level > COMPRESSION_MAX_LEVEL || compress_threads < 0) {
+		usage(argv[0]);
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
+	stats_init(stats_path);
+
+	/* Without a config file, tc runs on its local POSIX backend. */
+	if (posix) {
+		fprintf(stderr, "using the POSIX backend\n");
+	} else {
+		readlink("/proc/self/exe", exe_path, PATH_MAX);
+		snprintf(tc_config_path, PATH_MAX,
+			 "%s/../../../../config/tc.ganesha.conf",
+			 dirname(exe_path));
+		fprintf(stderr, "using config file: %s\n", tc_config_path);
+	}
 
-	context = tc_init(tc_config_path, DEFAULT_LOG_FILE, 77);
+	context = tc_init(posix ? NULL : tc_config_path, DEFAULT_LOG_FILE, 77);
 	if (!context) {
 		printf("initializing tc failed\n");
 		return 1;
@@ -201,48 +732,143 @@ int main(int argc, char **argv)
 			"warning: failed to register tc_deinit() on exit");
 	}
 
+	/*
+	 * The adaptive policy starts single-threaded at the given level and
+	 * may use up to --compress-threads threads, one per CPU by default.
+	 */
+	int threads = std::max(compress_threads, 1);
+	int max_threads = threads;
+	if (adaptive_compression) {
+		threads = 1;
+		if (compress_threads == 0) {
+			max_threads = std::thread::hardware_concurrency();
+		}
+	}
+	compression_policy compression(level, threads, max_threads,
+				       compress && adaptive_compression);
+
 	a = archive_write_new();
 	archive_write_set_format_ustar(a);
-	if (strcmp(argv[1], "--no-compress") == 0) {
-		argv++;
-	} else {
+	if (compress) {
 		archive_write_add_filter_xz(a);
+		set_compression(a, level, threads);
 	}
 
-	write_cbarg->output_file.file = tc_file_from_path(argv[1]);
-	write_cbarg->output_file.offset = 0;
-	write_cbarg->output_file.is_creation = true;
-	write_cbarg->writes = {};
+	bounded_queue<struct output_buffer> to_drain(OUTPUT_BUFFERS - 1);
+	bounded_queue<char *> drained(OUTPUT_BUFFERS);
+	const size_t capacity = OUTPUT_SEGMENTS * OUTPUT_SEGMENT_SIZE;
+	write_cbarg->file = tc_file_from_path(argv[1]);
+	write_cbarg->offset = 0;
+	write_cbarg->filled = 0;
+	write_cbarg->buf = (char *)malloc(capacity);
+	for (int i = 1; i < OUTPUT_BUFFERS; i++) {
+		drained.push((char *)malloc(capacity));
+	}
+	write_cbarg->to_drain = &to_drain;
+	write_cbarg->drained = &drained;
+	write_cbarg->compression = &compression;
+	write_cbarg->wait_seconds = 0;
+	write_cbarg->failed = false;
+	write_cbarg->drainer = std::thread(drain_thread, write_cbarg);
 
 	r = archive_write_open(a, write_cbarg, NULL, tc_archive_write,
 			       tc_archive_close);
 	if (r != ARCHIVE_OK) {
 		printf("error, could not open archive");
+		/* libarchive only calls the closer if the open got that far. */
+		tc_archive_close(a, write_cbarg);
+		archive_write_free(a);
+		delete write_cbarg;
+		delete cbarg;
 		return 1;
 	}
 
 	struct tc_attrs_masks listdir_mask = TC_ATTRS_MASK_NONE;
 	listdir_mask.has_mode = true;
 	listdir_mask.has_size = true;
+	listdir_mask.has_uid = true;
+	listdir_mask.has_gid = true;
+	listdir_mask.has_mtime = true;
+	listdir_mask.has_atime = true;
+	listdir_mask.has_ctime = true;
+	listdir_mask.has_nlink = true;
+	listdir_mask.has_fileid = true;
+	listdir_mask.has_rdev = true;
+	bounded_queue<struct batch *> to_read(queue_depth);
+	ordered_queue<struct batch *> to_write(queue_depth + read_threads);
 	cbarg->a = a;
-	cbarg->files = {};
-	cbarg->symlinks = {};
-	res = tc_listdirv((const char **)&argv[2], 1, listdir_mask, 0, true,
-			  listdir_callback, cbarg, false);
+	cbarg->output = write_cbarg;
+	cbarg->resolver = archive_entry_linkresolver_new();
+	archive_entry_linkresolver_set_strategy(cbarg->resolver,
+						archive_format(a));
+	cbarg->current = batch_new();
+	/*
+	 * Batches get their data when a reader picks them up and keep it until
+	 * the writer is done with them.  Up to read_threads are being read or
+	 * waiting to enter to_write, which holds up to its capacity, and one is
+	 * being compressed.
+	 */
+	batch_bytes = std::max(
+	    mem_budget / (2 * read_threads + queue_depth + 1), (size_t)1);
+	batch_policy policy(max_ops, batch_bytes, adaptive);
+	cbarg->policy = &policy;
+	cbarg->chunk_size = std::min(chunk_size, batch_bytes);
+	cbarg->to_read = &to_read;
+	cbarg->to_write = &to_write;
+	cbarg->next_seq = 0;
+	cbarg->failed = false;
+
+	std::vector<std::thread> readers;
+	for (int i = 0; i < read_threads; i++) {
+		readers.push_back(std::thread(reader_thread, cbarg));
+	}
+	std::thread writer(writer_thread, cbarg);
+	res = parallel_listdirv((const char **)&argv[2], argc - 2,
+				listdir_mask, list_threads, listdir_callback,
+				cbarg);
+	if (tc_okay(res) && !submit_batch(cbarg)) {
+		cbarg->failed = true;
+	}
+	to_read.close();
+	for (auto &reader : readers) {
+		reader.join();
+	}
+	to_write.close();
+	writer.join();
+	batch_free(cbarg->current);
+	archive_entry_linkresolver_free(cbarg->resolver);
+
+	/*
+	 * Free the archive even after a failure, as that stops the drain
+	 * thread, which may still be waiting on the queues above.
+	 */
+	stats_libarchive_begin(&timer);
+	r = archive_write_free(a);
+	stats_libarchive_end(&timer);
+	/*
+	 * libarchive skips the closer once a write has failed, and ignores
+	 * what it returns, so close again to join the drain thread and see
+	 * whether it could write everything.
+	 */
+	if (tc_archive_close(NULL, write_cbarg) != ARCHIVE_OK) {
+		r = ARCHIVE_FATAL;
+	}
+	bool failed = cbarg->failed;
+	delete write_cbarg;
+	delete cbarg;
 	if (!tc_okay(res)) {
 		printf("listdir: %s\n", strerror(res.err_no));
 		return res.err_no;
 	}
-	if (!tc_okay(read_files_and_write_to_archive(cbarg->a, cbarg->files,
-						     cbarg->symlinks, 1))) {
+	if (failed) {
+		printf("error, could not archive all files\n");
 		return 1;
 	}
-
-	r = archive_write_free(a);
-	free(write_cbarg);
-	free(cbarg);
 	if (r != ARCHIVE_OK) {
 		printf("error, could not free archive");
 		return 1;
 	}
+	if (print_stats) {
+		fprintf(stderr, "compounds: %lu\n", compound_count());
+	}
 }
@@ -1,4 +1,11 @@
+#include <errno.h>
 #include <stdio.h>
+#include <getopt.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 #include <libgen.h>
 
@@ -9,21 +16,227 @@
 #include "tc_helper.h"
 #include "path_utils.h"
 
+#include "batch_policy.h"
+#include "bounded_queue.h"
+#include "compound.h"
+#include "stats.h"
+#include "util.h"
+
 #define DEFAULT_LOG_FILE "/tmp/libarchive-tcuntar.log"
 
+/*
+ * Regular files are extracted as chunk-sized tc_iovec segments, so a large
+ * file never has to fit in memory.  mem_budget bounds the file data held at
+ * once, shared by the batch being filled, the chunk being assembled for it,
+ * the batch waiting for the writer and the one being written.
+ */
+#define DEFAULT_MEM_BUDGET (256UL * 1024 * 1024)
+#define DEFAULT_CHUNK_SIZE (4UL * 1024 * 1024)
+
+/* Default upper bound on the number of operations in one batch. */
+#define DEFAULT_MAX_OPS 255
+
+/* Operations queued for the next tc compounds. */
+struct batch
+{
+	std::vector<struct tc_attrs> directories;
+	std::vector<struct tc_iovec> writes;
+	size_t write_bytes;
+	std::vector<const char *> symlink_src_paths;
+	std::vector<const char *> symlink_dst_paths;
+	/* Hard links are created after the writes that create their targets. */
+	std::vector<const char *> hardlink_src_paths;
+	std::vector<const char *> hardlink_dst_paths;
+	/* Metadata of files whose data is complete, set after the writes. */
+	std::vector<struct tc_attrs> attrs;
+	double opened;
+};
+
+/*
+ * Decoding and I/O are double-buffered: the main thread decompresses into
+ * the current batch while the writer thread submits the previous one.
+ * Batches are submitted in order, and within a batch directories are created
+ * before any symlink or file, so a write never precedes its parent's mkdir.
+ */
+struct extract_state
+{
+	struct batch *current;
+	batch_policy *policy;
+	size_t chunk_size;
+	bounded_queue<struct batch *> *to_write;
+	std::atomic<bool> failed;
+	tc_res res;
+	bool restore_owner;
+	/*
+	 * Directory metadata is restored only after extraction finishes:
+	 * creating entries inside a directory would clobber its mtime, and
+	 * a read-only mode would make it impossible to fill.
+	 */
+	std::vector<struct tc_attrs> dir_fixups;
+	/*
+	 * Directories created or queued for creation so far.  Archives may
+	 * omit parent directories or list them after their contents, so
+	 * missing parents are synthesized into the mkdir batch before the
+	 * operations that need them.
+	 */
+	std::unordered_set<std::string> known_dirs;
+};
+
+/*
+ * tc_archive_read() serves libarchive from a ring of read_ahead buffers that
+ * a prefetch thread keeps filled.  Each prefetch compound reads consecutive
+ * ranges into all free buffers at once, so up to read_ahead requests are in
+ * flight while the decompressor works.  The request size starts at
+ * MIN_READ_SIZE and doubles after every full compound up to max_read_size;
+ * no skip or seek callback is registered, so the stream is always sequential.
+ */
+#define MIN_READ_SIZE (256UL * 1024)
+#define DEFAULT_MAX_READ_SIZE (8UL * 1024 * 1024)
+#define DEFAULT_READ_AHEAD 4
+
+struct read_buf
+{
+	char *data;
+	size_t length;
+};
+
+struct read_cbarg
+{
+	tc_file file;
+	/* Offset of the next range to prefetch. */
+	size_t offset;
+	size_t read_size;
+	size_t max_read_size;
+	int nbufs;
+	struct read_buf *bufs;
+	/* Buffer currently lent to libarchive. */
+	struct read_buf *current;
+	bounded_queue<struct read_buf *> *free_bufs;
+	bounded_queue<struct read_buf *> *ready_bufs;
+	std::thread prefetcher;
+	std::atomic<bool> failed;
+	bool print_stats;
+	/* Statistics: compounds issued, bytes read, time spent in tc_readv and
+	 * time libarchive spent waiting for data. */
+	size_t compounds;
+	size_t bytes;
+	double read_time;
+	double stall_time;
+};
+
+static void prefetch_thread(struct read_cbarg *cbarg)
+{
+	std::vector<struct read_buf *> bufs;
+	std::vector<struct tc_iovec> reads;
+	struct read_buf *buf;
+	bool eof = false;
+
+	while (!eof && cbarg->free_bufs->pop(buf)) {
+		bufs.assign(1, buf);
+		while (cbarg->free_bufs->try_pop(buf)) {
+			bufs.push_back(buf);
+		}
+		reads.clear();
+		for (size_t i = 0; i < bufs.size(); i++) {
+			struct tc_iovec iov;
+			iov.file = cbarg->file;
+			iov.offset = cbarg->offset + i * cbarg->read_size;
+			iov.length = cbarg->read_size;
+			iov.data = bufs[i]->data;
+			iov.is_creation = false;
+			iov.is_eof = false;
+			reads.push_back(iov);
+		}
+
+		double start = now_seconds();
+		tc_res res =
+		    compound_readv(reads.data(), reads.size(), false);
+		cbarg->read_time += now_seconds() - start;
+		cbarg->compounds++;
+		if (!tc_okay(res)) {
+			printf("readv: %s\n", strerror(res.err_no));
+			cbarg->failed = true;
+			break;
+		}
+
+		for (size_t i = 0; i < bufs.size() && !eof; i++) {
+			bufs[i]->length = reads[i].length;
+			cbarg->offset += reads[i].length;
+			cbarg->bytes += reads[i].length;
+			eof = reads[i].is_eof ||
+			      reads[i].length < cbarg->read_size;
+			cbarg->ready_bufs->push(bufs[i]);
+		}
+		cbarg->read_size =
+		    std::min(cbarg->read_size * 2, cbarg->max_read_size);
+	}
+	cbarg->ready_bufs->close();
+}
+
 ssize_t tc_archive_read(struct archive *a, void *client_data, const void **buff)
 {
+	struct read_cbarg *cbarg = (struct read_cbarg *)client_data;
+	struct read_buf *buf;
 
-	struct tc_iovec *input_file = (tc_iovec *)client_data;
+	/* libarchive is done with the buffer returned by the previous call. */
+	if (cbarg->current != NULL) {
+		cbarg->free_bufs->push(cbarg->current);
+		cbarg->current = NULL;
+	}
 
-	tc_res res = tc_readv(input_file, 1, false);
-	if (!tc_okay(res)) {
-		printf("readv: %s\n", strerror(res.err_no));
-		return res.err_no;
+	double start = now_seconds();
+	if (!cbarg->ready_bufs->pop(buf)) {
+		return cbarg->failed ? ARCHIVE_FATAL : 0;
 	}
-	*buff = input_file->data;
-	input_file->offset += input_file->length;
-	return input_file->length;
+	double stall = now_seconds() - start;
+	cbarg->stall_time += stall;
+	stats_record_wait(stall);
+
+	cbarg->current = buf;
+	*buff = buf->data;
+	return buf->length;
+}
+
+int tc_archive_open(struct archive *a, void *client_data)
+{
+	struct read_cbarg *cbarg = (struct read_cbarg *)client_data;
+
+	for (int i = 0; i < cbarg->nbufs; i++) {
+		cbarg->bufs[i].data = (char *)malloc(cbarg->max_read_size);
+		cbarg->free_bufs->push(&cbarg->bufs[i]);
+	}
+	cbarg->prefetcher = std::thread(prefetch_thread, cbarg);
+	return ARCHIVE_OK;
+}
+
+int tc_archive_close(struct archive *a, void *client_data)
+{
+	struct read_cbarg *cbarg = (struct read_cbarg *)client_data;
+
+	cbarg->free_bufs->close();
+	cbarg->ready_bufs->close();
+	/* Closing again, after a failed open has already closed, is a no-op. */
+	if (!cbarg->prefetcher.joinable()) {
+		return ARCHIVE_OK;
+	}
+	cbarg->prefetcher.join();
+	for (int i = 0; i < cbarg->nbufs; i++) {
+		free(cbarg->bufs[i].data);
+		cbarg->bufs[i].data = NULL;
+	}
+
+	if (cbarg->print_stats && cbarg->compounds > 0) {
+		fprintf(stderr,
+			"read-ahead: %zu compounds, %.1f MiB, "
+			"%.2f ms/compound, %.1f MiB/s, decoder waited %.3f s\n",
+			cbarg->compounds, cbarg->bytes / 1048576.0,
+			cbarg->read_time * 1000 / cbarg->compounds,
+			cbarg->read_time > 0
+			    ? cbarg->bytes / 1048576.0 / cbarg->read_time
+			    : 0.0,
+			cbarg->stall_time);
+	}
+	return ARCHIVE_OK;
 }
 
 void deinit(int status, void *context)
@@ -31,24 +244,39 @@ void deinit(int status, void *context)
 	tc_deinit(context);
 }
 
-tc_res performTCIO(std::vector<struct tc_attrs> &directories,
-		   std::vector<struct tc_iovec> &writes,
-		   std::vector<const char *> &symlink_src_paths,
-		   std::vector<const char *> &symlink_dst_paths, int min_count)
+tc_res performTCIO(struct batch &batch)
 {
 	tc_res res = { 0, 0 };
+	std::vector<struct tc_attrs> &directories = batch.directories;
+	std::vector<struct tc_iovec> &writes = batch.writes;
+	std::vector<const char *> &symlink_src_paths = batch.symlink_src_paths;
+	std::vector<const char *> &symlink_dst_paths = batch.symlink_dst_paths;
 
+	/*
+	 * A compound stops at its first failing operation.  Directories that
+	 * already exist, such as synthesized parents outside the archive, are
+	 * skipped and the rest of the batch is resubmitted.
+	 */
 	auto make_dirs = [](std::vector<struct tc_attrs> &directories) {
 		tc_res res = { 0, 0 };
-		if (directories.size() > 0) {
-			res = tc_mkdirv(directories.data(), directories.size(),
-					false);
-			if (!tc_okay(res)) {
+		size_t done = 0;
+		while (done < directories.size()) {
+			res = compound_mkdirv(&directories[done],
+					      directories.size() - done,
+					      false);
+			if (tc_okay(res)) {
+				break;
+			}
+			if (res.err_no != EEXIST) {
 				printf("mkdirv: %s (%s)\n",
 				       strerror(res.err_no),
-				       directories[res.index].file.path);
+				       directories[done + res.index].file.path);
 				return res;
 			}
+			done += res.index + 1;
+			res = { 0, 0 };
+		}
+		if (directories.size() > 0) {
 			for (auto &dir : directories) {
 				free((char *)dir.file.path);
 			}
@@ -57,21 +285,21 @@ tc_res performTCIO(std::vector<struct tc_attrs> &directories,
 		return res;
 	};
 
-	if (directories.size() >= min_count) {
+	if (directories.size() > 0) {
 		res = make_dirs(directories);
 		if (!tc_okay(res)) {
 			return res;
 		}
 	}
 
-	if (symlink_src_paths.size() >= min_count) {
+	if (symlink_src_paths.size() > 0) {
 		res = make_dirs(directories);
 		if (!tc_okay(res)) {
 			return res;
 		}
-		res = tc_symlinkv(symlink_src_paths.data(),
-				  symlink_dst_paths.data(),
-				  symlink_src_paths.size(), false);
+		res = compound_symlinkv(symlink_src_paths.data(),
+					symlink_dst_paths.data(),
+					symlink_src_paths.size(), false);
 		if (!tc_okay(res)) {
 			printf("symlinkv: %s (%s)\n", strerror(res.err_no),
 			       symlink_src_paths[res.index]);
@@ -87,12 +315,12 @@ tc_res performTCIO(std::vector<struct tc_attrs> &directories,
 		symlink_dst_paths.clear();
 	}
 
-	if (writes.size() >= min_count) {
+	if (writes.size() > 0) {
 		res = make_dirs(directories);
 		if (!tc_okay(res)) {
 			return res;
 		}
-		res = tc_writev(writes.data(), writes.size(), false);
+		res = compound_writev(writes.data(), writes.size(), false);
 		if (!tc_okay(res)) {
 			printf("writev: %s\n", strerror(res.err_no));
 			return res;
@@ -102,33 +330,485 @@ tc_res performTCIO(std::vector<struct tc_attrs> &directories,
 			free(iovec.data);
 		}
 		writes.clear();
+		batch.write_bytes = 0;
+	}
+
+	if (batch.hardlink_src_paths.size() > 0) {
+		res = make_dirs(directories);
+		if (!tc_okay(res)) {
+			return res;
+		}
+		res = compound_hardlinkv(batch.hardlink_src_paths.data(),
+					 batch.hardlink_dst_paths.data(),
+					 batch.hardlink_src_paths.size(),
+					 false);
+		if (!tc_okay(res)) {
+			printf("hardlinkv: %s (%s)\n", strerror(res.err_no),
+			       batch.hardlink_dst_paths[res.index]);
+			return res;
+		}
+		for (auto &s : batch.hardlink_src_paths) {
+			free((char *)s);
+		}
+		for (auto &s : batch.hardlink_dst_paths) {
+			free((char *)s);
+		}
+		batch.hardlink_src_paths.clear();
+		batch.hardlink_dst_paths.clear();
+	}
+
+	if (batch.attrs.size() > 0) {
+		res = compound_setattrsv(batch.attrs.data(),
+					 batch.attrs.size(), false);
+		if (!tc_okay(res)) {
+			printf("setattrsv: %s (%s)\n", strerror(res.err_no),
+			       batch.attrs[res.index].file.path);
+			return res;
+		}
+		for (auto &attrs : batch.attrs) {
+			free((char *)attrs.file.path);
+		}
+		batch.attrs.clear();
 	}
 
 	return res;
 }
 
+/* The metadata of an archive entry that has to be set after creating it. */
+static struct tc_attrs entry_fixup(struct archive_entry *entry,
+				   bool restore_owner)
+{
+	struct tc_attrs attrs;
+
+	attrs.file = tc_file_from_path(strdup(archive_entry_pathname(entry)));
+	attrs.masks = TC_ATTRS_MASK_NONE;
+	attrs.masks.has_mode = true;
+	attrs.mode = archive_entry_mode(entry) & 07777;
+	if (restore_owner) {
+		attrs.masks.has_uid = true;
+		attrs.uid = archive_entry_uid(entry);
+		attrs.masks.has_gid = true;
+		attrs.gid = archive_entry_gid(entry);
+	}
+	if (archive_entry_mtime_is_set(entry)) {
+		attrs.masks.has_mtime = true;
+		attrs.mtime.tv_sec = archive_entry_mtime(entry);
+		attrs.mtime.tv_nsec = archive_entry_mtime_nsec(entry);
+	}
+	if (archive_entry_atime_is_set(entry)) {
+		attrs.masks.has_atime = true;
+		attrs.atime.tv_sec = archive_entry_atime(entry);
+		attrs.atime.tv_nsec = archive_entry_atime_nsec(entry);
+	}
+	return attrs;
+}
+
+static int path_depth(const char *path)
+{
+	int depth = 0;
+
+	for (; *path != '\0'; path++) {
+		if (*path == '/' && path[1] != '\0') {
+			depth++;
+		}
+	}
+	return depth;
+}
+
+/*
+ * Restore directory metadata deepest-first, so setting a directory's mtime
+ * happens after everything below it has been touched, in setattr compounds
+ * of up to @max_ops directories.
+ */
+static tc_res apply_dir_fixups(std::vector<struct tc_attrs> &fixups,
+			       size_t max_ops)
+{
+	tc_res res = { 0, 0 };
+
+	std::stable_sort(fixups.begin(), fixups.end(),
+			 [](const struct tc_attrs &a, const struct tc_attrs &b) {
+				 return path_depth(a.file.path) >
+					path_depth(b.file.path);
+			 });
+	for (size_t i = 0; i < fixups.size(); i += max_ops) {
+		size_t count = std::min(max_ops, fixups.size() - i);
+		res = compound_setattrsv(&fixups[i], count, false);
+		if (!tc_okay(res)) {
+			printf("setattrsv: %s (%s)\n", strerror(res.err_no),
+			       fixups[i + res.index].file.path);
+			return res;
+		}
+	}
+	for (auto &attrs : fixups) {
+		free((char *)attrs.file.path);
+	}
+	fixups.clear();
+	return res;
+}
+
+static struct batch *batch_new()
+{
+	struct batch *batch = new struct batch();
+
+	batch->write_bytes = 0;
+	batch->opened = now_seconds();
+	return batch;
+}
+
+static size_t batch_ops(struct batch *batch)
+{
+	return batch->directories.size() + batch->writes.size() +
+	       batch->symlink_src_paths.size() +
+	       batch->hardlink_src_paths.size() + batch->attrs.size();
+}
+
+static void writer_thread(struct extract_state *state)
+{
+	struct batch *batch;
+
+	while (state->to_write->pop(batch)) {
+		if (!state->failed) {
+			size_t ops = batch_ops(batch);
+			size_t bytes = batch->write_bytes;
+			double start = now_seconds();
+			tc_res res = performTCIO(*batch);
+			if (!tc_okay(res)) {
+				state->res = res;
+				state->failed = true;
+			}
+			state->policy->record(ops, bytes,
+					      now_seconds() - start);
+		}
+		delete batch;
+	}
+}
+
+/*
+ * Hand the current batch to the writer thread once the batch policy considers
+ * it full, or unconditionally if @force is set.
+ */
+static tc_res submit_batch(struct extract_state *state, bool force)
+{
+	struct batch *batch = state->current;
+	size_t ops = batch_ops(batch);
+	tc_res res = { 0, 0 };
+
+	if (state->failed) {
+		return state->res;
+	}
+	if (ops == 0 ||
+	    (!force && !state->policy->full(ops + 1, batch->write_bytes) &&
+	     !(state->to_write->empty() &&
+	       state->policy->stale(batch->opened, now_seconds())))) {
+		return res;
+	}
+	state->current = batch_new();
+	if (!state->to_write->push(batch)) {
+		delete batch;
+		res.err_no = EIO;
+	}
+	return res;
+}
+
+static void queue_mkdir(struct extract_state *state, const std::string &path)
+{
+	struct tc_attrs dir;
+
+	dir.file = tc_file_from_path(strdup(path.c_str()));
+	dir.masks = TC_ATTRS_MASK_NONE;
+	dir.masks.has_mode = true;
+	dir.mode = 0755;
+	state->current->directories.push_back(dir);
+	state->known_dirs.insert(path);
+}
+
+/* Strip trailing slashes and a leading "./". */
+static std::string normalize_path(const char *pathname)
+{
+	std::string path = pathname;
+
+	while (path.size() > 1 && path[path.size() - 1] == '/') {
+		path.erase(path.size() - 1);
+	}
+	while (path.compare(0, 2, "./") == 0) {
+		path.erase(0, 2);
+	}
+	return path;
+}
+
+/* Queue a mkdir for every ancestor of @path not known to exist yet. */
+static void ensure_parents(struct extract_state *state,
+			   const std::string &path)
+{
+	for (size_t slash = path.find('/', 1); slash != std::string::npos;
+	     slash = path.find('/', slash + 1)) {
+		std::string parent = path.substr(0, slash);
+		if (parent == "." || parent == ".." ||
+		    parent[parent.size() - 1] == '/' ||
+		    state->known_dirs.count(parent) > 0) {
+			continue;
+		}
+		queue_mkdir(state, parent);
+	}
+}
+
+static int next_header(struct archive *a, struct archive_entry **entry)
+{
+	struct stats_timer timer;
+	int r;
+
+	stats_libarchive_begin(&timer);
+	r = archive_read_next_header(a, entry);
+	stats_libarchive_end(&timer);
+	return r;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [--mem-budget=SIZE] [--chunk-size=SIZE] "
+		"[--read-ahead=N] [--max-read-size=SIZE] [--max-ops=N] "
+		"[--no-adaptive] [--[no-]same-owner] [--posix] "
+		"[--inject-latency=USEC] [--stats] [--stats-json=FILE] "
+		"<archive>\n",
+		prog);
+	exit(1);
+}
+
+/*
+ * Queue the data of the current entry as writes of up to chunk_size bytes,
+ * flushing the pending writes whenever they reach the memory budget.
+ *
+ * The data comes from archive_read_data_block(), which skips the holes of
+ * sparse entries, so only the data extents are sent; contiguous blocks are
+ * coalesced into one write.  The size set along with the metadata then
+ * extends the file over a trailing hole, and also cuts off whatever an
+ * older, longer file left past the end.
+ *
+ * A read error is returned like a tc error, with the errno libarchive
+ * reported, so that extraction stops instead of leaving the file short.
+ */
+static tc_res queue_file_data(struct archive *a, struct archive_entry *entry,
+			      struct extract_state *state)
+{
+	size_t size = archive_entry_size(entry);
+	struct tc_iovec pending;
+	size_t capacity = 0;
+	bool created = false;
+	tc_res res = { 0, 0 };
+
+	memset(&pending, 0, sizeof(pending));
+	auto queue_pending = [&]() {
+		/* Send the batch first if the chunk would take it past its
+		 * share of the budget. */
+		if (state->current->write_bytes > 0 &&
+		    state->policy->full(0, state->current->write_bytes +
+					       pending.length)) {
+			tc_res res = submit_batch(state, true);
+			if (!tc_okay(res)) {
+				return res;
+			}
+		}
+		struct batch &batch = *state->current;
+
+		pending.file =
+		    tc_file_from_path(strdup(archive_entry_pathname(entry)));
+		pending.is_creation = !created;
+		created = true;
+		batch.writes.push_back(pending);
+		batch.write_bytes += pending.length;
+		pending.data = NULL;
+		pending.length = 0;
+		return submit_batch(state, false);
+	};
+
+	for (;;) {
+		const void *block;
+		size_t length;
+		int64_t offset;
+
+		struct stats_timer timer;
+		stats_libarchive_begin(&timer);
+		int r = archive_read_data_block(a, &block, &length, &offset);
+		stats_libarchive_end(&timer);
+		if (r == ARCHIVE_EOF) {
+			break;
+		}
+		if (r < ARCHIVE_WARN) {
+			fprintf(stderr, "error: %s (%s)\n",
+				archive_error_string(a),
+				archive_entry_pathname(entry));
+			free(pending.data);
+			res.err_no = archive_errno(a) > 0 ? archive_errno(a)
+							  : EIO;
+			return res;
+		}
+
+		while (length > 0 && tc_okay(res)) {
+			if (pending.data != NULL &&
+			    (offset != pending.offset + pending.length ||
+			     pending.length == capacity)) {
+				res = queue_pending();
+				if (!tc_okay(res)) {
+					break;
+				}
+			}
+			if (pending.data == NULL) {
+				capacity = std::min(state->chunk_size,
+						    std::max(size, (size_t)offset +
+								       length) -
+							offset);
+				pending.data = (char *)malloc(capacity);
+				pending.offset = offset;
+			}
+			size_t n = std::min(length, capacity - pending.length);
+			memcpy(pending.data + pending.length, block, n);
+			pending.length += n;
+			block = (const char *)block + n;
+			offset += n;
+			length -= n;
+		}
+		if (!tc_okay(res)) {
+			free(pending.data);
+			return res;
+		}
+	}
+
+	/* An empty or entirely sparse file is created by an empty write. */
+	if (pending.data != NULL || !created) {
+		if (pending.data == NULL) {
+			pending.data = (char *)malloc(1);
+			pending.offset = 0;
+		}
+		res = queue_pending();
+		if (!tc_okay(res)) {
+			free(pending.data);
+			return res;
+		}
+	}
+
+	struct tc_attrs attrs = entry_fixup(entry, state->restore_owner);
+	attrs.masks.has_size = true;
+	attrs.size = size;
+	state->current->attrs.push_back(attrs);
+	return submit_batch(state, false);
+}
+
 int main(int argc, char **argv)
 {
+	static const struct option long_options[] = {
+		{ "mem-budget", required_argument, NULL, 'm' },
+		{ "chunk-size", required_argument, NULL, 'c' },
+		{ "read-ahead", required_argument, NULL, 'r' },
+		{ "max-read-size", required_argument, NULL, 'x' },
+		{ "max-ops", required_argument, NULL, 'o' },
+		{ "no-adaptive", no_argument, NULL, 'A' },
+		{ "same-owner", no_argument, NULL, 'O' },
+		{ "no-same-owner", no_argument, NULL, 'N' },
+		{ "posix", no_argument, NULL, 'P' },
+		{ "inject-latency", required_argument, NULL, 'L' },
+		{ "stats", no_argument, NULL, 's' },
+		{ "stats-json", required_argument, NULL, 'j' },
+		{ NULL, 0, NULL, 0 },
+	};
 	char exe_path[PATH_MAX];
 	char tc_config_path[PATH_MAX];
+	bool posix = false;
 	void *context;
 	struct archive *a;
 	struct archive_entry *entry;
 	int r;
-	tc_res res;
-	struct tc_iovec *input_file =
-	    (tc_iovec *)malloc(sizeof(struct tc_iovec));
-	std::vector<struct tc_attrs> directories;
-	std::vector<struct tc_iovec> writes;
-	std::vector<const char *> symlink_src_paths;
-	std::vector<const char *> symlink_dst_paths;
+	tc_res res = { 0, 0 };
+	int opt;
+	size_t mem_budget = DEFAULT_MEM_BUDGET;
+	size_t chunk_size = DEFAULT_CHUNK_SIZE;
+	int read_ahead = DEFAULT_READ_AHEAD;
+	size_t max_read_size = DEFAULT_MAX_READ_SIZE;
+	int max_ops = DEFAULT_MAX_OPS;
+	bool adaptive = true;
+	bool print_stats = false;
+	const char *stats_path = NULL;
+	/* Like tar, only restore ownership by default when running as root. */
+	bool restore_owner = (geteuid() == 0);
+	struct read_cbarg *read_cbarg = new struct read_cbarg();
+	struct extract_state *state = new struct extract_state();
 
-	readlink("/proc/self/exe", exe_path, PATH_MAX);
-	snprintf(tc_config_path, PATH_MAX,
-		 "%s/../../../../config/tc.ganesha.conf", dirname(exe_path));
-	fprintf(stderr, "using config file: %s\n", tc_config_path);
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'm':
+			mem_budget = parse_size(optarg);
+			break;
+		case 'c':
+			chunk_size = parse_size(optarg);
+			break;
+		case 'r':
+			read_ahead = atoi(optarg);
+			break;
+		case 'x':
+			max_read_size = parse_size(optarg);
+			break;
+		case 'o':
+			max_ops = atoi(optarg);
+			break;
+		case 'A':
+			adaptive = false;
+			break;
+		case 'O':
+			restore_owner = true;
+			break;
+		case 'N':
+			restore_owner = false;
+			break;
+		case 'P':
+			posix = true;
+			break;
+		case 'L':
+			compound_set_latency(strtoul(optarg, NULL, 10));
+			break;
+		case 's':
+			print_stats = true;
+			break;
+		case 'j':
+			stats_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1 || mem_budget == 0 || chunk_size == 0 ||
+	    read_ahead <= 0 || max_read_size == 0 || max_ops <= 0) {
+		usage(argv[0]);
+	}
+	argv += optind - 1;
+	stats_init(stats_path);
+	bounded_queue<struct batch *> to_write(1);
+	state->current = batch_new();
+	/*
+	 * A batch is never filled past batch_bytes, and up to three hold data
+	 * at once: the one being filled, the one in to_write and the one being
+	 * written.  The chunk being assembled for the first one takes the
+	 * fourth share.
+	 */
+	size_t batch_bytes = std::max(mem_budget / 4, (size_t)1);
+	batch_policy policy(max_ops, batch_bytes, adaptive);
+	state->policy = &policy;
+	state->chunk_size = std::min(chunk_size, batch_bytes);
+	state->to_write = &to_write;
+	state->failed = false;
+	state->restore_owner = restore_owner;
 
-	context = tc_init(tc_config_path, DEFAULT_LOG_FILE, 77);
+	/* Without a config file, tc runs on its local POSIX backend. */
+	if (posix) {
+		fprintf(stderr, "using the POSIX backend\n");
+	} else {
+		readlink("/proc/self/exe", exe_path, PATH_MAX);
+		snprintf(tc_config_path, PATH_MAX,
+			 "%s/../../../../config/tc.ganesha.conf",
+			 dirname(exe_path));
+		fprintf(stderr, "using config file: %s\n", tc_config_path);
+	}
+
+	context = tc_init(posix ? NULL : tc_config_path, DEFAULT_LOG_FILE, 77);
 	if (!context) {
 		printf("initializing tc failed\n");
 		return 1;
@@ -138,73 +818,113 @@ int main(int argc, char **argv)
 			"warning: failed to register tc_deinit() on exit");
 	}
 
-	const int read_size = 1024 * 1024;
-	input_file->file = tc_file_from_path(argv[1]);
-	input_file->offset = 0;
-	input_file->length = read_size;
-	input_file->data = (char *)malloc(read_size);
+	bounded_queue<struct read_buf *> free_bufs(read_ahead);
+	bounded_queue<struct read_buf *> ready_bufs(read_ahead);
+	read_cbarg->file = tc_file_from_path(argv[1]);
+	read_cbarg->offset = 0;
+	read_cbarg->read_size = std::min(MIN_READ_SIZE, max_read_size);
+	read_cbarg->max_read_size = max_read_size;
+	read_cbarg->nbufs = read_ahead;
+	read_cbarg->bufs = new struct read_buf[read_ahead];
+	read_cbarg->current = NULL;
+	read_cbarg->free_bufs = &free_bufs;
+	read_cbarg->ready_bufs = &ready_bufs;
+	read_cbarg->failed = false;
+	read_cbarg->print_stats = print_stats;
 
 	a = archive_read_new();
 	archive_read_support_filter_all(a);
 	archive_read_support_format_all(a);
-	r = archive_read_open(a, input_file, NULL, tc_archive_read, NULL);
+	r = archive_read_open(a, read_cbarg, tc_archive_open, tc_archive_read,
+			      tc_archive_close);
 	if (r != ARCHIVE_OK) {
 		printf("error, could not open archive");
+		/* Stops the prefetch thread, which waits on the queues above. */
+		archive_read_free(a);
+		delete[] read_cbarg->bufs;
+		delete read_cbarg;
+		delete state->current;
+		delete state;
 		return 1;
 	}
-	while (archive_read_next_header(a, &entry) == ARCHIVE_OK) {
+
+	std::thread writer(writer_thread, state);
+	while ((r = next_header(a, &entry)) == ARCHIVE_OK ||
+	       r == ARCHIVE_WARN) {
+		if (r == ARCHIVE_WARN) {
+			fprintf(stderr, "warning: %s (%s)\n",
+				archive_error_string(a),
+				archive_entry_pathname(entry));
+		}
 		mode_t type = archive_entry_filetype(entry);
-		if (S_ISDIR(type)) {
-			struct tc_attrs dir;
-			dir.file = tc_file_from_path(
+		std::string path = normalize_path(archive_entry_pathname(entry));
+
+		ensure_parents(state, path);
+		if (archive_entry_hardlink(entry) != NULL) {
+			state->current->hardlink_src_paths.push_back(
+			    strdup(archive_entry_hardlink(entry)));
+			state->current->hardlink_dst_paths.push_back(
 			    strdup(archive_entry_pathname(entry)));
-			dir.masks = TC_ATTRS_MASK_NONE;
-			dir.masks.has_mode = true;
-			dir.mode = 0755;
-			directories.push_back(dir);
+		} else if (S_ISDIR(type)) {
+			if (state->known_dirs.count(path) == 0) {
+				queue_mkdir(state, path);
+			}
+			state->dir_fixups.push_back(
+			    entry_fixup(entry, state->restore_owner));
 		} else if (S_ISREG(type)) {
-			size_t size = archive_entry_size(entry);
-			void *buff = malloc(size);
-			struct tc_iovec iovec;
-
-			r = archive_read_data(a, buff, size);
-			if (r != size) {
-				printf("error: r != size\n");
+			res = queue_file_data(a, entry, state);
+			if (!tc_okay(res)) {
+				break;
 			}
-
-			iovec.file = tc_file_from_path(
-			    strdup(archive_entry_pathname(entry)));
-			iovec.is_creation = true;
-			iovec.offset = 0;
-			iovec.length = size;
-			iovec.data = (char *)buff;
-			writes.push_back(iovec);
 		} else if (S_ISLNK(type)) {
-			symlink_src_paths.push_back(
+			state->current->symlink_src_paths.push_back(
 			    strdup(archive_entry_symlink(entry)));
-			symlink_dst_paths.push_back(
+			state->current->symlink_dst_paths.push_back(
 			    strdup(archive_entry_pathname(entry)));
 		} else {
 			printf("unhandled type: %s\n",
 			       archive_entry_pathname(entry));
 		}
 
-		res = performTCIO(directories, writes, symlink_src_paths,
-				  symlink_dst_paths, 255);
+		res = submit_batch(state, false);
 		if (!tc_okay(res)) {
-			return res.err_no;
+			break;
 		}
 	}
 
-	res = performTCIO(directories, writes, symlink_src_paths,
-			  symlink_dst_paths, 0);
-	if (!tc_okay(res)) {
-		return res.err_no;
+	if (tc_okay(res) && r != ARCHIVE_EOF) {
+		fprintf(stderr, "error: %s\n", archive_error_string(a));
+		res.err_no = archive_errno(a) > 0 ? archive_errno(a) : EIO;
+	}
+	if (tc_okay(res)) {
+		res = submit_batch(state, true);
+	}
+	to_write.close();
+	writer.join();
+	if (state->failed) {
+		res = state->res;
+	}
+	if (tc_okay(res)) {
+		res = apply_dir_fixups(state->dir_fixups, max_ops);
 	}
 
+	/*
+	 * Free the archive before returning on any error, as that stops the
+	 * prefetch thread, which may still be waiting on the queues above.
+	 */
 	r = archive_read_free(a);
+	delete[] read_cbarg->bufs;
+	delete read_cbarg;
+	delete state->current;
+	delete state;
+	if (!tc_okay(res)) {
+		return res.err_no;
+	}
 	if (r != ARCHIVE_OK) {
 		printf("error, could not free archive");
 		return 1;
 	}
+	if (print_stats) {
+		fprintf(stderr, "compounds: %lu\n", compound_count());
+	}
 }
@@ -0,0 +1,35 @@
+#ifndef TCTAR_UTIL_H
+#define TCTAR_UTIL_H
+
+#include <stdlib.h>
+#include <time.h>
+
+/* Parse a byte count with an optional K, M or G suffix. */
+static inline size_t parse_size(const char *arg)
+{
+	char *end;
+	size_t size = strtoull(arg, &end, 10);
+
+	switch (*end) {
+	case 'G': case 'g':
+		size *= 1024;
+		/* FALLTHROUGH */
+	case 'M': case 'm':
+		size *= 1024;
+		/* FALLTHROUGH */
+	case 'K': case 'k':
+		size *= 1024;
+	}
+	return size;
+}
+
+/* Monotonic wall-clock time in seconds. */
+static inline double now_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif /* TCTAR_UTIL_H */